@@ -127,6 +127,19 @@ void ColorScheme::freeScheme(int scheme)
   schemes_.erase(scheme);
 }
 
+MemoryUsage ColorScheme::getMemoryUsage() const
+{
+  MemoryUsage usage;
+  for (const Schemes::value_type &scheme : schemes_) {
+    usage.add(sizeof(scheme));
+    usage.objects += scheme.second.size();
+    usage.bytes += scheme.second.size() * sizeof(Properties::value_type);
+  }
+  usage.objects += pairs_.size();
+  usage.bytes += pairs_.size() * sizeof(ColorPairs::value_type);
+  return usage;
+}
+
 void ColorScheme::clear()
 {
   schemes_.clear();
@@ -148,6 +161,8 @@ const char *ColorScheme::propertyToWidgetName(int property)
     return "horizontalline";
   case PROPERTY_LABEL_TEXT:
     return "label";
+  case PROPERTY_LISTVIEW_TEXT:
+    return "listview";
   case PROPERTY_PANEL_LINE:
   case PROPERTY_PANEL_TITLE:
     return "panel";
@@ -181,6 +196,7 @@ const char *ColorScheme::propertyToPropertyName(int property)
   case PROPERTY_TREEVIEW_LINE:
     return "line";
   case PROPERTY_LABEL_TEXT:
+  case PROPERTY_LISTVIEW_TEXT:
   case PROPERTY_TEXTEDIT_TEXT:
   case PROPERTY_TEXTVIEW_TEXT:
     return "text";
@@ -244,6 +260,20 @@ ColorScheme::PropertyConversionResult ColorScheme::stringPairToPropertyPair(
     }
     return CONVERSION_ERROR_PROPERTY;
   }
+  else if (std::strcmp(widget, "listview") == 0) {
+    if (std::strcmp(property, "text") == 0) {
+      *out_property = PROPERTY_LISTVIEW_TEXT;
+      return CONVERSION_SUCCESS;
+    }
+
+    // Handle text_<number> properties.
+    if (std::strncmp(property, "text_", 5) != 0 ||
+      !stringToSubproperty(property + 5, out_subproperty))
+      return CONVERSION_ERROR_PROPERTY;
+
+    *out_property = PROPERTY_LISTVIEW_TEXT;
+    return CONVERSION_SUCCESS;
+  }
   else if (std::strcmp(widget, "panel") == 0) {
     if (std::strcmp(property, "line") == 0) {
       *out_property = PROPERTY_PANEL_LINE;
@@ -277,20 +307,10 @@ ColorScheme::PropertyConversionResult ColorScheme::stringPairToPropertyPair(
     if (std::strncmp(property, "text_", 5) != 0 &&
       std::strncmp(property, "color", 5) != 0)
       return CONVERSION_ERROR_PROPERTY;
-    property += 5;
-
-    if (!std::isdigit((unsigned char)*property))
-      return CONVERSION_ERROR_PROPERTY;
-
-    char *endptr;
-    errno = 0;
-    long i = std::strtol(property, &endptr, 10);
-    assert(i >= 0);
-    if (*endptr != '\0' || errno == ERANGE || i > INT_MAX)
+    if (!stringToSubproperty(property + 5, out_subproperty))
       return CONVERSION_ERROR_PROPERTY;
 
     *out_property = PROPERTY_TEXTVIEW_TEXT;
-    *out_subproperty = i;
     return CONVERSION_SUCCESS;
   }
   else if (std::strcmp(widget, "verticalline") == 0) {
@@ -309,6 +329,24 @@ ColorScheme::PropertyConversionResult ColorScheme::stringPairToPropertyPair(
   return CONVERSION_ERROR_WIDGET;
 }
 
+bool ColorScheme::stringToSubproperty(const char *str, int *out_subproperty)
+{
+  assert(out_subproperty != nullptr);
+
+  if (!std::isdigit((unsigned char)*str))
+    return false;
+
+  char *endptr;
+  errno = 0;
+  long i = std::strtol(str, &endptr, 10);
+  assert(i >= 0);
+  if (*endptr != '\0' || errno == ERANGE || i > INT_MAX)
+    return false;
+
+  *out_subproperty = i;
+  return true;
+}
+
 } // namespace CppConsUI
 
 // vim: set tabstop=2 shiftwidth=2 textwidth=80 expandtab:
@@ -64,6 +64,7 @@ public:
     PROPERTY_CONTAINER_BACKGROUND,
     PROPERTY_HORIZONTALLINE_LINE,
     PROPERTY_LABEL_TEXT,
+    PROPERTY_LISTVIEW_TEXT,
     PROPERTY_PANEL_LINE,
     PROPERTY_PANEL_TITLE,
     PROPERTY_TEXTEDIT_TEXT,
@@ -99,6 +100,9 @@ public:
   void freeScheme(int scheme);
   const Schemes &getSchemes() const { return schemes_; }
 
+  /// Returns memory held by the color scheme and color pair tables.
+  MemoryUsage getMemoryUsage() const;
+
   void clear();
 
   static const char *propertyToWidgetName(int property);
@@ -117,6 +121,9 @@ private:
   ~ColorScheme() {}
   CONSUI_DISABLE_COPY(ColorScheme);
 
+  /// Converts a number in the <property>_<number> string form.
+  static bool stringToSubproperty(const char *str, int *out_subproperty);
+
   friend void initializeConsUI(AppInterface &interface);
   friend void finalizeConsUI();
 };
@@ -130,6 +130,30 @@ struct Rect : public Point, public Size {
   int getBottom() const { return y + height - 1; }
 };
 
+/// Approximate amount of memory held by a group of objects. Only the payload
+/// is counted, overhead of the allocator and of container nodes is not
+/// included.
+struct MemoryUsage {
+  MemoryUsage() : objects(0), bytes(0) {}
+
+  /// Accounts one object of a given size.
+  void add(std::size_t size)
+  {
+    ++objects;
+    bytes += size;
+  }
+
+  MemoryUsage &operator+=(const MemoryUsage &other)
+  {
+    objects += other.objects;
+    bytes += other.bytes;
+    return *this;
+  }
+
+  std::size_t objects;
+  std::size_t bytes;
+};
+
 struct AppInterface {
   sigc::slot<void> redraw;
   sigc::slot<void, const char *> logDebug;
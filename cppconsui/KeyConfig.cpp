@@ -89,6 +89,17 @@ bool KeyConfig::stringToTermKey(const char *key, TermKeyKey *termkey) const
   return res != nullptr && res[0] == '\0';
 }
 
+MemoryUsage KeyConfig::getMemoryUsage() const
+{
+  MemoryUsage usage;
+  for (const KeyBinds::value_type &context : binds_) {
+    usage.add(sizeof(context) + context.first.capacity());
+    for (const KeyBindContext::value_type &key_action : context.second)
+      usage.add(sizeof(key_action) + key_action.second.capacity());
+  }
+  return usage;
+}
+
 void KeyConfig::clear()
 {
   binds_.clear();
@@ -116,6 +127,14 @@ void KeyConfig::loadDefaultKeyConfig()
 
   bindKey("coremanager", "redraw-screen", "Ctrl-l");
 
+  bindKey("listview", "cursor-up", "Up");
+  bindKey("listview", "cursor-down", "Down");
+  bindKey("listview", "cursor-page-up", "PageUp");
+  bindKey("listview", "cursor-page-down", "PageDown");
+  bindKey("listview", "cursor-begin", "Home");
+  bindKey("listview", "cursor-end", "End");
+  bindKey("listview", "activate", "Enter");
+
   bindKey("textentry", "cursor-right", "Right");
   bindKey("textentry", "cursor-left", "Left");
   bindKey("textentry", "cursor-down", "Down");
@@ -68,6 +68,9 @@ public:
   /// Returns all key binds.
   const KeyBinds *getKeyBinds() const { return &binds_; }
 
+  /// Returns memory held by the key binding tables.
+  MemoryUsage getMemoryUsage() const;
+
   /// Returns all key binds for a given context.
   const KeyBindContext *getKeyBinds(const char *context) const;
 
@@ -29,7 +29,8 @@
 namespace CppConsUI {
 
 ListBox::ListBox(int w, int h)
-  : AbstractListBox(w, h), children_height_(0), autosize_children_count_(0)
+  : AbstractListBox(w, h), children_height_(0), autosize_children_count_(0),
+    update_level_(0), update_area_pending_(false)
 {
   // Allow fast focus changing (paging) using PageUp/PageDown keys.
   page_focus_ = true;
@@ -75,8 +76,30 @@ void ListBox::appendWidget(Widget &widget)
   insertWidget(children_.size(), widget);
 }
 
+void ListBox::beginUpdate()
+{
+  ++update_level_;
+}
+
+void ListBox::endUpdate()
+{
+  assert(update_level_ > 0);
+
+  if (--update_level_ > 0 || !update_area_pending_)
+    return;
+
+  update_area_pending_ = false;
+  updateArea();
+  signal_children_height_change(*this, children_height_);
+}
+
 void ListBox::updateArea()
 {
+  if (update_level_ > 0) {
+    update_area_pending_ = true;
+    return;
+  }
+
   int autosize_height = 1;
   int autosize_height_extra = 0;
   if (autosize_children_count_ && children_height_ < real_height_) {
@@ -210,7 +233,8 @@ void ListBox::updateChildren(
 
   // Reposition all child widgets.
   updateArea();
-  signal_children_height_change(*this, children_height_);
+  if (update_level_ == 0)
+    signal_children_height_change(*this, children_height_);
 }
 
 } // namespace CppConsUI
@@ -43,6 +43,14 @@ public:
 
   virtual int getChildrenHeight() const { return children_height_; };
 
+  /// Postpones repositioning of child widgets until endUpdate() is called.
+  /// Use it when a large number of widgets is inserted or removed. Calls can be
+  /// nested.
+  virtual void beginUpdate();
+
+  /// Repositions child widgets once the outermost update ends.
+  virtual void endUpdate();
+
   sigc::signal<void, ListBox &, int> signal_children_height_change;
 
 protected:
@@ -52,6 +60,12 @@ protected:
   /// Number of visible children that has their height set to AUTOSIZE.
   int autosize_children_count_;
 
+  /// Nesting level of beginUpdate() calls.
+  int update_level_;
+
+  /// Flag whether children need to be repositioned when the update ends.
+  bool update_area_pending_;
+
   // Widget
   virtual void updateArea() override;
 
@@ -0,0 +1,273 @@
+// Copyright (C) 2016 Petr Pavlu <setup@dagobah.cz>
+//
+// This file is part of CenterIM.
+//
+// CenterIM is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// CenterIM is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with CenterIM.  If not, see <http://www.gnu.org/licenses/>.
+
+/// @file
+/// ListView class implementation.
+///
+/// @ingroup cppconsui
+
+#include "ListView.h"
+
+#include "ColorScheme.h"
+
+#include <cassert>
+
+namespace CppConsUI {
+
+ListView::ListView(int w, int h, ListModel *model)
+  : Widget(w, h), model_(nullptr), view_top_(0), cursor_(0)
+{
+  can_focus_ = true;
+  declareBindables();
+
+  setModel(model);
+}
+
+ListView::~ListView()
+{
+  disconnectModel();
+}
+
+int ListView::draw(Curses::ViewPort area, Error &error)
+{
+  DRAW(area.erase(error));
+
+  std::size_t count = getRowCount();
+  if (count == 0)
+    return 0;
+
+  updateViewTop();
+
+  // Only the visible rows are queried from the model.
+  for (int j = 0; j < real_height_ && view_top_ + j < count; ++j) {
+    std::size_t row = view_top_ + j;
+
+    int attrs;
+    DRAW(getAttributes(ColorScheme::PROPERTY_LISTVIEW_TEXT,
+      model_->getRowColor(row), &attrs, error));
+    if (has_focus_ && row == cursor_) {
+      attrs |= Curses::Attr::REVERSE;
+      DRAW(area.fill(attrs, 0, j, real_width_, 1, error));
+    }
+
+    DRAW(area.attrOn(attrs, error));
+    DRAW(area.addString(0, j, real_width_, model_->getRowText(row), error));
+    DRAW(area.attrOff(attrs, error));
+  }
+
+  return 0;
+}
+
+void ListView::setModel(ListModel *new_model)
+{
+  disconnectModel();
+
+  model_ = new_model;
+  view_top_ = cursor_ = 0;
+
+  if (model_ != nullptr) {
+    rows_inserted_conn_ = model_->signal_rows_inserted.connect(
+      sigc::mem_fun(this, &ListView::onRowsInserted));
+    rows_removed_conn_ = model_->signal_rows_removed.connect(
+      sigc::mem_fun(this, &ListView::onRowsRemoved));
+    rows_changed_conn_ = model_->signal_rows_changed.connect(
+      sigc::mem_fun(this, &ListView::onRowsChanged));
+    reset_conn_ =
+      model_->signal_reset.connect(sigc::mem_fun(this, &ListView::onReset));
+  }
+
+  redraw();
+}
+
+void ListView::setCursor(std::size_t row)
+{
+  std::size_t count = getRowCount();
+  if (count == 0)
+    return;
+
+  assert(row < count);
+
+  cursor_ = row;
+  updateViewTop();
+  redraw();
+}
+
+std::size_t ListView::getRowCount() const
+{
+  return model_ != nullptr ? model_->getRowCount() : 0;
+}
+
+void ListView::updateViewTop()
+{
+  std::size_t count = getRowCount();
+  if (count == 0 || real_height_ <= 0) {
+    view_top_ = 0;
+    return;
+  }
+
+  if (cursor_ >= count)
+    cursor_ = count - 1;
+
+  std::size_t height = real_height_;
+  if (cursor_ < view_top_)
+    view_top_ = cursor_;
+  else if (cursor_ >= view_top_ + height)
+    view_top_ = cursor_ - height + 1;
+
+  // Do not leave an empty space at the bottom if it can be filled.
+  if (count >= height && view_top_ > count - height)
+    view_top_ = count - height;
+}
+
+void ListView::onRowsInserted(std::size_t first, std::size_t count)
+{
+  // Keep the cursor and the view on the same rows. If the model was empty
+  // before then the cursor stays on the first row.
+  if (getRowCount() > count && first <= cursor_)
+    cursor_ += count;
+  if (first < view_top_)
+    view_top_ += count;
+
+  redraw();
+}
+
+void ListView::onRowsRemoved(std::size_t first, std::size_t count)
+{
+  if (cursor_ >= first + count)
+    cursor_ -= count;
+  else if (cursor_ >= first)
+    cursor_ = first;
+
+  if (view_top_ >= first + count)
+    view_top_ -= count;
+  else if (view_top_ > first)
+    view_top_ = first;
+
+  // The cursor and the view are clamped by updateViewTop() during the next
+  // draw.
+  redraw();
+}
+
+void ListView::onRowsChanged(std::size_t first, std::size_t count)
+{
+  // Redraw only if any of the changed rows is visible.
+  if (first < view_top_ + real_height_ && first + count > view_top_)
+    redraw();
+}
+
+void ListView::onReset()
+{
+  view_top_ = cursor_ = 0;
+  redraw();
+}
+
+void ListView::disconnectModel()
+{
+  rows_inserted_conn_.disconnect();
+  rows_removed_conn_.disconnect();
+  rows_changed_conn_.disconnect();
+  reset_conn_.disconnect();
+}
+
+void ListView::actionMoveCursor(int direction)
+{
+  std::size_t count = getRowCount();
+  if (count == 0)
+    return;
+
+  if (direction < 0) {
+    if (cursor_ == 0)
+      return;
+    --cursor_;
+  }
+  else {
+    if (cursor_ + 1 >= count)
+      return;
+    ++cursor_;
+  }
+
+  updateViewTop();
+  redraw();
+}
+
+void ListView::actionMoveCursorPage(int direction)
+{
+  std::size_t count = getRowCount();
+  if (count == 0)
+    return;
+
+  std::size_t s = real_height_ > 1 ? real_height_ - 1 : 1;
+  if (direction < 0)
+    cursor_ = cursor_ > s ? cursor_ - s : 0;
+  else
+    cursor_ = cursor_ + s < count ? cursor_ + s : count - 1;
+
+  updateViewTop();
+  redraw();
+}
+
+void ListView::actionCursorBegin()
+{
+  if (getRowCount() == 0)
+    return;
+
+  setCursor(0);
+}
+
+void ListView::actionCursorEnd()
+{
+  std::size_t count = getRowCount();
+  if (count == 0)
+    return;
+
+  setCursor(count - 1);
+}
+
+void ListView::actionActivate()
+{
+  if (cursor_ < getRowCount())
+    signal_activate(*this, cursor_);
+}
+
+void ListView::declareBindables()
+{
+  declareBindable("listview", "cursor-up",
+    sigc::bind(sigc::mem_fun(this, &ListView::actionMoveCursor), -1),
+    InputProcessor::BINDABLE_NORMAL);
+  declareBindable("listview", "cursor-down",
+    sigc::bind(sigc::mem_fun(this, &ListView::actionMoveCursor), 1),
+    InputProcessor::BINDABLE_NORMAL);
+  declareBindable("listview", "cursor-page-up",
+    sigc::bind(sigc::mem_fun(this, &ListView::actionMoveCursorPage), -1),
+    InputProcessor::BINDABLE_NORMAL);
+  declareBindable("listview", "cursor-page-down",
+    sigc::bind(sigc::mem_fun(this, &ListView::actionMoveCursorPage), 1),
+    InputProcessor::BINDABLE_NORMAL);
+  declareBindable("listview", "cursor-begin",
+    sigc::mem_fun(this, &ListView::actionCursorBegin),
+    InputProcessor::BINDABLE_NORMAL);
+  declareBindable("listview", "cursor-end",
+    sigc::mem_fun(this, &ListView::actionCursorEnd),
+    InputProcessor::BINDABLE_NORMAL);
+  declareBindable("listview", "activate",
+    sigc::mem_fun(this, &ListView::actionActivate),
+    InputProcessor::BINDABLE_NORMAL);
+}
+
+} // namespace CppConsUI
+
+// vim: set tabstop=2 shiftwidth=2 textwidth=80 expandtab:
@@ -0,0 +1,135 @@
+// Copyright (C) 2016 Petr Pavlu <setup@dagobah.cz>
+//
+// This file is part of CenterIM.
+//
+// CenterIM is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// CenterIM is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with CenterIM.  If not, see <http://www.gnu.org/licenses/>.
+
+/// @file
+/// ListModel and ListView classes.
+///
+/// @ingroup cppconsui
+
+#ifndef LISTVIEW_H
+#define LISTVIEW_H
+
+#include "Widget.h"
+
+namespace CppConsUI {
+
+/// Abstract source of rows displayed by ListView.
+///
+/// The model is queried only for rows that are currently visible. An
+/// implementation has to emit the change signals after its data is modified so
+/// all attached views can update their state.
+class ListModel {
+public:
+  ListModel() {}
+  virtual ~ListModel() {}
+
+  /// Returns count of all rows.
+  virtual std::size_t getRowCount() const = 0;
+
+  /// Returns UTF-8 encoded text of a specified row. The returned string has to
+  /// stay valid at least until the next call of any model method.
+  virtual const char *getRowText(std::size_t row) const = 0;
+
+  /// Returns color number of a specified row. Zero means the default color.
+  virtual int getRowColor(std::size_t /*row*/) const { return 0; }
+
+  /// Emitted after rows <first, first + count) are inserted.
+  sigc::signal<void, std::size_t, std::size_t> signal_rows_inserted;
+
+  /// Emitted after rows <first, first + count) are removed, the numbers refer
+  /// to the state before the removal.
+  sigc::signal<void, std::size_t, std::size_t> signal_rows_removed;
+
+  /// Emitted after text or color of rows <first, first + count) changes.
+  sigc::signal<void, std::size_t, std::size_t> signal_rows_changed;
+
+  /// Emitted after the whole content of the model changes.
+  sigc::signal<void> signal_reset;
+
+private:
+  CONSUI_DISABLE_COPY(ListModel);
+};
+
+/// Virtualized list widget.
+///
+/// Unlike ListBox, rows are not widgets. ListView keeps only a position in the
+/// model and draws visible rows directly, its memory usage does not depend on
+/// the number of rows.
+class ListView : public Widget {
+public:
+  /// Creates a view of a given model. The model is not owned by the view and
+  /// it has to outlive it or be detached by calling setModel(nullptr).
+  ListView(int w, int h, ListModel *model = nullptr);
+  virtual ~ListView() override;
+
+  // Widget
+  virtual int draw(Curses::ViewPort area, Error &error) override;
+
+  /// Attaches a different model.
+  virtual void setModel(ListModel *new_model);
+  virtual ListModel *getModel() const { return model_; }
+
+  /// Moves the cursor to a specified row and scrolls the view to show it.
+  virtual void setCursor(std::size_t row);
+  virtual std::size_t getCursor() const { return cursor_; }
+
+  /// Emitted when the row under the cursor is activated.
+  sigc::signal<void, ListView &, std::size_t> signal_activate;
+
+protected:
+  ListModel *model_;
+
+  /// First row shown at the top of the view.
+  std::size_t view_top_;
+
+  /// Row under the cursor, it is meaningful only if the model is not empty.
+  std::size_t cursor_;
+
+  sigc::connection rows_inserted_conn_;
+  sigc::connection rows_removed_conn_;
+  sigc::connection rows_changed_conn_;
+  sigc::connection reset_conn_;
+
+  virtual std::size_t getRowCount() const;
+
+  /// Adjusts view_top_ so the cursor is visible.
+  virtual void updateViewTop();
+
+  virtual void onRowsInserted(std::size_t first, std::size_t count);
+  virtual void onRowsRemoved(std::size_t first, std::size_t count);
+  virtual void onRowsChanged(std::size_t first, std::size_t count);
+  virtual void onReset();
+
+private:
+  CONSUI_DISABLE_COPY(ListView);
+
+  void disconnectModel();
+
+  void actionMoveCursor(int direction);
+  void actionMoveCursorPage(int direction);
+  void actionCursorBegin();
+  void actionCursorEnd();
+  void actionActivate();
+
+  void declareBindables();
+};
+
+} // namespace CppConsUI
+
+#endif // LISTVIEW_H
+
+// vim: set tabstop=2 shiftwidth=2 textwidth=80 expandtab:
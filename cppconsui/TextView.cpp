@@ -264,6 +264,24 @@ std::size_t TextView::getLinesNumber() const
   return lines_.size();
 }
 
+void TextView::scrollToLine(std::size_t line_num)
+{
+  assert(line_num < lines_.size());
+
+  // Find the first screen line of the line.
+  Line *line = lines_[line_num];
+  std::size_t i = 0;
+  while (i < screen_lines_.size() && screen_lines_[i].parent != line)
+    ++i;
+  if (i == screen_lines_.size())
+    return;
+
+  // The position is adjusted by draw() if the line is too close to the end.
+  view_top_ = i;
+  autoscroll_suspended_ = screen_lines_.size() > view_top_ + real_height_;
+  redraw();
+}
+
 void TextView::setAutoScroll(bool new_autoscroll)
 {
   if (new_autoscroll == autoscroll_)
@@ -283,6 +301,22 @@ void TextView::setScrollBar(bool new_scrollbar)
   redraw();
 }
 
+MemoryUsage TextView::getLinesMemoryUsage() const
+{
+  MemoryUsage usage;
+  for (Line *line : lines_)
+    usage.add(sizeof(Line *) + sizeof(Line) + std::strlen(line->text) + 1);
+  return usage;
+}
+
+MemoryUsage TextView::getScreenLinesMemoryUsage() const
+{
+  MemoryUsage usage;
+  usage.objects = screen_lines_.size();
+  usage.bytes = screen_lines_.size() * sizeof(ScreenLine);
+  return usage;
+}
+
 TextView::Line::Line(const char *text_, std::size_t bytes, int color_)
   : color(color_)
 {
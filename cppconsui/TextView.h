@@ -62,12 +62,21 @@ public:
   /// Returns count of all lines.
   virtual std::size_t getLinesNumber() const;
 
+  /// Scrolls the view so that a specified line is shown at the top.
+  virtual void scrollToLine(std::size_t line_num);
+
   virtual void setAutoScroll(bool new_autoscroll);
   virtual bool hasAutoScroll() const { return autoscroll_; }
 
   virtual void setScrollBar(bool new_scrollbar);
   virtual bool hasScrollBar() const { return scrollbar_; }
 
+  /// Returns memory held by real lines, including their text.
+  virtual MemoryUsage getLinesMemoryUsage() const;
+
+  /// Returns memory held by on-screen lines.
+  virtual MemoryUsage getScreenLinesMemoryUsage() const;
+
 protected:
   /// Struct Line saves a real line. All text added into TextView is split on
   /// '\\n' character and stored into Line objects.
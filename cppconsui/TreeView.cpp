@@ -45,7 +45,9 @@ void TreeView::ToggleCollapseButton::setParent(Container &parent)
     sigc::hide(sigc::mem_fun(tree, &TreeView::actionToggleCollapsed)));
 }
 
-TreeView::TreeView(int w, int h) : Container(w, h)
+TreeView::TreeView(int w, int h)
+  : Container(w, h), update_level_(0), update_area_pending_(false),
+    fix_focus_pending_(false)
 {
   // Allow fast focus changing (paging) using PageUp/PageDown keys.
   page_focus_ = true;
@@ -99,9 +101,11 @@ bool TreeView::grabFocus()
 
 void TreeView::clear()
 {
+  beginUpdate();
   TheTree::pre_order_iterator root = thetree_.begin();
   while (root.number_of_children() != 0)
     deleteNode(++thetree_.begin(), false);
+  endUpdate();
 
   // Stay sane.
   assert(children_.empty());
@@ -363,6 +367,14 @@ int TreeView::getNodeDepth(NodeReference node) const
   return thetree_.depth(node);
 }
 
+MemoryUsage TreeView::getNodesMemoryUsage() const
+{
+  MemoryUsage usage;
+  usage.objects = thetree_.size();
+  usage.bytes = usage.objects * sizeof(tree_node_<TreeNode>);
+  return usage;
+}
+
 void TreeView::moveNodeBefore(NodeReference node, NodeReference position)
 {
   assert(node->treeview == this);
@@ -424,8 +436,36 @@ TreeView::Style TreeView::getNodeStyle(NodeReference node) const
   return node->style;
 }
 
+void TreeView::beginUpdate()
+{
+  ++update_level_;
+}
+
+void TreeView::endUpdate()
+{
+  assert(update_level_ > 0);
+
+  if (--update_level_ > 0)
+    return;
+
+  if (fix_focus_pending_) {
+    fix_focus_pending_ = false;
+    fixFocus();
+  }
+  if (update_area_pending_) {
+    update_area_pending_ = false;
+    updateArea();
+  }
+  redraw();
+}
+
 void TreeView::updateArea()
 {
+  if (update_level_ > 0) {
+    update_area_pending_ = true;
+    return;
+  }
+
   repositionChildren(thetree_.begin(), 0, true);
 
   // Make sure that the currently focused widget is visible.
@@ -539,6 +579,11 @@ TreeView::TreeNode TreeView::addNode(Widget &widget)
 
 void TreeView::fixFocus()
 {
+  if (update_level_ > 0) {
+    fix_focus_pending_ = true;
+    return;
+  }
+
   // This function is called when a widget tree is reorganized (a node was moved
   // in another position in the tree). In this case, it is possible that there
   // can be revealed a widget that could grab the focus (if there is no focused
@@ -114,6 +114,9 @@ public:
   /// Returns node depth.
   virtual int getNodeDepth(NodeReference node) const;
 
+  /// Returns memory held by tree nodes. Widgets of the nodes are not included.
+  virtual MemoryUsage getNodesMemoryUsage() const;
+
   /// Detaches a given node from its current location and moves it before a
   /// given position.
   virtual void moveNodeBefore(NodeReference node, NodeReference position);
@@ -129,6 +132,16 @@ public:
   virtual void setNodeStyle(NodeReference node, Style s);
   virtual Style getNodeStyle(NodeReference node) const;
 
+  /// Defers relayout of the tree and fixing of the focus until a matching
+  /// endUpdate() call. This allows to add, move or delete many nodes at once
+  /// without relayouting the whole tree after each change. Calls can be
+  /// nested.
+  virtual void beginUpdate();
+
+  /// Ends a deferred update. When the outermost update ends the tree is
+  /// relayouted once.
+  virtual void endUpdate();
+
 protected:
   class TreeNode {
     // Note: If TreeNode is just protected/private and all its variables are
@@ -159,6 +172,13 @@ protected:
   TheTree thetree_;
   NodeReference focus_node_;
 
+  /// Nesting level of beginUpdate() calls.
+  int update_level_;
+  /// Flags whether updateArea() and fixFocus() were requested during a
+  /// deferred update.
+  bool update_area_pending_;
+  bool fix_focus_pending_;
+
   // Widget
   virtual void updateArea() override;
 
@@ -24,8 +24,16 @@
 
 #include "gettext.h"
 #include <cppconsui/Spacer.h>
+#include <algorithm>
 #include <cstdlib>
 #include <cstring>
+#include <map>
+#include <vector>
+
+// Interval in seconds in which activity of buddies is saved in the buddy list.
+#define BUDDYLIST_ACTIVITY_SAVE_INTERVAL 60
+// Time budget in microseconds of one slice of the buddy list population.
+#define BUDDYLIST_POPULATE_SLICE_TIME 4000
 
 BuddyList *BuddyList::my_instance_ = nullptr;
 
@@ -48,7 +56,7 @@ bool BuddyList::processInputText(const TermKeyKey &key)
   filter_buffer_onscreen_width_ += CppConsUI::Curses::onScreenWidth(pos);
   filter_buffer_length_ += input_len;
 
-  updateList(UPDATE_OTHERS);
+  updateFilter(true);
   redraw();
 
   return true;
@@ -76,7 +84,7 @@ void BuddyList::close()
     return;
 
   filterHide();
-  updateList(UPDATE_OTHERS);
+  updateFilter(false);
 }
 
 void BuddyList::onScreenResized()
@@ -84,9 +92,68 @@ void BuddyList::onScreenResized()
   moveResizeRect(CENTERIM->getScreenArea(CenterIM::BUDDY_LIST_AREA));
 }
 
-void BuddyList::updateNode(PurpleBlistNode *node)
+bool BuddyList::updateFilterNode(BuddyListNode &node)
+{
+  bool match = isFilterMatch(node.getFilterName());
+  if (match) {
+    filter_unmatched_.erase(&node);
+    filter_matched_.insert(&node);
+  }
+  else {
+    filter_matched_.erase(&node);
+    filter_unmatched_.insert(&node);
+  }
+  return match;
+}
+
+void BuddyList::removeFilterNode(BuddyListNode &node)
+{
+  filter_matched_.erase(&node);
+  filter_unmatched_.erase(&node);
+}
+
+void BuddyList::updateActivity(PurpleBuddy *buddy, time_t activity)
+{
+  // Setting the blist value schedules a save of the whole blist.xml file, so
+  // it is done in batches.
+  PurpleBlistNode *node = PURPLE_BLIST_NODE(buddy);
+  pending_activity_[node] = activity;
+  if (pending_activity_id_ == 0)
+    pending_activity_id_ = g_timeout_add_seconds(
+      BUDDYLIST_ACTIVITY_SAVE_INTERVAL, save_pending_activity_, this);
+
+  BuddyListNode *bnode =
+    reinterpret_cast<BuddyListNode *>(purple_blist_node_get_ui_data(node));
+  if (bnode == nullptr)
+    return;
+
+  bnode->setLastActivity(activity);
+  if (buddy_sort_mode_ == BUDDY_SORT_BY_ACTIVITY)
+    queueUpdate(node, BuddyListNode::ASPECT_SORT);
+}
+
+time_t BuddyList::getLastActivity(PurpleBuddy *buddy) const
 {
-  update(buddylist_, node);
+  PurpleBlistNode *node = PURPLE_BLIST_NODE(buddy);
+  PendingActivity::const_iterator i = pending_activity_.find(node);
+  if (i != pending_activity_.end())
+    return i->second;
+  return purple_blist_node_get_int(node, "last_activity");
+}
+
+void BuddyList::reportMemoryUsage(MemoryReport &report) const
+{
+  CppConsUI::MemoryUsage nodes;
+  for (PurpleBlistNode *node = purple_blist_get_root(); node != nullptr;
+       node = purple_blist_node_next(node, TRUE)) {
+    BuddyListNode *bnode =
+      reinterpret_cast<BuddyListNode *>(purple_blist_node_get_ui_data(node));
+    if (bnode != nullptr)
+      nodes.add(bnode->getMemoryUsage());
+  }
+
+  report.add(_("Buddy list nodes"), nodes);
+  report.add(_("Buddy list tree"), treeview_->getNodesMemoryUsage());
 }
 
 BuddyList::Filter::Filter(BuddyList *parent_blist)
@@ -478,6 +545,12 @@ BuddyList::BuddyList() : Window(0, 0, 80, 24)
   hbox->appendWidget(*(new CppConsUI::Spacer(1, AUTOSIZE)));
 
   filter_ = new Filter(this);
+  filter_folded_ = g_strdup("");
+  pending_updates_id_ = 0;
+  pending_activity_id_ = 0;
+  loading_ = false;
+  populate_pos_ = 0;
+  populate_id_ = 0;
   filterHide();
   lbox->appendWidget(*filter_);
 
@@ -530,6 +603,20 @@ BuddyList::BuddyList() : Window(0, 0, 80, 24)
   // centerim_blist_ui_ops_.save_account = save_account_;
   purple_blist_set_ui_ops(&centerim_blist_ui_ops_);
 
+  // Cached presence of buddy nodes is refreshed only from these signals.
+  void *blist_handle = purple_blist_get_handle();
+  purple_signal_connect(blist_handle, "buddy-status-changed", this,
+    PURPLE_CALLBACK(buddy_status_changed_), this);
+  purple_signal_connect(blist_handle, "buddy-signed-on", this,
+    PURPLE_CALLBACK(buddy_signed_on_off_), this);
+  purple_signal_connect(blist_handle, "buddy-signed-off", this,
+    PURPLE_CALLBACK(buddy_signed_on_off_), this);
+  void *accounts_handle = purple_accounts_get_handle();
+  purple_signal_connect(accounts_handle, "account-signed-on", this,
+    PURPLE_CALLBACK(account_signed_on_off_), this);
+  purple_signal_connect(accounts_handle, "account-signed-off", this,
+    PURPLE_CALLBACK(account_signed_on_off_), this);
+
   CENTERIM->timeoutOnceConnect(sigc::mem_fun(this, &BuddyList::load), 0);
 
   onScreenResized();
@@ -538,8 +625,20 @@ BuddyList::BuddyList() : Window(0, 0, 80, 24)
 
 BuddyList::~BuddyList()
 {
+  if (pending_activity_id_ != 0)
+    g_source_remove(pending_activity_id_);
+  savePendingActivity();
+
   purple_blist_set_ui_ops(nullptr);
   purple_prefs_disconnect_by_handle(this);
+  purple_signals_disconnect_by_handle(this);
+  if (pending_updates_id_ != 0)
+    g_source_remove(pending_updates_id_);
+  stopPopulation();
+
+  // Destroy all nodes while the filter and sort indices still exist.
+  treeview_->clear();
+  g_free(filter_folded_);
 }
 
 void BuddyList::init()
@@ -560,22 +659,223 @@ void BuddyList::finalize()
 
 void BuddyList::load()
 {
-  // Load the buddy list from ~/.centerim5/blist.xml.
+  // Load the buddy list from ~/.centerim5/blist.xml. Nodes are not created
+  // one by one while the list is loading, the list is populated afterwards.
+  loading_ = true;
   purple_blist_load();
+  loading_ = false;
+  CENTERIM->markStartupPhase(_("buddy list load"));
+  startPopulation();
+}
+
+void BuddyList::startPopulation()
+{
+  stopPopulation();
+
+  treeview_->beginUpdate();
+  treeview_->clear();
+
+  // New nodes read their activity from the buddy list.
+  savePendingActivity();
+
+  // Groups are created right away, there are only a few of them and manually
+  // ordered groups need all preceding groups to exist. Other nodes are queued,
+  // the ones with an online buddy first so they are shown first.
+  std::vector<PurpleBlistNode *> offline;
+  for (PurpleBlistNode *node = purple_blist_get_root(); node != nullptr;
+       node = purple_blist_node_next(node, TRUE)) {
+    if (PURPLE_BLIST_NODE_IS_GROUP(node)) {
+      createNode(node);
+      continue;
+    }
+
+    PurpleBuddy *buddy = nullptr;
+    if (PURPLE_BLIST_NODE_IS_CONTACT(node))
+      buddy = purple_contact_get_priority_buddy(PURPLE_CONTACT(node));
+    else if (PURPLE_BLIST_NODE_IS_BUDDY(node))
+      buddy = PURPLE_BUDDY(node);
+    if (buddy != nullptr && PURPLE_BUDDY_IS_ONLINE(buddy))
+      populate_queue_.push_back(node);
+    else
+      offline.push_back(node);
+  }
+  populate_queue_.insert(populate_queue_.end(), offline.begin(), offline.end());
+  populate_pending_.insert(populate_queue_.begin(), populate_queue_.end());
 
+  treeview_->endUpdate();
   delayedGroupNodesInit();
+
+  populate_id_ = g_idle_add_full(
+    G_PRIORITY_DEFAULT_IDLE, populate_slice_, this, nullptr);
+}
+
+void BuddyList::stopPopulation()
+{
+  if (populate_id_ != 0) {
+    g_source_remove(populate_id_);
+    populate_id_ = 0;
+  }
+
+  // Release the memory, clear() keeps the capacity.
+  std::vector<PurpleBlistNode *>().swap(populate_queue_);
+  populate_pending_.clear();
+  populate_pos_ = 0;
+}
+
+gboolean BuddyList::populateSlice()
+{
+  // Create nodes until the time budget of the slice runs out. The treeview is
+  // relayouted only once per slice.
+  gint64 end = g_get_monotonic_time() + BUDDYLIST_POPULATE_SLICE_TIME;
+  treeview_->beginUpdate();
+  while (populate_pos_ < populate_queue_.size()) {
+    createPendingNode(populate_queue_[populate_pos_++]);
+    if (g_get_monotonic_time() >= end)
+      break;
+  }
+  treeview_->endUpdate();
+
+  if (populate_pos_ < populate_queue_.size())
+    return TRUE;
+
+  // The source is removed by returning FALSE.
+  populate_id_ = 0;
+  stopPopulation();
+
+  CENTERIM->finishStartup();
+  return FALSE;
+}
+
+void BuddyList::queuePopulation(PurpleBlistNode *node)
+{
+  if (populate_pending_.insert(node).second)
+    populate_queue_.push_back(node);
+}
+
+void BuddyList::createPendingNode(PurpleBlistNode *node)
+{
+  // Skip nodes that were already created or removed.
+  if (populate_pending_.erase(node) == 0)
+    return;
+
+  // Parents have to be created before their children and manually ordered
+  // groups after their preceding groups.
+  PurpleBlistNode *parent = purple_blist_node_get_parent(node);
+  if (parent != nullptr)
+    createPendingNode(parent);
+  else if (PURPLE_BLIST_NODE_IS_GROUP(node)) {
+    PurpleBlistNode *prev = purple_blist_node_get_sibling_prev(node);
+    if (prev != nullptr)
+      createPendingNode(prev);
+  }
+
+  createNode(node);
+}
+
+void BuddyList::createNode(PurpleBlistNode *node)
+{
+  if (PURPLE_BLIST_NODE_IS_GROUP(node) && list_mode_ == BuddyList::LIST_FLAT) {
+    // Flat mode = no groups.
+    return;
+  }
+
+  BuddyListNode *bnode = BuddyListNode::createNode(node);
+  if (bnode == nullptr)
+    return;
+
+  BuddyListNode *parent = bnode->getParentNode();
+  CppConsUI::TreeView::NodeReference nref = treeview_->appendNode(
+    parent ? parent->getRefNode() : treeview_->getRootNode(), *bnode);
+  bnode->setRefNode(nref);
+  bnode->update(BuddyListNode::ASPECT_ALL);
+
+  // The sort key of a parent depends on its children (a contact is sorted by
+  // its priority buddy) which are created after it. Sort the parent in again.
+  PurpleBlistNode *parent_node = purple_blist_node_get_parent(node);
+  if (parent_node != nullptr)
+    queueUpdate(parent_node, BuddyListNode::ASPECT_SORT);
 }
 
 void BuddyList::rebuildList()
 {
+  // A population in progress is superseded by the bulk build.
+  bool populating = populate_id_ != 0;
+  stopPopulation();
+
+  // Build the whole list in bulk. All nodes are created first, then every
+  // group of siblings is sorted once and linked into the treeview in the final
+  // order. Sorting in the nodes when they are updated afterwards then does not
+  // need to move them. The treeview is relayouted only once at the end.
+  treeview_->beginUpdate();
   treeview_->clear();
 
+  // New nodes read their activity from the buddy list.
+  savePendingActivity();
+
+  // Create all nodes and collect them by their parents.
+  typedef std::map<BuddyListNode *, std::vector<BuddyListNode *>> Children;
+  Children children;
+  std::vector<BuddyListNode *> created;
   for (PurpleBlistNode *node = purple_blist_get_root(); node != nullptr;
-       node = purple_blist_node_next(node, TRUE))
-    new_node(node);
+       node = purple_blist_node_next(node, TRUE)) {
+    if (PURPLE_BLIST_NODE_IS_GROUP(node) && list_mode_ == LIST_FLAT) {
+      // Flat mode = no groups.
+      continue;
+    }
+
+    BuddyListNode *bnode = BuddyListNode::createNode(node);
+    if (bnode == nullptr)
+      continue;
+    created.push_back(bnode);
+  }
+
+  // Sort keys of contacts depend on their buddy nodes so they can be computed
+  // only after all nodes exist.
+  for (BuddyListNode *bnode : created) {
+    bnode->prepareSortKey();
+    children[bnode->getParentNode()].push_back(bnode);
+  }
+
+  // Link the nodes, parents before their children.
+  std::vector<BuddyListNode *> linked;
+  linked.reserve(created.size());
+  // Manually ordered groups are kept in the libpurple order.
+  bool sort_root =
+    list_mode_ == LIST_FLAT || group_sort_mode_ != GROUP_SORT_BY_USER;
+  linkNodes(nullptr, children[nullptr], sort_root, linked);
+  for (std::size_t i = 0; i < linked.size(); ++i) {
+    Children::iterator j = children.find(linked[i]);
+    if (j != children.end())
+      linkNodes(linked[i], j->second, true, linked);
+  }
+
+  g_assert(linked.size() == created.size());
+
+  for (BuddyListNode *bnode : linked)
+    bnode->update(BuddyListNode::ASPECT_ALL);
+
+  treeview_->endUpdate();
+
+  if (populating)
+    CENTERIM->finishStartup();
 }
 
-void BuddyList::updateList(int flags)
+void BuddyList::linkNodes(BuddyListNode *parent,
+  std::vector<BuddyListNode *> &nodes, bool sort,
+  std::vector<BuddyListNode *> &linked)
+{
+  if (sort)
+    std::sort(nodes.begin(), nodes.end(), BuddyListNode::SortKeyLess());
+
+  CppConsUI::TreeView::NodeReference parent_ref =
+    parent != nullptr ? parent->getRefNode() : treeview_->getRootNode();
+  for (BuddyListNode *bnode : nodes) {
+    bnode->setRefNode(treeview_->appendNode(parent_ref, *bnode));
+    linked.push_back(bnode);
+  }
+}
+
+void BuddyList::updateList(int flags, int aspects)
 {
   for (PurpleBlistNode *node = purple_blist_get_root(); node != nullptr;
        node = purple_blist_node_next(node, TRUE))
@@ -584,10 +884,58 @@ void BuddyList::updateList(int flags)
       BuddyListNode *bnode =
         reinterpret_cast<BuddyListNode *>(purple_blist_node_get_ui_data(node));
       if (bnode != nullptr)
-        bnode->update();
+        bnode->update(aspects);
     }
 }
 
+void BuddyList::queueUpdate(PurpleBlistNode *node, int aspects)
+{
+  // Parents have to be updated too because their state depends on their
+  // children.
+  for (; node != nullptr; node = purple_blist_node_get_parent(node))
+    pending_updates_[node] |= aspects;
+
+  if (pending_updates_id_ == 0)
+    pending_updates_id_ = g_timeout_add_full(
+      G_PRIORITY_DEFAULT, 0, process_pending_updates_, this, nullptr);
+}
+
+void BuddyList::processPendingUpdates()
+{
+  // Update children before their parents so each parent is updated and sorted
+  // in only once, according to the final state of its children.
+  std::vector<std::pair<int, PendingUpdates::value_type>> nodes;
+  nodes.reserve(pending_updates_.size());
+  for (const PendingUpdates::value_type &pending : pending_updates_) {
+    int depth = 0;
+    for (PurpleBlistNode *parent = purple_blist_node_get_parent(pending.first);
+         parent != nullptr; parent = purple_blist_node_get_parent(parent))
+      ++depth;
+    nodes.push_back(std::make_pair(-depth, pending));
+  }
+  pending_updates_.clear();
+  std::sort(nodes.begin(), nodes.end());
+
+  for (const auto &node : nodes) {
+    PurpleBlistNode *blist_node = node.second.first;
+    BuddyListNode *bnode = reinterpret_cast<BuddyListNode *>(
+      purple_blist_node_get_ui_data(blist_node));
+    if (bnode != nullptr)
+      bnode->update(node.second.second);
+    else {
+      // A new parent node, this also updates it.
+      new_node(blist_node);
+    }
+  }
+}
+
+void BuddyList::savePendingActivity()
+{
+  for (const PendingActivity::value_type &activity : pending_activity_)
+    purple_blist_node_set_int(activity.first, "last_activity", activity.second);
+  pending_activity_.clear();
+}
+
 void BuddyList::delayedGroupNodesInit()
 {
   // Delayed group nodes init.
@@ -662,6 +1010,33 @@ void BuddyList::filterHide()
   filter_buffer_onscreen_width_ = 0;
 }
 
+void BuddyList::updateFilter(bool narrowed)
+{
+  g_free(filter_folded_);
+  filter_folded_ = g_utf8_casefold(filter_buffer_, -1);
+
+  // Only nodes that can change their match state are checked. Nodes are moved
+  // to the other set after the iteration is done.
+  FilterNodes &candidates = narrowed ? filter_matched_ : filter_unmatched_;
+  FilterNodes &others = narrowed ? filter_unmatched_ : filter_matched_;
+  std::vector<BuddyListNode *> changed;
+  for (BuddyListNode *node : candidates)
+    if (isFilterMatch(node->getFilterName()) != narrowed)
+      changed.push_back(node);
+
+  for (BuddyListNode *node : changed) {
+    candidates.erase(node);
+    others.insert(node);
+    node->setFilterMatch(!narrowed);
+  }
+}
+
+bool BuddyList::isFilterMatch(const char *filter_name) const
+{
+  return filter_folded_[0] == '\0' ||
+    std::strstr(filter_name, filter_folded_) != nullptr;
+}
+
 void BuddyList::actionOpenFilter()
 {
   if (filter_->isVisible())
@@ -691,7 +1066,7 @@ void BuddyList::actionDeleteChar()
   else
     filterHide();
 
-  updateList(UPDATE_OTHERS);
+  updateFilter(false);
   redraw();
 }
 
@@ -715,43 +1090,43 @@ void BuddyList::new_node(PurpleBlistNode *node)
 {
   g_return_if_fail(!purple_blist_node_get_ui_data(node));
 
-  if (PURPLE_BLIST_NODE_IS_GROUP(node) && list_mode_ == BuddyList::LIST_FLAT) {
-    // Flat mode = no groups.
+  if (loading_)
     return;
-  }
 
-  BuddyListNode *bnode = BuddyListNode::createNode(node);
-  if (bnode == nullptr)
+  // While the list is being populated, the node is created in its turn after
+  // its parent.
+  if (populate_id_ != 0) {
+    queuePopulation(node);
     return;
+  }
 
-  BuddyListNode *parent = bnode->getParentNode();
-  CppConsUI::TreeView::NodeReference nref = treeview_->appendNode(
-    parent ? parent->getRefNode() : treeview_->getRootNode(), *bnode);
-  bnode->setRefNode(nref);
-  bnode->update();
+  createNode(node);
 }
 
-void BuddyList::update(PurpleBuddyList *list, PurpleBlistNode *node)
+void BuddyList::update(PurpleBuddyList * /*list*/, PurpleBlistNode *node)
 {
   // Not cool, but necessary because libpurple does not always behave nice. Note
   // that calling new_node() can modify node's ui_data.
   if (purple_blist_node_get_ui_data(node) == nullptr)
     new_node(node);
 
-  BuddyListNode *bnode =
-    reinterpret_cast<BuddyListNode *>(purple_blist_node_get_ui_data(node));
-  if (bnode == nullptr)
+  if (purple_blist_node_get_ui_data(node) == nullptr)
     return;
 
-  // Update the node data.
-  bnode->update();
-
-  if (node->parent != nullptr)
-    update(list, node->parent);
+  // Nothing is known about what changed.
+  queueUpdate(node, BuddyListNode::ASPECT_ALL);
 }
 
 void BuddyList::remove(PurpleBuddyList *list, PurpleBlistNode *node)
 {
+  // The node is going to be freed by libpurple. Forget it even if it has no
+  // UI node, it can be still waiting to be created (during the population),
+  // be a group in the flat mode queued by an update of its child, or have
+  // a pending activity update.
+  populate_pending_.erase(node);
+  pending_updates_.erase(node);
+  pending_activity_.erase(node);
+
   BuddyListNode *bnode =
     reinterpret_cast<BuddyListNode *>(purple_blist_node_get_ui_data(node));
   if (bnode == nullptr)
@@ -827,12 +1202,40 @@ void BuddyList::blist_pref_change(
     return;
   }
 
-  bool groups_only = false;
-  if (std::strcmp(name, CONF_PREFIX "/blist/show_empty_groups") == 0 ||
-    std::strcmp(name, CONF_PREFIX "/blist/group_sort_mode") == 0)
-    groups_only = true;
+  // Update only nodes and their aspects that depend on the preference. Note
+  // that toggling visibility never re-sorts the list.
+  if (std::strcmp(name, CONF_PREFIX "/blist/show_empty_groups") == 0)
+    updateList(UPDATE_GROUPS, BuddyListNode::ASPECT_VISIBILITY);
+  else if (std::strcmp(name, CONF_PREFIX "/blist/show_offline_buddies") == 0)
+    updateList(UPDATE_OTHERS, BuddyListNode::ASPECT_VISIBILITY);
+  else if (std::strcmp(name, CONF_PREFIX "/blist/group_sort_mode") == 0)
+    updateList(UPDATE_GROUPS, BuddyListNode::ASPECT_SORT);
+  else if (std::strcmp(name, CONF_PREFIX "/blist/buddy_sort_mode") == 0)
+    updateList(UPDATE_OTHERS, BuddyListNode::ASPECT_SORT);
+  else if (std::strcmp(name, CONF_PREFIX "/blist/colorization_mode") == 0)
+    updateList(UPDATE_OTHERS, BuddyListNode::ASPECT_COLOR);
+  else
+    updateList(UPDATE_GROUPS | UPDATE_OTHERS, BuddyListNode::ASPECT_ALL);
+}
 
-  updateList(UPDATE_GROUPS | (!groups_only ? UPDATE_OTHERS : 0));
+void BuddyList::buddy_presence_changed(PurpleBuddy *buddy)
+{
+  PurpleBlistNode *node = PURPLE_BLIST_NODE(buddy);
+  BuddyListBuddy *bnode =
+    reinterpret_cast<BuddyListBuddy *>(purple_blist_node_get_ui_data(node));
+  if (bnode == nullptr)
+    return;
+
+  bnode->updatePresence();
+  queueUpdate(node, BuddyListNode::ASPECT_PRESENCE);
+}
+
+void BuddyList::account_signed_on_off(PurpleAccount *account)
+{
+  GSList *buddies = purple_find_buddies(account, nullptr);
+  for (GSList *l = buddies; l != nullptr; l = l->next)
+    buddy_presence_changed(reinterpret_cast<PurpleBuddy *>(l->data));
+  g_slist_free(buddies);
 }
 
 // vim: set tabstop=2 shiftwidth=2 textwidth=80 expandtab:
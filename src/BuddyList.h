@@ -20,6 +20,7 @@
 #define BUDDYLIST_H
 
 #include "BuddyListNode.h"
+#include "MemoryReport.h"
 
 #include <cppconsui/Button.h>
 #include <cppconsui/CheckBox.h>
@@ -27,6 +28,9 @@
 #include <cppconsui/SplitDialog.h>
 #include <cppconsui/TreeView.h>
 #include <cppconsui/Window.h>
+#include <map>
+#include <set>
+#include <vector>
 
 #define BUDDYLIST (BuddyList::instance())
 
@@ -77,7 +81,26 @@ public:
 
   const char *getFilterString() const { return filter_buffer_; }
 
-  void updateNode(PurpleBlistNode *node);
+  // Adds or updates a node in the filter index after its filter name changed.
+  // Returns true if the node matches the current filter.
+  bool updateFilterNode(BuddyListNode &node);
+  void removeFilterNode(BuddyListNode &node);
+
+  // Returns the index of sorted nodes at the root level of the list.
+  BuddyListNode::SortedNodes *getSortedRootNodes()
+  {
+    return &sorted_root_nodes_;
+  }
+
+  // Records activity of a buddy. The node is re-sorted only if the list is
+  // sorted by activity, the "last_activity" blist setting is saved later.
+  void updateActivity(PurpleBuddy *buddy, time_t activity);
+  // Returns the last activity of a buddy, including activity that is not saved
+  // in the blist setting yet.
+  time_t getLastActivity(PurpleBuddy *buddy) const;
+
+  // Adds memory held by the buddy list nodes and the tree to a report.
+  void reportMemoryUsage(MemoryReport &report) const;
 
 private:
   enum UpdateFlags {
@@ -258,6 +281,44 @@ private:
   std::size_t filter_buffer_length_;
   // Onscreen width.
   std::size_t filter_buffer_onscreen_width_;
+  // Case-folded filter string.
+  char *filter_folded_;
+
+  // Index of nodes that are subject to filtering. Nodes are kept in two sets
+  // according to whether they match the current filter. When the filter string
+  // is extended only matching nodes need to be checked, and when it is
+  // shortened only the non-matching ones.
+  typedef std::set<BuddyListNode *> FilterNodes;
+  FilterNodes filter_matched_;
+  FilterNodes filter_unmatched_;
+
+  BuddyListNode::SortedNodes sorted_root_nodes_;
+
+  // Nodes waiting for an update and aspects of them that need to be updated.
+  // Updates requested by libpurple are coalesced and processed together in the
+  // next main loop iteration.
+  typedef std::map<PurpleBlistNode *, int> PendingUpdates;
+  PendingUpdates pending_updates_;
+  guint pending_updates_id_;
+
+  // Activity times that have not been saved in the buddy list yet.
+  typedef std::map<PurpleBlistNode *, time_t> PendingActivity;
+  PendingActivity pending_activity_;
+  guint pending_activity_id_;
+
+  // Set while libpurple loads the buddy list, the list is populated after the
+  // load finishes.
+  bool loading_;
+
+  // Nodes that still need to be created after the buddy list was loaded. The
+  // list is populated in time-limited slices at the idle priority so the first
+  // frame is not delayed and input is processed while a large list is built.
+  std::vector<PurpleBlistNode *> populate_queue_;
+  std::size_t populate_pos_;
+  // Queued nodes that have not been created yet. Nodes removed by libpurple in
+  // the meantime are dropped from this set.
+  std::set<PurpleBlistNode *> populate_pending_;
+  guint populate_id_;
 
   static BuddyList *my_instance_;
 
@@ -270,12 +331,41 @@ private:
   friend class CenterIM;
 
   void load();
+  void startPopulation();
+  void stopPopulation();
+  static gboolean populate_slice_(gpointer data)
+  {
+    return reinterpret_cast<BuddyList *>(data)->populateSlice();
+  }
+  gboolean populateSlice();
+  void queuePopulation(PurpleBlistNode *node);
+  void createPendingNode(PurpleBlistNode *node);
+  void createNode(PurpleBlistNode *node);
   void rebuildList();
-  void updateList(int flags);
+  void linkNodes(BuddyListNode *parent, std::vector<BuddyListNode *> &nodes,
+    bool sort, std::vector<BuddyListNode *> &linked);
+  void updateList(int flags, int aspects);
+  void queueUpdate(PurpleBlistNode *node, int aspects);
+  static gboolean process_pending_updates_(gpointer data)
+  {
+    reinterpret_cast<BuddyList *>(data)->pending_updates_id_ = 0;
+    reinterpret_cast<BuddyList *>(data)->processPendingUpdates();
+    return FALSE;
+  }
+  void processPendingUpdates();
+  static gboolean save_pending_activity_(gpointer data)
+  {
+    reinterpret_cast<BuddyList *>(data)->pending_activity_id_ = 0;
+    reinterpret_cast<BuddyList *>(data)->savePendingActivity();
+    return FALSE;
+  }
+  void savePendingActivity();
   void delayedGroupNodesInit();
   void updateCachedPreference(const char *name);
   bool isAnyAccountConnected();
   void filterHide();
+  void updateFilter(bool narrowed);
+  bool isFilterMatch(const char *filter_name) const;
   void actionOpenFilter();
   void actionDeleteChar();
   void declareBindables();
@@ -322,6 +412,26 @@ private:
   }
   void blist_pref_change(
     const char *name, PurplePrefType type, gconstpointer val);
+
+  // Called when presence of a buddy changes.
+  static void buddy_status_changed_(PurpleBuddy *buddy,
+    PurpleStatus * /*old_status*/, PurpleStatus * /*new_status*/,
+    gpointer data)
+  {
+    reinterpret_cast<BuddyList *>(data)->buddy_presence_changed(buddy);
+  }
+  static void buddy_signed_on_off_(PurpleBuddy *buddy, gpointer data)
+  {
+    reinterpret_cast<BuddyList *>(data)->buddy_presence_changed(buddy);
+  }
+  void buddy_presence_changed(PurpleBuddy *buddy);
+
+  // Called when an account signs on or off.
+  static void account_signed_on_off_(PurpleAccount *account, gpointer data)
+  {
+    reinterpret_cast<BuddyList *>(data)->account_signed_on_off(account);
+  }
+  void account_signed_on_off(PurpleAccount *account);
 };
 
 #endif // BUDDYLIST_H
@@ -24,6 +24,7 @@
 
 #include "gettext.h"
 #include <cppconsui/ColorScheme.h>
+#include <cstring>
 
 BuddyListNode *BuddyListNode::createNode(PurpleBlistNode *node)
 {
@@ -55,37 +56,36 @@ void BuddyListNode::setRefNode(CppConsUI::TreeView::NodeReference n)
   treeview_->setCollapsed(ref_, true);
 }
 
-void BuddyListNode::update()
+void BuddyListNode::update(int aspects)
 {
-  // Cache the last_activity time.
-  last_activity_ = purple_blist_node_get_int(blist_node_, "last_activity");
-
-  BuddyListNode *parent_node = getParentNode();
-  // The parent could have changed, so re-parent the node.
-  if (parent_node != nullptr)
-    treeview_->setNodeParent(ref_, parent_node->getRefNode());
+  if (aspects & ASPECT_PARENT) {
+    BuddyListNode *parent_node = getParentNode();
+    // The parent could have changed, so re-parent the node.
+    if (parent_node != nullptr)
+      treeview_->setNodeParent(ref_, parent_node->getRefNode());
+  }
 }
 
 void BuddyListNode::sortIn()
 {
-  CppConsUI::TreeView::NodeReference parent_ref;
+  SortedNodes *index;
   if (purple_blist_node_get_parent(blist_node_) != nullptr) {
     // This blist node has got a logical (libpurple) parent, check if it is
     // possible to find also a cim node.
     BuddyListNode *parent_node = getParentNode();
     if (parent_node != nullptr)
-      parent_ref = parent_node->getRefNode();
+      index = &parent_node->sorted_children_;
     else {
       // there shouldn't be a cim node only if the flat mode is active
       g_assert(BUDDYLIST->getListMode() == BuddyList::LIST_FLAT);
 
-      parent_ref = treeview_->getRootNode();
+      index = BUDDYLIST->getSortedRootNodes();
     }
   }
   else {
     if (PURPLE_BLIST_NODE_IS_GROUP(blist_node_)) {
       // Groups do not have parent nodes.
-      parent_ref = treeview_->getRootNode();
+      index = BUDDYLIST->getSortedRootNodes();
     }
     else {
       // When the new_node() callback is called for a contact/chat/buddy (and
@@ -95,45 +95,21 @@ void BuddyListNode::sortIn()
     }
   }
 
-  // Do the insertion sort. It should be fast enough here because nodes are
-  // usually already sorted and only one node is in a wrong position, so it kind
-  // of runs in O(n).
-  CppConsUI::TreeView::SiblingIterator i = parent_ref.end();
-  --i;
-  while (true) {
-    // sref is a node that we want to sort in.
-    CppConsUI::TreeView::SiblingIterator sref = i;
-
-    // Calculate a stop condition.
-    bool stop_flag;
-    if (i != parent_ref.begin()) {
-      stop_flag = false;
-      --i;
-    }
-    else
-      stop_flag = true;
-
-    BuddyListNode *swidget = dynamic_cast<BuddyListNode *>(sref->getWidget());
-    g_assert(swidget != nullptr);
-    CppConsUI::TreeView::SiblingIterator j = sref;
-    ++j;
-    while (j != parent_ref.end()) {
-      BuddyListNode *n = dynamic_cast<BuddyListNode *>(j->getWidget());
-      g_assert(n != nullptr);
-
-      if (swidget->lessOrEqual(*n)) {
-        treeview_->moveNodeBefore(sref, j);
-        break;
-      }
-      ++j;
-    }
-    // the node is last in the list
-    if (j == parent_ref.end())
-      treeview_->moveNodeAfter(sref, --j);
+  // Re-insert the node in the index of its siblings with an updated key. The
+  // key must not be changed while the node is stored in the index.
+  removeSortedIn();
+  updateSortKey();
+  SortedNodes::iterator i = index->insert(this).first;
+  sorted_in_ = index;
 
-    if (stop_flag)
-      break;
-  }
+  // The siblings in the index are in the same order as in the treeview, so
+  // only this node needs to be moved next to its new neighbour.
+  SortedNodes::iterator next = i;
+  ++next;
+  if (next != index->end())
+    treeview_->moveNodeBefore(ref_, (*next)->getRefNode());
+  else if (i != index->begin())
+    treeview_->moveNodeAfter(ref_, (*--i)->getRefNode());
 }
 
 BuddyListNode *BuddyListNode::getParentNode() const
@@ -146,6 +122,35 @@ BuddyListNode *BuddyListNode::getParentNode() const
     purple_blist_node_get_ui_data(parent));
 }
 
+void BuddyListNode::setFilterMatch(bool match)
+{
+  filter_match_ = match;
+  setVisibility(state_visible_ && filter_match_);
+}
+
+std::size_t BuddyListNode::getMemoryUsage() const
+{
+  std::size_t size;
+  if (PURPLE_BLIST_NODE_IS_BUDDY(blist_node_))
+    size = sizeof(BuddyListBuddy);
+  else if (PURPLE_BLIST_NODE_IS_CHAT(blist_node_))
+    size = sizeof(BuddyListChat);
+  else if (PURPLE_BLIST_NODE_IS_CONTACT(blist_node_))
+    size = sizeof(BuddyListContact);
+  else
+    size = sizeof(BuddyListGroup);
+
+  auto string_size = [](const char *str) {
+    return str != nullptr ? std::strlen(str) + 1 : 0;
+  };
+  size += string_size(text_) + string_size(value_) + string_size(unit_) +
+    string_size(right_);
+  size += string_size(filter_name_) + string_size(sort_name_) +
+    string_size(sort_collate_key_);
+  size += sorted_children_.size() * sizeof(BuddyListNode *);
+  return size;
+}
+
 BuddyListNode::ContextMenu::ContextMenu(BuddyListNode &parent_node)
   : MenuWindow(parent_node, AUTOSIZE, AUTOSIZE), parent_node_(&parent_node)
 {
@@ -237,7 +242,11 @@ void BuddyListNode::ContextMenu::appendExtendedMenu()
 }
 
 BuddyListNode::BuddyListNode(PurpleBlistNode *node)
-  : treeview_(nullptr), blist_node_(node), last_activity_(0)
+  : treeview_(nullptr), blist_node_(node),
+    last_activity_(purple_blist_node_get_int(node, "last_activity")),
+    filter_name_(nullptr), filter_match_(true), state_visible_(true),
+    sort_weight_(0), sort_name_(nullptr), sort_collate_key_(nullptr),
+    sorted_in_(nullptr)
 {
   purple_blist_node_set_ui_data(blist_node_, this);
   signal_activate.connect(sigc::mem_fun(this, &BuddyListNode::onActivate));
@@ -246,34 +255,74 @@ BuddyListNode::BuddyListNode(PurpleBlistNode *node)
 
 BuddyListNode::~BuddyListNode()
 {
+  if (filter_name_ != nullptr) {
+    BUDDYLIST->removeFilterNode(*this);
+    g_free(filter_name_);
+  }
+
+  // Children can be destroyed after their parent.
+  for (BuddyListNode *child : sorted_children_)
+    child->sorted_in_ = nullptr;
+  removeSortedIn();
+  g_free(sort_name_);
+  g_free(sort_collate_key_);
+
   purple_blist_node_set_ui_data(blist_node_, nullptr);
 }
 
-bool BuddyListNode::lessOrEqualByType(const BuddyListNode &other) const
+bool BuddyListNode::SortKeyLess::operator()(
+  const BuddyListNode *left, const BuddyListNode *right) const
 {
   // group < contact < buddy < chat < other.
-  PurpleBlistNodeType t1 = purple_blist_node_get_type(blist_node_);
-  PurpleBlistNodeType t2 = purple_blist_node_get_type(other.blist_node_);
-  return t1 <= t2;
+  PurpleBlistNodeType t1 = purple_blist_node_get_type(left->blist_node_);
+  PurpleBlistNodeType t2 = purple_blist_node_get_type(right->blist_node_);
+  if (t1 != t2)
+    return t1 < t2;
+
+  if (left->sort_weight_ != right->sort_weight_)
+    return left->sort_weight_ > right->sort_weight_;
+
+  int res = std::strcmp(left->sort_collate_key_, right->sort_collate_key_);
+  if (res != 0)
+    return res < 0;
+
+  // Keep the order of equal nodes stable.
+  return left < right;
 }
 
-bool BuddyListNode::lessOrEqualByBuddySort(
-  PurpleBuddy *left, PurpleBuddy *right) const
+void BuddyListNode::setSortKey(int weight, const char *name)
 {
-  BuddyList::BuddySortMode mode = BUDDYLIST->getBuddySortMode();
-  int a, b;
+  g_assert(sorted_in_ == nullptr);
 
-  switch (mode) {
+  sort_weight_ = weight;
+
+  if (name == nullptr)
+    name = "";
+  if (sort_name_ != nullptr && std::strcmp(sort_name_, name) == 0)
+    return;
+
+  g_free(sort_name_);
+  sort_name_ = g_strdup(name);
+  g_free(sort_collate_key_);
+  sort_collate_key_ = g_utf8_collate_key(name, -1);
+}
+
+void BuddyListNode::setBuddySortKey(PurpleBuddy *buddy)
+{
+  if (buddy == nullptr) {
+    setSortKey(0, "");
+    return;
+  }
+
+  int weight = 0;
+  switch (BUDDYLIST->getBuddySortMode()) {
   case BuddyList::BUDDY_SORT_BY_NAME:
     break;
   case BuddyList::BUDDY_SORT_BY_STATUS:
-    a = getBuddyStatusWeight(left);
-    b = getBuddyStatusWeight(right);
-    if (a != b)
-      return a > b;
+    weight = getBuddyStatusWeight(buddy);
     break;
   case BuddyList::BUDDY_SORT_BY_ACTIVITY: {
-    // Compare buddies according to their last activity.
+    // Sort according to the last activity of the buddy.
     //
     // It is possible that a blist node will not have the ui_data set. For
     // instance, this happens when libpurple informs the program that a blist
@@ -284,64 +333,101 @@ bool BuddyListNode::lessOrEqualByBuddySort(
     //
     // In such a case, the cached value cannot be obtained and value 0 will be
     // used instead.
-    BuddyListNode *bnode_left = reinterpret_cast<BuddyListNode *>(
-      purple_blist_node_get_ui_data(PURPLE_BLIST_NODE(left)));
-    BuddyListNode *bnode_right = reinterpret_cast<BuddyListNode *>(
-      purple_blist_node_get_ui_data(PURPLE_BLIST_NODE(right)));
-    a = bnode_left ? bnode_left->last_activity_ : 0;
-    b = bnode_right ? bnode_right->last_activity_ : 0;
-    if (a != b)
-      return a > b;
+    BuddyListNode *bnode = reinterpret_cast<BuddyListNode *>(
+      purple_blist_node_get_ui_data(PURPLE_BLIST_NODE(buddy)));
+    weight = bnode != nullptr ? bnode->last_activity_ : 0;
   } break;
   }
-  return g_utf8_collate(
-           purple_buddy_get_alias(left), purple_buddy_get_alias(right)) <= 0;
+  setSortKey(weight, purple_buddy_get_alias(buddy));
 }
 
-const char *BuddyListNode::getBuddyStatus(PurpleBuddy *buddy) const
+void BuddyListNode::removeSortedIn()
 {
-  if (!purple_account_is_connected(purple_buddy_get_account(buddy)))
-    return "";
+  if (sorted_in_ == nullptr)
+    return;
 
-  PurplePresence *presence = purple_buddy_get_presence(buddy);
-  PurpleStatus *status = purple_presence_get_active_status(presence);
-  return Utils::getStatusIndicator(status);
+  sorted_in_->erase(this);
+  sorted_in_ = nullptr;
 }
 
-int BuddyListNode::getBuddyStatusWeight(PurpleBuddy *buddy) const
+BuddyListNode::BuddyPresence BuddyListNode::queryBuddyPresence(
+  PurpleBuddy *buddy)
 {
-  if (!purple_account_is_connected(purple_buddy_get_account(buddy)))
-    return 0;
+  BuddyPresence presence;
+  presence.connected =
+    purple_account_is_connected(purple_buddy_get_account(buddy));
 
-  PurplePresence *presence = purple_buddy_get_presence(buddy);
-  PurpleStatus *status = purple_presence_get_active_status(presence);
+  PurplePresence *purple_presence = purple_buddy_get_presence(buddy);
+  PurpleStatus *status = purple_presence_get_active_status(purple_presence);
   PurpleStatusType *status_type = purple_status_get_type(status);
-  PurpleStatusPrimitive prim = purple_status_type_get_primitive(status_type);
+  presence.primitive = purple_status_type_get_primitive(status_type);
+  presence.indicator = Utils::getStatusIndicator(status);
 
-  switch (prim) {
+  switch (presence.primitive) {
   case PURPLE_STATUS_OFFLINE:
-    return 0;
+    presence.weight = 0;
+    break;
   default:
-    return 1;
+    presence.weight = 1;
+    break;
   case PURPLE_STATUS_UNSET:
-    return 2;
+    presence.weight = 2;
+    break;
   case PURPLE_STATUS_UNAVAILABLE:
-    return 3;
+    presence.weight = 3;
+    break;
   case PURPLE_STATUS_AWAY:
-    return 4;
+    presence.weight = 4;
+    break;
   case PURPLE_STATUS_EXTENDED_AWAY:
-    return 5;
+    presence.weight = 5;
+    break;
   case PURPLE_STATUS_MOBILE:
-    return 6;
+    presence.weight = 6;
+    break;
   case PURPLE_STATUS_MOOD:
-    return 7;
+    presence.weight = 7;
+    break;
   case PURPLE_STATUS_TUNE:
-    return 8;
+    presence.weight = 8;
+    break;
   case PURPLE_STATUS_INVISIBLE:
-    return 9;
+    presence.weight = 9;
+    break;
   case PURPLE_STATUS_AVAILABLE:
-    return 10;
+    presence.weight = 10;
+    break;
   }
+
+  return presence;
+}
+
+BuddyListNode::BuddyPresence BuddyListNode::getBuddyPresence(
+  PurpleBuddy *buddy) const
+{
+  // The ui_data of a buddy is always a BuddyListBuddy node, but it might not be
+  // set, for instance when the buddy is being removed.
+  BuddyListBuddy *bnode = reinterpret_cast<BuddyListBuddy *>(
+    purple_blist_node_get_ui_data(PURPLE_BLIST_NODE(buddy)));
+  if (bnode != nullptr)
+    return bnode->getPresence();
+  return queryBuddyPresence(buddy);
+}
+
+const char *BuddyListNode::getBuddyStatus(PurpleBuddy *buddy) const
+{
+  BuddyPresence presence = getBuddyPresence(buddy);
+  if (!presence.connected)
+    return "";
+  return presence.indicator;
+}
+
+int BuddyListNode::getBuddyStatusWeight(PurpleBuddy *buddy) const
+{
+  BuddyPresence presence = getBuddyPresence(buddy);
+  if (!presence.connected)
+    return 0;
+  return presence.weight;
 }
 
 int BuddyListNode::getColorSchemeByBuddy(int base_scheme, PurpleBuddy *buddy)
@@ -351,16 +437,12 @@ int BuddyListNode::getColorSchemeByBuddy(int base_scheme, PurpleBuddy *buddy)
 
   bool scheme_buddy = (base_scheme == CenterIM::SCHEME_BUDDYLISTBUDDY);
 
-  if (!purple_account_is_connected(purple_buddy_get_account(buddy)))
+  BuddyPresence presence = getBuddyPresence(buddy);
+  if (!presence.connected)
     return scheme_buddy ? CenterIM::SCHEME_BUDDYLISTBUDDY_OFFLINE
                         : CenterIM::SCHEME_BUDDYLISTCONTACT_OFFLINE;
 
-  PurplePresence *presence = purple_buddy_get_presence(buddy);
-  PurpleStatus *status = purple_presence_get_active_status(presence);
-  PurpleStatusType *status_type = purple_status_get_type(status);
-  PurpleStatusPrimitive prim = purple_status_type_get_primitive(status_type);
-
-  switch (prim) {
+  switch (presence.primitive) {
   case PURPLE_STATUS_UNSET:
   case PURPLE_STATUS_OFFLINE:
   default:
@@ -383,17 +465,17 @@ int BuddyListNode::getColorSchemeByBuddy(int base_scheme, PurpleBuddy *buddy)
   }
 }
 
-void BuddyListNode::updateFilterVisibility(const char *name)
+void BuddyListNode::setStateVisibility(bool visible)
 {
-  if (!isVisible())
-    return;
-
-  const char *filter = BUDDYLIST->getFilterString();
-  if (filter[0] == '\0')
-    return;
+  state_visible_ = visible;
+  setVisibility(state_visible_ && filter_match_);
+}
 
-  // Filtering is active.
-  setVisibility(purple_strcasestr(name, filter));
+void BuddyListNode::setFilterName(const char *name)
+{
+  g_free(filter_name_);
+  filter_name_ = g_utf8_casefold(name, -1);
+  filter_match_ = BUDDYLIST->updateFilterNode(*this);
 }
 
 void BuddyListNode::retrieveUserInfoForName(
@@ -418,40 +500,44 @@ void BuddyListNode::declareBindables()
     InputProcessor::BINDABLE_NORMAL);
 }
 
-bool BuddyListBuddy::lessOrEqual(const BuddyListNode &other) const
+void BuddyListBuddy::updateSortKey()
 {
-  const BuddyListBuddy *o = dynamic_cast<const BuddyListBuddy *>(&other);
-  if (o != nullptr)
-    return lessOrEqualByBuddySort(buddy_, o->buddy_);
-  return lessOrEqualByType(other);
+  setBuddySortKey(buddy_);
 }
 
-void BuddyListBuddy::update()
+void BuddyListBuddy::update(int aspects)
 {
-  BuddyListNode::update();
+  BuddyListNode::update(aspects);
 
   const char *status = getBuddyStatus(buddy_);
-  const char *alias = purple_buddy_get_alias(buddy_);
-  if (status[0] != '\0') {
-    char *text = g_strdup_printf("%s %s", status, alias);
-    setText(text);
-    g_free(text);
+  if (aspects & ASPECT_TEXT) {
+    const char *alias = purple_buddy_get_alias(buddy_);
+    if (status[0] != '\0') {
+      char *text = g_strdup_printf("%s %s", status, alias);
+      setText(text);
+      g_free(text);
+    }
+    else
+      setText(alias);
+
+    setFilterName(alias);
   }
-  else
-    setText(alias);
 
-  sortIn();
+  if (aspects & ASPECT_SORT)
+    sortIn();
 
-  updateColorScheme();
+  if (aspects & ASPECT_COLOR)
+    updateColorScheme();
 
-  if (!purple_account_is_connected(purple_buddy_get_account(buddy_))) {
-    // Hide if account is offline.
-    setVisibility(false);
+  if (aspects & ASPECT_VISIBILITY) {
+    if (!presence_.connected) {
+      // Hide if account is offline.
+      setStateVisibility(false);
+    }
+    else
+      setStateVisibility(
+        status[0] != '\0' || BUDDYLIST->getShowOfflineBuddiesPref());
   }
-  else
-    setVisibility(status[0] != '\0' || BUDDYLIST->getShowOfflineBuddiesPref());
-
-  updateFilterVisibility(alias);
 }
 
 void BuddyListBuddy::onActivate(Button & /*activator*/)
@@ -583,6 +669,7 @@ BuddyListBuddy::BuddyListBuddy(PurpleBlistNode *node) : BuddyListNode(node)
   setColorScheme(CenterIM::SCHEME_BUDDYLISTBUDDY);
 
   buddy_ = PURPLE_BUDDY(blist_node_);
+  updatePresence();
 }
 
 void BuddyListBuddy::updateColorScheme()
@@ -600,28 +687,29 @@ void BuddyListBuddy::updateColorScheme()
   }
 }
 
-bool BuddyListChat::lessOrEqual(const BuddyListNode &other) const
+void BuddyListChat::updateSortKey()
 {
-  const BuddyListChat *o = dynamic_cast<const BuddyListChat *>(&other);
-  if (o != nullptr)
-    return g_utf8_collate(
-             purple_chat_get_name(chat_), purple_chat_get_name(o->chat_)) <= 0;
-  return lessOrEqualByType(other);
+  setSortKey(0, purple_chat_get_name(chat_));
 }
 
-void BuddyListChat::update()
+void BuddyListChat::update(int aspects)
 {
-  BuddyListNode::update();
-
-  const char *name = purple_chat_get_name(chat_);
-  setText(name);
+  BuddyListNode::update(aspects);
 
-  sortIn();
+  if (aspects & ASPECT_TEXT) {
+    const char *name = purple_chat_get_name(chat_);
+    setText(name);
+    setFilterName(name);
+  }
 
-  // Hide if account is offline.
-  setVisibility(purple_account_is_connected(purple_chat_get_account(chat_)));
+  if (aspects & ASPECT_SORT)
+    sortIn();
 
-  updateFilterVisibility(name);
+  if (aspects & ASPECT_VISIBILITY) {
+    // Hide if account is offline.
+    setStateVisibility(
+      purple_account_is_connected(purple_chat_get_account(chat_)));
+  }
 }
 
 void BuddyListChat::onActivate(Button & /*activator*/)
@@ -734,61 +822,64 @@ BuddyListChat::BuddyListChat(PurpleBlistNode *node) : BuddyListNode(node)
   chat_ = PURPLE_CHAT(blist_node_);
 }
 
-bool BuddyListContact::lessOrEqual(const BuddyListNode &other) const
+void BuddyListContact::updateSortKey()
 {
-  const BuddyListContact *o = dynamic_cast<const BuddyListContact *>(&other);
-  if (o != nullptr) {
-    PurpleBuddy *left = purple_contact_get_priority_buddy(contact_);
-    PurpleBuddy *right = purple_contact_get_priority_buddy(o->contact_);
-    return lessOrEqualByBuddySort(left, right);
-  }
-  return lessOrEqualByType(other);
+  setBuddySortKey(purple_contact_get_priority_buddy(contact_));
 }
 
-void BuddyListContact::update()
+void BuddyListContact::update(int aspects)
 {
-  BuddyListNode::update();
+  BuddyListNode::update(aspects);
 
   PurpleBuddy *buddy = purple_contact_get_priority_buddy(contact_);
   if (buddy == nullptr) {
     // The contact does not have any associated buddy, ignore it until it gets a
     // buddy assigned.
-    setText("*Contact*");
-    setVisibility(false);
+    if (aspects & ASPECT_TEXT)
+      setText("*Contact*");
+    if (aspects & ASPECT_VISIBILITY)
+      setStateVisibility(false);
     return;
   }
 
-  // Format contact size.
-  char *size;
-  if (contact_->currentsize > 1)
-    size = g_strdup_printf(" (%d)", contact_->currentsize);
-  else
-    size = nullptr;
-
-  // Format contact label.
-  const char *alias = purple_contact_get_alias(contact_);
   const char *status = getBuddyStatus(buddy);
-  char *text;
-  if (status[0] != '\0')
-    text = g_strdup_printf("%s %s%s", status, alias, size ? size : "");
-  else
-    text = g_strdup_printf("%s%s", alias, size ? size : "");
-  setText(text);
-  g_free(size);
-  g_free(text);
-
-  sortIn();
+  if (aspects & ASPECT_TEXT) {
+    // Format contact size.
+    char *size;
+    if (contact_->currentsize > 1)
+      size = g_strdup_printf(" (%d)", contact_->currentsize);
+    else
+      size = nullptr;
 
-  updateColorScheme();
+    // Format contact label.
+    const char *alias = purple_contact_get_alias(contact_);
+    char *text;
+    if (status[0] != '\0')
+      text = g_strdup_printf("%s %s%s", status, alias, size ? size : "");
+    else
+      text = g_strdup_printf("%s%s", alias, size ? size : "");
+    setText(text);
+    g_free(size);
+    g_free(text);
 
-  if (!purple_account_is_connected(purple_buddy_get_account(buddy))) {
-    // Hide if account is offline.
-    setVisibility(false);
+    setFilterName(alias);
   }
-  else
-    setVisibility(status[0] != '\0' || BUDDYLIST->getShowOfflineBuddiesPref());
 
-  updateFilterVisibility(alias);
+  if (aspects & ASPECT_SORT)
+    sortIn();
+
+  if (aspects & ASPECT_COLOR)
+    updateColorScheme();
+
+  if (aspects & ASPECT_VISIBILITY) {
+    if (!getBuddyPresence(buddy).connected) {
+      // Hide if account is offline.
+      setStateVisibility(false);
+    }
+    else
+      setStateVisibility(
+        status[0] != '\0' || BUDDYLIST->getShowOfflineBuddiesPref());
+  }
 }
 
 void BuddyListContact::onActivate(Button &activator)
@@ -999,28 +1090,40 @@ void BuddyListContact::updateColorScheme()
   }
 }
 
-bool BuddyListGroup::lessOrEqual(const BuddyListNode &other) const
+void BuddyListGroup::updateSortKey()
 {
   // If the groups are not sorted but ordered manually then this method is not
   // used.
-
-  const BuddyListGroup *o = dynamic_cast<const BuddyListGroup *>(&other);
-  if (o != nullptr)
-    return g_utf8_collate(purple_group_get_name(group_),
-             purple_group_get_name(o->group_)) <= 0;
-  return lessOrEqualByType(other);
+  setSortKey(0, purple_group_get_name(group_));
 }
 
-void BuddyListGroup::update()
+void BuddyListGroup::update(int aspects)
 {
-  BuddyListNode::update();
+  BuddyListNode::update(aspects);
 
-  setText(purple_group_get_name(group_));
+  if (aspects & ASPECT_TEXT)
+    setText(purple_group_get_name(group_));
 
+  if (aspects & ASPECT_SORT)
+    sortInGroup();
+
+  if (aspects & ASPECT_VISIBILITY) {
+    bool vis = true;
+    if (!BUDDYLIST->getShowEmptyGroupsPref())
+      vis = purple_blist_get_group_size(group_, FALSE);
+    setVisibility(vis);
+  }
+}
+
+void BuddyListGroup::sortInGroup()
+{
   // Sort in the group.
   BuddyList::GroupSortMode mode = BUDDYLIST->getGroupSortMode();
   switch (mode) {
   case BuddyList::GROUP_SORT_BY_USER: {
+    // Groups ordered manually are not kept in the sorted index.
+    removeSortedIn();
+
     // Note that the sorting below works even if there was a contact/chat/buddy
     // node that is attached at the root level of the blist treeview. This
     // happens when such a node was just created (the new_node() callback was
@@ -1049,11 +1152,6 @@ void BuddyListGroup::update()
     sortIn();
     break;
   }
-
-  bool vis = true;
-  if (!BUDDYLIST->getShowEmptyGroupsPref())
-    vis = purple_blist_get_group_size(group_, FALSE);
-  setVisibility(vis);
 }
 
 void BuddyListGroup::onActivate(Button & /*activator*/)
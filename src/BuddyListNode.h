@@ -25,16 +25,41 @@
 #include <cppconsui/MessageDialog.h>
 #include <cppconsui/TreeView.h>
 #include <libpurple/purple.h>
+#include <set>
 
 class BuddyListNode : public CppConsUI::Button {
 public:
+  // Orders nodes according to their cached sort keys.
+  struct SortKeyLess {
+    bool operator()(
+      const BuddyListNode *left, const BuddyListNode *right) const;
+  };
+  // Ordered index of sibling nodes.
+  typedef std::set<BuddyListNode *, SortKeyLess> SortedNodes;
+
+  // Aspects of a node that can be updated separately.
+  enum UpdateAspect {
+    // Parent of the node in the treeview.
+    ASPECT_PARENT = 1 << 0,
+    // Text of the node and the name used for filtering.
+    ASPECT_TEXT = 1 << 1,
+    ASPECT_COLOR = 1 << 2,
+    // Position of the node among its siblings.
+    ASPECT_SORT = 1 << 3,
+    ASPECT_VISIBILITY = 1 << 4,
+    ASPECT_ALL = (1 << 5) - 1,
+    // Aspects that depend on presence of a buddy.
+    ASPECT_PRESENCE =
+      ASPECT_TEXT | ASPECT_COLOR | ASPECT_SORT | ASPECT_VISIBILITY,
+  };
+
   static BuddyListNode *createNode(PurpleBlistNode *node);
 
   // Widget
   virtual void setParent(CppConsUI::Container &parent) override;
 
-  virtual bool lessOrEqual(const BuddyListNode &other) const = 0;
-  virtual void update();
+  // Updates given aspects of the node, see UpdateAspect.
+  virtual void update(int aspects);
   virtual void onActivate(CppConsUI::Button &activator) = 0;
   // Debugging method.
   virtual const char *toString() const = 0;
@@ -44,12 +69,41 @@ public:
 
   PurpleBlistNode *getPurpleBlistNode() const { return blist_node_; }
 
+  // Sets the last activity time, the caller is responsible for re-sorting the
+  // node.
+  void setLastActivity(int activity) { last_activity_ = activity; }
+
   // Sorts in this node.
   void sortIn();
+  // Recomputes the cached sort key of a node that is not sorted in yet. Used
+  // when the list is built in bulk.
+  void prepareSortKey() { updateSortKey(); }
 
   BuddyListNode *getParentNode() const;
 
+  // Returns the case-folded name that is matched by the buddy list filter, or
+  // nullptr if the node is not subject to filtering.
+  const char *getFilterName() const { return filter_name_; }
+  // Sets whether the node matches the buddy list filter and updates its
+  // visibility accordingly.
+  void setFilterMatch(bool match);
+
+  // Returns the approximate number of bytes held by the node, including its
+  // strings and the index of its children.
+  std::size_t getMemoryUsage() const;
+
 protected:
+  // Presence state of a buddy, cached by BuddyListBuddy.
+  struct BuddyPresence {
+    // Whether the account of the buddy is connected.
+    bool connected;
+    PurpleStatusPrimitive primitive;
+    // Presence status char, see Utils::getStatusIndicator().
+    const char *indicator;
+    // Weight of the status, used for sorting.
+    int weight;
+  };
+
   class ContextMenu : public CppConsUI::MenuWindow {
   public:
     ContextMenu(BuddyListNode &parent_node);
@@ -72,16 +126,46 @@ protected:
 
   PurpleBlistNode *blist_node_;
 
-  // Cached value of purple_blist_node_get_int(blist_node, "last_activity").
+  // Last activity time. Initialized from the "last_activity" blist setting and
+  // then kept up to date by BuddyList, which saves it back in batches.
   int last_activity_;
 
+  char *filter_name_;
+  bool filter_match_;
+  // Visibility of the node when no filter is active.
+  bool state_visible_;
+
+  // Cached sort key. Siblings are ordered by their type (groups < contacts <
+  // buddies < chats), then by the sort weight (higher first) and then by the
+  // name. The key is updated only when the node is sorted in, so that the
+  // index it is stored in stays consistent.
+  int sort_weight_;
+  char *sort_name_;
+  // Collation key of sort_name_, recomputed only when the name changes.
+  char *sort_collate_key_;
+  // Children of this node ordered by their sort keys.
+  SortedNodes sorted_children_;
+  // Index that this node is currently stored in, or nullptr.
+  SortedNodes *sorted_in_;
+
   BuddyListNode(PurpleBlistNode *node_);
   virtual ~BuddyListNode();
 
   virtual void openContextMenu() = 0;
 
-  bool lessOrEqualByType(const BuddyListNode &other) const;
-  bool lessOrEqualByBuddySort(PurpleBuddy *left, PurpleBuddy *right) const;
+  // Recomputes the cached sort key.
+  virtual void updateSortKey() = 0;
+  void setSortKey(int weight, const char *name);
+  // Sets the sort key of a buddy or contact according to the buddy sort mode.
+  void setBuddySortKey(PurpleBuddy *buddy);
+  // Removes the node from the index of its siblings.
+  void removeSortedIn();
+
+  // Queries libpurple for the current presence state of a buddy.
+  static BuddyPresence queryBuddyPresence(PurpleBuddy *buddy);
+  // Returns the cached presence state of a buddy, libpurple is queried only if
+  // the buddy does not have a BuddyListBuddy node.
+  BuddyPresence getBuddyPresence(PurpleBuddy *buddy) const;
 
   // Called by BuddyListBuddy and BuddyListContact to get presence status char.
   // Returned value should be used as a prefix of buddy/contact name.
@@ -93,7 +177,12 @@ protected:
 
   int getColorSchemeByBuddy(int base_scheme, PurpleBuddy *buddy);
 
-  void updateFilterVisibility(const char *name);
+  // Sets visibility of the node as given by its state, the node is shown only
+  // if it also matches the filter.
+  void setStateVisibility(bool visible);
+  // Sets the name used for filtering and registers the node in the buddy list
+  // filter index.
+  void setFilterName(const char *name);
 
   void retrieveUserInfoForName(PurpleConnection *gc, const char *name) const;
 
@@ -109,14 +198,18 @@ class BuddyListBuddy : public BuddyListNode {
 
 public:
   // BuddyListNode
-  virtual bool lessOrEqual(const BuddyListNode &other) const override;
-  virtual void update() override;
+  virtual void update(int aspects) override;
   virtual void onActivate(Button &activator) override;
   virtual const char *toString() const override;
 
   PurpleBuddy *getPurpleBuddy() const { return buddy_; }
   void retrieveUserInfo();
 
+  // Refreshes the cached presence state, called when the presence of the
+  // buddy or the status of its account changes.
+  void updatePresence() { presence_ = queryBuddyPresence(buddy_); }
+  const BuddyPresence &getPresence() const { return presence_; }
+
 protected:
   class BuddyContextMenu : public ContextMenu {
   public:
@@ -141,6 +234,7 @@ protected:
   };
 
   PurpleBuddy *buddy_;
+  BuddyPresence presence_;
 
   // Widget
   virtual int getAttributes(int property, int subproperty, int *attrs,
@@ -148,6 +242,7 @@ protected:
 
   // BuddyListNode
   virtual void openContextMenu() override;
+  virtual void updateSortKey() override;
 
   void updateColorScheme();
 
@@ -162,8 +257,7 @@ class BuddyListChat : public BuddyListNode {
 
 public:
   // BuddyListNode
-  virtual bool lessOrEqual(const BuddyListNode &other) const override;
-  virtual void update() override;
+  virtual void update(int aspects) override;
   virtual void onActivate(Button &activator) override;
   virtual const char *toString() const override;
 
@@ -194,6 +288,7 @@ protected:
 
   // BuddyListNode
   virtual void openContextMenu() override;
+  virtual void updateSortKey() override;
 
 private:
   BuddyListChat(PurpleBlistNode *node);
@@ -206,8 +301,7 @@ class BuddyListContact : public BuddyListNode {
 
 public:
   // BuddyListNode
-  virtual bool lessOrEqual(const BuddyListNode &other) const override;
-  virtual void update() override;
+  virtual void update(int aspects) override;
   virtual void onActivate(Button &activator) override;
   virtual const char *toString() const override;
   virtual void setRefNode(CppConsUI::TreeView::NodeReference n) override;
@@ -255,6 +349,7 @@ protected:
 
   // BuddyListNode
   virtual void openContextMenu() override;
+  virtual void updateSortKey() override;
 
   void updateColorScheme();
 
@@ -269,8 +364,7 @@ class BuddyListGroup : public BuddyListNode {
 
 public:
   // BuddyListNode
-  virtual bool lessOrEqual(const BuddyListNode &other) const override;
-  virtual void update() override;
+  virtual void update(int aspects) override;
   virtual void onActivate(Button &activator) override;
   virtual const char *toString() const override;
   virtual void setRefNode(CppConsUI::TreeView::NodeReference n) override;
@@ -306,6 +400,9 @@ protected:
 
   // BuddyListNode
   virtual void openContextMenu() override;
+  virtual void updateSortKey() override;
+
+  void sortInGroup();
 
 private:
   BuddyListGroup(PurpleBlistNode *node);
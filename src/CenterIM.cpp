@@ -21,12 +21,15 @@
 #include "Accounts.h"
 #include "BuddyList.h"
 #include "Connections.h"
+#include "ConversationLogCompactor.h"
 #include "Conversations.h"
+#include "FileWriter.h"
 #include "Footer.h"
 #include "Header.h"
 #include "Log.h"
 #include "Notify.h"
 #include "Request.h"
+#include "SearchIndex.h"
 #include "Transfers.h"
 
 #include "AccountStatusMenu.h"
@@ -391,7 +394,9 @@ CenterIM::CenterIM()
   : mainloop_(nullptr), mainloop_error_exit_(false), mngr_(nullptr),
     convs_expanded_(false), idle_reporting_on_keyboard_(false),
     stdin_timeout_id_(0), resize_pending_(false),
-    sigwinch_write_error_(nullptr), sigwinch_write_error_size_(0)
+    sigwinch_write_error_(nullptr), sigwinch_write_error_size_(0),
+    startup_profile_(false), startup_finished_(false),
+    startup_first_frame_(false), startup_time_(0), startup_report_(nullptr)
 {
   resize_pipe_[0] = -1;
   resize_pipe_[1] = -1;
@@ -421,11 +426,15 @@ int CenterIM::run(int argc, char *argv[])
 
 int CenterIM::runAll(int argc, char *argv[])
 {
+  // Startup phases are measured from this point.
+  startup_time_ = g_get_monotonic_time();
+
   int res = 1;
   bool cppconsui_input_initialized = false;
   bool cppconsui_output_initialized = false;
   bool screen_resizing_initialized = false;
   bool purple_initialized = false;
+  int logs_lock = -1;
   CppConsUI::Error error;
   guint stdin_watch_handle;
   guint resize_watch_handle;
@@ -450,16 +459,19 @@ int CenterIM::runAll(int argc, char *argv[])
   // Parse command-line arguments.
   bool ascii = false;
   bool offline = false;
+  bool compact_logs = false;
   const char *config_path = CIM_CONFIG_PATH;
   int opt;
   // clang-format off
   struct option long_options[] = {
-    {"ascii",   no_argument,       nullptr, 'a'},
-    {"help",    no_argument,       nullptr, 'h'},
-    {"version", no_argument,       nullptr, 'v'},
-    {"basedir", required_argument, nullptr, 'b'},
-    {"offline", no_argument,       nullptr, 'o'},
-    {nullptr,   0,                 nullptr,  0 }
+    {"ascii",           no_argument,       nullptr, 'a'},
+    {"help",            no_argument,       nullptr, 'h'},
+    {"version",         no_argument,       nullptr, 'v'},
+    {"basedir",         required_argument, nullptr, 'b'},
+    {"offline",         no_argument,       nullptr, 'o'},
+    {"compact-logs",    no_argument,       nullptr, 'c'},
+    {"startup-profile", no_argument,       nullptr, 'p'},
+    {nullptr,           0,                 nullptr,  0 }
   };
   // clang-format on
 
@@ -481,6 +493,12 @@ int CenterIM::runAll(int argc, char *argv[])
     case 'o':
       offline = true;
       break;
+    case 'c':
+      compact_logs = true;
+      break;
+    case 'p':
+      startup_profile_ = true;
+      break;
     default:
       printUsage(stderr, argv[0]);
       return 1;
@@ -493,11 +511,19 @@ int CenterIM::runAll(int argc, char *argv[])
     return 1;
   }
 
+  // Run the log maintenance without starting the UI or libpurple.
+  if (compact_logs) {
+    initializeUserDir(config_path);
+    ConversationLogCompactor compactor;
+    return compactor.run();
+  }
+
   // Initialize the internal logger. It will buffer all messages produced by
   // GLib, libpurple, or CppConsUI until it is possible to output them on the
   // screen (in the log window). If any part of the initialization fails the
   // buffered messages will be printed on stderr.
   Log::init();
+  markStartupPhase(_("command line and locale"));
 
   // Create the main loop.
   mainloop_ = g_main_loop_new(nullptr, FALSE);
@@ -543,6 +569,7 @@ int CenterIM::runAll(int argc, char *argv[])
     goto out;
   }
   screen_resizing_initialized = true;
+  markStartupPhase(_("CppConsUI initialization"));
 
   // Initialize libpurple.
   if (initializePurple(config_path) != 0) {
@@ -550,17 +577,31 @@ int CenterIM::runAll(int argc, char *argv[])
     goto out;
   }
   purple_initialized = true;
+  markStartupPhase(_("libpurple initialization"));
 
   // Initialize global preferences.
   initializePreferences();
 
+  // Start the asynchronous file writer. It is used by the logfile and
+  // conversation logs.
+  FileWriter::init();
+
+  // Keep the conversation logs locked while they can be written so that they
+  // are not compacted at the same time.
+  logs_lock = ConversationLogCompactor::lockLogs(false);
+  if (logs_lock == -1)
+    LOG->warning(_("Error locking conversation logs (%s)."), g_strerror(errno));
+
   // Initialize the log window.
   LOG->initNormalPhase();
+  markStartupPhase(_("preferences and log window"));
 
   // Init colorschemes and keybinds after the Log is initialized so the user can
   // see if there is any error in the configs.
   loadColorSchemeConfig();
+  markStartupPhase(_("color scheme config"));
   loadKeyConfig();
+  markStartupPhase(_("key config"));
 
   Footer::init();
 
@@ -569,17 +610,24 @@ int CenterIM::runAll(int argc, char *argv[])
   Notify::init();
   Request::init();
 
+  // Open the search index before any conversation can write to it.
+  SearchIndex::init();
+  markStartupPhase(_("accounts, connections and search index"));
+
   // Initialize UI.
   Conversations::init();
   Header::init();
+  markStartupPhase(_("conversations and header"));
   // Init BuddyList last so it takes the focus.
   BuddyList::init();
+  markStartupPhase(_("buddy list window"));
 
   LOG->info(_("Welcome to CenterIM 5. Press %s to display main menu."),
     KEYCONFIG->getKeyBind("centerim", "generalmenu"));
 
   // Restore last know status on all accounts.
   ACCOUNTS->restoreStatuses(offline);
+  markStartupPhase(_("status restoration"));
 
   mngr_->setTopInputProcessor(*this);
   mngr_->onScreenResized();
@@ -631,6 +679,8 @@ int CenterIM::runAll(int argc, char *argv[])
   Header::finalize();
   BuddyList::finalize();
 
+  SearchIndex::finalize();
+
   Accounts::finalize();
   Connections::finalize();
   Notify::finalize();
@@ -640,12 +690,18 @@ int CenterIM::runAll(int argc, char *argv[])
 
   LOG->finalizeNormalPhase();
 
+  // Write out all pending data.
+  FileWriter::finalize();
+
   if (!mainloop_error_exit_) {
     // Everything went ok.
     res = 0;
   }
 
 out:
+  if (logs_lock != -1)
+    close(logs_lock);
+
   // Finalize libpurple.
   if (purple_initialized)
     finalizePurple();
@@ -671,6 +727,13 @@ out:
   // are any) on stderr.
   Log::finalize();
 
+  // Print the startup profile now that the terminal is restored.
+  if (startup_report_ != nullptr) {
+    std::fprintf(stderr, "%s\n", startup_report_);
+    g_free(startup_report_);
+    startup_report_ = nullptr;
+  }
+
   return res;
 }
 
@@ -684,7 +747,12 @@ void CenterIM::printUsage(FILE *out, const char *prg_name)
 "  -h, --help                 display command line usage\n"
 "  -v, --version              show the program version info\n"
 "  -b, --basedir <directory>  specify another base directory\n"
-"  -o, --offline              start with all accounts set offline\n"),
+"  -o, --offline              start with all accounts set offline\n"
+"      --compact-logs         convert conversation logs to the binary format\n"
+"                             and exit, HTML markup is removed from the\n"
+"                             messages\n"
+"      --startup-profile      measure duration of startup phases and print\n"
+"                             them on exit\n"),
     prg_name);
   // clang-format on
 }
@@ -694,7 +762,7 @@ void CenterIM::printVersion(FILE *out)
   std::fprintf(out, "CenterIM %s\n", version_);
 }
 
-int CenterIM::initializePurple(const char *config_path)
+void CenterIM::initializeUserDir(const char *config_path)
 {
   g_assert(config_path != nullptr);
 
@@ -709,6 +777,11 @@ int CenterIM::initializePurple(const char *config_path)
     purple_util_set_user_dir(path);
     g_free(path);
   }
+}
+
+int CenterIM::initializePurple(const char *config_path)
+{
+  initializeUserDir(config_path);
 
   // This does not disable debugging, but rather it disables printing to stdout.
   // Do not change this to TRUE or things will get messy.
@@ -852,6 +925,49 @@ void CenterIM::finalizeScreenResizing()
   resize_pipe_[1] = -1;
 }
 
+void CenterIM::markStartupPhase(const char *name)
+{
+  // Phases after the first frame are not part of the startup.
+  if (!startup_profile_ || startup_report_ != nullptr)
+    return;
+
+  StartupPhase phase;
+  phase.name = name;
+  phase.time = g_get_monotonic_time();
+  startup_phases_.push_back(phase);
+}
+
+void CenterIM::finishStartup()
+{
+  if (!startup_profile_ || startup_finished_)
+    return;
+
+  markStartupPhase(_("buddy list population"));
+  startup_finished_ = true;
+
+  // The first frame is usually drawn while the buddy list is still being
+  // populated, otherwise draw() outputs the profile.
+  if (startup_first_frame_)
+    reportStartupProfile();
+}
+
+void CenterIM::reportStartupProfile()
+{
+  GString *report = g_string_new(_("Startup profile:"));
+  gint64 prev = startup_time_;
+  for (const StartupPhase &phase : startup_phases_) {
+    g_string_append_printf(report, _("\n  %-40s %8.1f ms"), phase.name,
+      (phase.time - prev) / 1000.0);
+    prev = phase.time;
+  }
+  g_string_append_printf(report, _("\n  %-40s %8.1f ms"), _("total"),
+    (prev - startup_time_) / 1000.0);
+  startup_report_ = g_string_free(report, FALSE);
+
+  // Show the profile also in the Log window.
+  LOG->info("%s", startup_report_);
+}
+
 void CenterIM::onScreenResized()
 {
   CppConsUI::Rect size;
@@ -1065,6 +1181,14 @@ gboolean CenterIM::draw()
     // Exit the program.
     mainloop_error_exit_ = true;
     g_main_loop_quit(mainloop_);
+    return FALSE;
+  }
+
+  if (startup_profile_ && !startup_first_frame_) {
+    markStartupPhase(_("first frame"));
+    startup_first_frame_ = true;
+    if (startup_finished_)
+      reportStartupProfile();
   }
   return FALSE;
 }
@@ -95,6 +95,14 @@ public:
   sigc::connection timeoutOnceConnect(const sigc::slot<void> &slot,
     unsigned interval, int priority = G_PRIORITY_DEFAULT);
 
+  // Records the end of a startup phase when the startup profiling is enabled.
+  // The name has to be a static string.
+  void markStartupPhase(const char *name);
+  // Called when the last deferred startup task (populating the buddy list)
+  // finishes. The startup profile ends with it, or with the first drawn frame
+  // if no frame has been drawn yet.
+  void finishStartup();
+
 private:
   struct IOClosurePurple {
     PurpleInputFunction function;
@@ -104,6 +112,13 @@ private:
     IOClosurePurple() : function(nullptr), result(0), data(nullptr) {}
   };
 
+  struct StartupPhase {
+    const char *name;
+    // End of the phase in the monotonic time.
+    gint64 time;
+  };
+  typedef std::vector<StartupPhase> StartupPhases;
+
   GMainLoop *mainloop_;
   bool mainloop_error_exit_;
   CppConsUI::CoreManager *mngr_;
@@ -124,6 +139,14 @@ private:
 
   CppConsUI::Rect areas_[AREAS_NUM];
 
+  // Startup profiling, enabled by the --startup-profile option.
+  bool startup_profile_;
+  bool startup_finished_;
+  bool startup_first_frame_;
+  gint64 startup_time_;
+  StartupPhases startup_phases_;
+  char *startup_report_;
+
   static const char *color_names_[];
   static const char *scheme_names_[];
 
@@ -139,10 +162,14 @@ private:
   int runAll(int argc, char *argv[]);
   void printUsage(FILE *out, const char *prg_name);
   void printVersion(FILE *out);
+  void initializeUserDir(const char *config_path);
   int initializePurple(const char *config_path);
   void finalizePurple();
   void initializePreferences();
 
+  // Outputs the startup profile.
+  void reportStartupProfile();
+
   int initializeScreenResizing();
   void finalizeScreenResizing();
 
@@ -19,18 +19,30 @@
 #include "Conversation.h"
 
 #include "BuddyList.h"
+#include "ConversationLogFormat.h"
 #include "Conversations.h"
 #include "Footer.h"
+#include "SearchIndex.h"
+#include "Utils.h"
 
 #include "gettext.h"
+#include <algorithm>
+#include <cerrno>
 #include <cppconsui/ColorScheme.h>
 #include <cstdlib>
 #include <cstring>
+#include <glib/gstdio.h>
 #include <sys/stat.h>
 
+// Maximum number of lines of unlogged messages (for instance, echoed commands)
+// that are kept to be shown again after the conversation wakes up.
+#define CONVERSATION_MAX_UNLOGGED_LINES 100
+
 Conversation::Conversation(PurpleConversation *conv)
   : Window(0, 0, 80, 24), conv_(conv), filename_(nullptr), logfile_(nullptr),
-    input_text_length_(0), room_list_(nullptr), room_list_line_(nullptr)
+    history_lines_(0), log_position_pending_(false), log_position_(0),
+    hibernated_(true), input_text_length_(0),
+    room_list_(nullptr), room_list_line_(nullptr)
 {
   g_assert(conv_ != nullptr);
 
@@ -60,18 +72,23 @@ Conversation::Conversation(PurpleConversation *conv)
 
   input_->grabFocus();
 
-  // Open logfile.
+  // Open logfile. Reading it and its index is deferred until the conversation
+  // is shown or a message is logged.
   buildLogFilename();
 
   GError *err = nullptr;
-  logfile_ = g_io_channel_new_file(filename_, "a", &err);
+  logfile_ = FILEWRITER->openFile(filename_, true, &err);
   if (logfile_ == nullptr) {
     LOG->error(_("Error opening conversation logfile '%s' (%s)."), filename_,
       err->message);
     g_clear_error(&err);
   }
 
-  loadHistory();
+  // The conversation starts without its scrollback. Conversations created in
+  // the background (for instance, auto-joined rooms) read their logfile only
+  // when they are shown for the first time.
+  history_loader_.signal_message.connect(
+    sigc::mem_fun(this, &Conversation::onHistoryMessage));
 
   onScreenResized();
   declareBindables();
@@ -81,7 +98,7 @@ Conversation::~Conversation()
 {
   g_free(filename_);
   if (logfile_ != nullptr)
-    g_io_channel_unref(logfile_);
+    FILEWRITER->closeFile(logfile_);
 }
 
 bool Conversation::processInput(const TermKeyKey &key)
@@ -160,6 +177,9 @@ void Conversation::show()
   // necessary.
   view_->setScrollBar(!CENTERIM->isEnabledExpandedConversationMode());
 
+  if (hibernated_)
+    wakeUp();
+
   Window::show();
 }
 
@@ -172,6 +192,123 @@ void Conversation::close()
   purple_conversation_destroy(conv_);
 }
 
+void Conversation::showLogPosition(guint64 offset)
+{
+  if (hibernated_)
+    wakeUp();
+
+  std::size_t line;
+  if (findMessageLine(offset, &line)) {
+    log_position_pending_ = false;
+    view_->scrollToLine(line);
+    return;
+  }
+
+  // Wait until the message is loaded.
+  if (history_loader_.isLoading()) {
+    log_position_pending_ = true;
+    log_position_ = offset;
+  }
+}
+
+bool Conversation::showLogTime(time_t time)
+{
+  // A hibernated conversation does not hold its index.
+  if (hibernated_)
+    wakeUp();
+
+  // The sidecar index finds the message without reading the logfile.
+  std::size_t i = log_index_.findByTime(time);
+  if (i >= log_index_.getMessageCount())
+    return false;
+
+  showLogPosition(log_index_.getEntry(i).offset);
+  return true;
+}
+
+void Conversation::hibernate()
+{
+  if (hibernated_ || logfile_ == nullptr || history_loader_.isLoading())
+    return;
+
+  view_->clear();
+  history_lines_ = 0;
+  // Release the memory, clear() keeps the capacity.
+  MessageLines().swap(history_message_lines_);
+  MessageLines().swap(new_message_lines_);
+  log_position_pending_ = false;
+  log_index_.release();
+
+  hibernated_ = true;
+}
+
+void Conversation::wakeUp()
+{
+  g_assert(hibernated_);
+
+  hibernated_ = false;
+
+  // Messages written while hibernated (or by a previous instance of this
+  // conversation) have to reach the logfile before it is read. Only writes to
+  // this logfile are waited for, not the whole FileWriter queue.
+  if (logfile_ != nullptr)
+    FILEWRITER->flush(logfile_);
+  // Load the index, messages written while hibernated are indexed from the
+  // logfile.
+  if (logfile_ != nullptr && !log_index_.isLoaded())
+    openLogIndex();
+  loadHistory();
+
+  // The history is inserted before these lines.
+  for (const UnloggedLine &line : unlogged_lines_)
+    view_->append(line.text.c_str(), line.color);
+}
+
+void Conversation::openLogIndex()
+{
+  // New logfiles are created in the binary format if it is enabled.
+  bool binary = false;
+  if (!log_index_.isOpen()) {
+    GStatBuf st;
+    binary = g_stat(filename_, &st) == 0 && st.st_size == 0 &&
+      std::strcmp(
+        purple_prefs_get_string(CONF_PREFIX "/chat/log_format"), "binary") == 0;
+  }
+
+  // A hibernated conversation only needs to know where new messages start.
+  if (hibernated_)
+    log_index_.openForAppend(filename_);
+  else
+    log_index_.open(filename_);
+
+  if (binary) {
+    FILEWRITER->write(logfile_, g_strndup(ConversationLogFormat::HEADER,
+                                  ConversationLogFormat::HEADER_SIZE),
+      ConversationLogFormat::HEADER_SIZE);
+    log_index_.startBinaryLog();
+    SEARCHINDEX->addLogHeader(filename_, ConversationLogFormat::HEADER_SIZE);
+  }
+}
+
+void Conversation::reportMemoryUsage(MemoryReport &report) const
+{
+  const char *name = purple_conversation_get_name(conv_);
+
+  // Count the tables of message lines with the lines.
+  CppConsUI::MemoryUsage lines = view_->getLinesMemoryUsage();
+  lines.bytes += (history_message_lines_.capacity() +
+                   new_message_lines_.capacity()) *
+    sizeof(MessageLine);
+
+  char *entry = g_strdup_printf(_("Conversation %s, lines"), name);
+  report.add(entry, lines);
+  g_free(entry);
+
+  entry = g_strdup_printf(_("Conversation %s, screen lines"), name);
+  report.add(entry, view_->getScreenLinesMemoryUsage());
+  g_free(entry);
+}
+
 void Conversation::onScreenResized()
 {
   CppConsUI::Rect r = CENTERIM->getScreenArea(CenterIM::CHAT_AREA);
@@ -192,70 +329,113 @@ void Conversation::write(const char *name, const char * /*alias*/,
       LOG->error("%s", error.getString());
   }
 
-  // Update the last_activity property.
+  // Update the last activity of the buddy.
   PurpleConversationType type = purple_conversation_get_type(conv_);
   time_t cur_time = time(nullptr);
 
   if (type == PURPLE_CONV_TYPE_IM) {
-    PurpleBlistNode *bnode = PURPLE_BLIST_NODE(
-      purple_find_buddy(purple_conversation_get_account(conv_),
-        purple_conversation_get_name(conv_)));
-    if (bnode) {
-      purple_blist_node_set_int(bnode, "last_activity", cur_time);
-
-      // Inform the buddy list node that it should update its state.
-      BUDDYLIST->updateNode(bnode);
-    }
+    PurpleAccount *account = purple_conversation_get_account(conv_);
+    PurpleBuddy *buddy =
+      purple_find_buddy(account, purple_conversation_get_name(conv_));
+    if (buddy != nullptr)
+      BUDDYLIST->updateActivity(buddy, cur_time);
   }
 
   // Write the message.
   int color;
   const char *dir;
   const char *mtype;
+  guint32 record_flags;
   if (flags & PURPLE_MESSAGE_SEND) {
     dir = "OUT";
     mtype = "MSG2"; // cim5 message.
+    record_flags = ConversationLogFormat::RECORD_OUT;
     color = 1;
   }
   else if (flags & PURPLE_MESSAGE_RECV) {
     dir = "IN";
     mtype = "MSG2"; // cim5 message.
+    record_flags = ConversationLogFormat::RECORD_IN;
     color = 2;
   }
   else {
     dir = "IN";
     mtype = "OTHER";
+    record_flags = ConversationLogFormat::RECORD_OTHER;
     color = 0;
   }
 
+  bool logged = !(flags & PURPLE_MESSAGE_NO_LOG) && logfile_ != nullptr;
+
+  // We currently do not support displaying HTML in any way.
+  char *nohtml = Utils::stripHTML(message);
+
   // Write text into logfile.
-  if (!(flags & PURPLE_MESSAGE_NO_LOG)) {
-    char *log_msg;
+  if (logged) {
+    if (!log_index_.isOpen()) {
+      // Make sure that all pending writes to the log (for instance, from
+      // a previous instance of this conversation) are finished before its size
+      // is read.
+      FILEWRITER->flush(logfile_);
+      openLogIndex();
+    }
+
+    char *text;
     if (type == PURPLE_CONV_TYPE_CHAT)
-      log_msg = g_strdup_printf("\f\n%s\n%s\n%lu\n%lu\n%s: %s\n", dir, mtype,
-        mtime, cur_time, name, message);
+      text = g_strdup_printf("%s: %s", name, nohtml);
     else
-      log_msg = g_strdup_printf(
-        "\f\n%s\n%s\n%lu\n%lu\n%s\n", dir, mtype, mtime, cur_time, message);
-    if (logfile_ != nullptr) {
-      GError *err = nullptr;
-      if (g_io_channel_write_chars(logfile_, log_msg, -1, nullptr, &err) !=
-        G_IO_STATUS_NORMAL) {
-        LOG->error(
-          _("Error writing to conversation logfile (%s)."), err->message);
-        g_clear_error(&err);
+      text = g_strdup(nohtml);
+
+    char *log_msg;
+    gsize length;
+    if (log_index_.isBinaryLog()) {
+      // The binary format stores only valid UTF-8 text.
+      if (!g_utf8_validate(text, -1, nullptr)) {
+        char *valid = purple_utf8_salvage(text);
+        g_free(text);
+        text = valid;
       }
-      if (g_io_channel_flush(logfile_, &err) != G_IO_STATUS_NORMAL) {
-        LOG->error(
-          _("Error flushing conversation logfile (%s)."), err->message);
-        g_clear_error(&err);
+
+      // Cut off an extremely long message, the format limits the text length.
+      gsize text_length = std::strlen(text);
+      if (text_length > ConversationLogFormat::MAX_TEXT_LENGTH) {
+        const char *end = text + ConversationLogFormat::MAX_TEXT_LENGTH + 1;
+        text_length = g_utf8_find_prev_char(text, end) - text;
       }
+
+      ConversationLogFormat::Record record = {
+        record_flags, mtime, cur_time, text, text_length};
+      log_msg = ConversationLogFormat::encodeRecord(record, &length);
     }
-    g_free(log_msg);
+    else {
+      if (type == PURPLE_CONV_TYPE_CHAT)
+        log_msg = g_strdup_printf("\f\n%s\n%s\n%lu\n%lu\n%s: %s\n", dir,
+          mtype, mtime, cur_time, name, message);
+      else
+        log_msg = g_strdup_printf(
+          "\f\n%s\n%s\n%lu\n%lu\n%s\n", dir, mtype, mtime, cur_time, message);
+      length = std::strlen(log_msg);
+    }
+
+    // The writer takes ownership of log_msg.
+    FILEWRITER->write(logfile_, log_msg, length);
+    guint64 offset = log_index_.append(mtime, cur_time, length);
+
+    // Remember where the message is shown and make it searchable. A hibernated
+    // conversation picks the message up from the logfile when it wakes up.
+    if (!hibernated_) {
+      MessageLine message_line = {
+        offset, view_->getLinesNumber() - history_lines_};
+      new_message_lines_.push_back(message_line);
+    }
+    SEARCHINDEX->addMessage(filename_, offset, length, cur_time, text);
+    g_free(text);
   }
 
-  // We currently do not support displaying HTML in any way.
-  char *nohtml = stripHTML(message);
+  if (hibernated_ && logged) {
+    g_free(nohtml);
+    return;
+  }
 
   // Write text to the window.
   char *time = extractTime(mtime, cur_time);
@@ -264,7 +444,16 @@ void Conversation::write(const char *name, const char * /*alias*/,
     msg = g_strdup_printf("%s %s: %s", time, name, nohtml);
   else
     msg = g_strdup_printf("%s %s", time, nohtml);
-  view_->append(msg, color);
+  if (!logged) {
+    // A message that is not logged cannot be restored from the logfile, keep
+    // it for when the conversation is woken up again.
+    UnloggedLine line = {msg, color};
+    unlogged_lines_.push_back(line);
+    if (unlogged_lines_.size() > CONVERSATION_MAX_UNLOGGED_LINES)
+      unlogged_lines_.pop_front();
+  }
+  if (!hibernated_)
+    view_->append(msg, color);
   g_free(nohtml);
   g_free(time);
   g_free(msg);
@@ -316,159 +505,6 @@ int Conversation::ConversationLine::draw(
   return 0;
 }
 
-char *Conversation::stripHTML(const char *str) const
-{
-  // Almost copy&paste from libpurple/util.c:purple_markup_strip_html(), but
-  // this version does not convert tab character to a space.
-
-  if (str == nullptr)
-    return nullptr;
-
-  int i, j, k, entlen;
-  bool visible = true;
-  bool closing_td_p = false;
-  gchar *str2;
-  const gchar *cdata_close_tag = nullptr, *ent;
-  gchar *href = nullptr;
-  int href_st = 0;
-
-  str2 = g_strdup(str);
-
-  for (i = 0, j = 0; str2[i] != '\0'; ++i) {
-    if (str2[i] == '<') {
-      if (cdata_close_tag) {
-        // Note: Do not even assume any other tag is a tag in CDATA.
-        if (g_ascii_strncasecmp(
-              str2 + i, cdata_close_tag, !strlen(cdata_close_tag))) {
-          i += strlen(cdata_close_tag) - 1;
-          cdata_close_tag = nullptr;
-        }
-        continue;
-      }
-      else if (!g_ascii_strncasecmp(str2 + i, "<td", 3) && closing_td_p) {
-        str2[j++] = '\t';
-        visible = true;
-      }
-      else if (!g_ascii_strncasecmp(str2 + i, "</td>", 5)) {
-        closing_td_p = true;
-        visible = false;
-      }
-      else {
-        closing_td_p = false;
-        visible = true;
-      }
-
-      k = i + 1;
-
-      if (g_ascii_isspace(str2[k]))
-        visible = true;
-      else if (str2[k]) {
-        // Scan until we end the tag either implicitly (closed start tag) or
-        // explicitly, using a sloppy method (i.e., < or > inside quoted
-        // attributes will screw us up).
-        while (str2[k] != '\0' && str2[k] != '<' && str2[k] != '>')
-          ++k;
-
-        // If we have got an <a> tag with an href, save the address to print
-        // later.
-        if (g_ascii_strncasecmp(str2 + i, "<a", 2) == 0 &&
-          g_ascii_isspace(str2[i + 2])) {
-          int st;  // Start of href, inclusive [.
-          int end; // End of href, exclusive ).
-          char delim = ' ';
-          // Find start of href.
-          for (st = i + 3; st < k; ++st) {
-            if (g_ascii_strncasecmp(str2 + st, "href=", 5) == 0) {
-              st += 5;
-              if (str2[st] == '"' || str2[st] == '\'') {
-                delim = str2[st];
-                ++st;
-              }
-              break;
-            }
-          }
-          // Find end of address.
-          for (end = st; end < k && str2[end] != delim; ++end) {
-            // All the work is done in the loop construct above.
-          }
-
-          // If there is an address, save it. If there was already one saved,
-          // kill it.
-          if (st < k) {
-            char *tmp;
-            g_free(href);
-            tmp = g_strndup(str2 + st, end - st);
-            href = purple_unescape_html(tmp);
-            g_free(tmp);
-            href_st = j;
-          }
-        }
-
-        // Replace </a> with an ascii representation of the address the link was
-        // pointing to.
-        else if (href != nullptr &&
-          g_ascii_strncasecmp(str2 + i, "</a>", 4) == 0) {
-          std::size_t hrlen = std::strlen(href);
-
-          // Only insert the href if it is different from the CDATA.
-          // 7 == strlen("http://").
-          if ((hrlen != (unsigned)(j - href_st) ||
-                std::strncmp(str2 + href_st, href, hrlen)) != 0 &&
-            (hrlen != (unsigned)(j - href_st + 7) ||
-                std::strncmp(str2 + href_st, href + 7, hrlen - 7) != 0)) {
-            str2[j++] = ' ';
-            str2[j++] = '(';
-            g_memmove(str2 + j, href, hrlen);
-            j += hrlen;
-            str2[j++] = ')';
-            g_free(href);
-            href = nullptr;
-          }
-        }
-
-        // Check for tags which should be mapped to newline (but ignore some of
-        // the tags at the beginning of the text).
-        else if ((j != 0 && (g_ascii_strncasecmp(str2 + i, "<p>", 3) == 0 ||
-                              g_ascii_strncasecmp(str2 + i, "<tr", 3) == 0 ||
-                              g_ascii_strncasecmp(str2 + i, "<hr", 3) == 0 ||
-                              g_ascii_strncasecmp(str2 + i, "<li", 3) == 0 ||
-                              g_ascii_strncasecmp(str2 + i, "<div", 4) == 0)) ||
-          g_ascii_strncasecmp(str2 + i, "<br", 3) == 0 ||
-          g_ascii_strncasecmp(str2 + i, "</table>", 8) == 0)
-          str2[j++] = '\n';
-        else if (g_ascii_strncasecmp(str2 + i, "<script", 7) == 0)
-          cdata_close_tag = "</script>";
-        else if (g_ascii_strncasecmp(str2 + i, "<style", 6) == 0)
-          cdata_close_tag = "</style>";
-        // Update the index and continue checking after the tag.
-        i = (str2[k] == '<' || str2[k] == '\0') ? k - 1 : k;
-        continue;
-      }
-    }
-    else if (cdata_close_tag)
-      continue;
-    else if (!g_ascii_isspace(str2[i]))
-      visible = true;
-
-    if (str2[i] == '&' &&
-      (ent = purple_markup_unescape_entity(str2 + i, &entlen))) {
-      while (*ent != '\0')
-        str2[j++] = *ent++;
-      i += entlen - 1;
-      continue;
-    }
-
-    if (visible)
-      str2[j++] = g_ascii_isspace(str2[i]) && str[i] != '\t' ? ' ' : str2[i];
-  }
-
-  g_free(href);
-
-  str2[j] = '\0';
-
-  return str2;
-}
-
 void Conversation::buildLogFilename()
 {
   PurpleAccount *account = purple_conversation_get_account(conv_);
@@ -495,177 +531,95 @@ void Conversation::buildLogFilename()
   g_free(acct_name);
 }
 
-char *Conversation::extractTime(time_t sent_time, time_t show_time) const
+char *Conversation::extractTime(time_t sent_time, time_t show_time)
 {
   // Based on the extracttime() function from cim4.
 
-  // Convert to local time, note that localtime_r() should not really fail.
-  struct tm show_time_local;
-  struct tm sent_time_local;
-  if (localtime_r(&show_time, &show_time_local) == nullptr)
-    std::memset(&show_time_local, 0, sizeof(show_time_local));
-  if (localtime_r(&sent_time, &sent_time_local) == nullptr)
-    std::memset(&sent_time_local, 0, sizeof(sent_time_local));
-
   // Format the times.
-  char *t1 = g_strdup(purple_date_format_long(&show_time_local));
-  char *t2 = g_strdup(purple_date_format_long(&sent_time_local));
+  char t1[128];
+  char t2[128];
+  show_time_formatter_.format(show_time, t1, sizeof(t1));
+  sent_time_formatter_.format(sent_time, t2, sizeof(t2));
 
   int tdiff = std::abs(sent_time - show_time);
 
-  if (tdiff > 5 && std::strcmp(t1, t2) != 0) {
-    char *res = g_strdup_printf("%s [%s]", t1, t2);
-    g_free(t1);
-    g_free(t2);
-    return res;
-  }
+  if (tdiff > 5 && std::strcmp(t1, t2) != 0)
+    return g_strdup_printf("%s [%s]", t1, t2);
 
-  g_free(t2);
-  return t1;
+  return g_strdup(t1);
 }
 
 void Conversation::loadHistory()
 {
-  // Open logfile.
-  GError *err = nullptr;
-  GIOChannel *chan = g_io_channel_new_file(filename_, "r", &err);
-  if (chan == nullptr) {
+  // Only the current content of the logfile is loaded, new messages are
+  // appended to the view directly.
+  GStatBuf st;
+  if (g_stat(filename_, &st) != 0) {
     LOG->error(_("Error opening conversation logfile '%s' (%s)."), filename_,
-      err->message);
-    g_clear_error(&err);
+      g_strerror(errno));
     return;
   }
-  // This should never fail.
-  g_io_channel_set_encoding(chan, nullptr, nullptr);
-
-  GIOStatus st;
-  char *line;
-  bool new_msg = false;
-  // Read conversation logfile line by line.
-  while (new_msg ||
-    (st = g_io_channel_read_line(chan, &line, nullptr, nullptr, &err)) ==
-      G_IO_STATUS_NORMAL) {
-    new_msg = false;
-
-    // Start flag.
-    if (std::strcmp(line, "\f\n") != 0) {
-      g_free(line);
-      continue;
-    }
-    g_free(line);
-
-    // Parse direction (in/out).
-    if ((st = g_io_channel_read_line(chan, &line, nullptr, nullptr, &err)) !=
-      G_IO_STATUS_NORMAL)
-      break;
-    int color = 0;
-    if (std::strcmp(line, "OUT\n") == 0)
-      color = 1;
-    else if (std::strcmp(line, "IN\n") == 0)
-      color = 2;
-    g_free(line);
-
-    // Handle type.
-    if ((st = g_io_channel_read_line(chan, &line, nullptr, nullptr, &err)) !=
-      G_IO_STATUS_NORMAL)
-      break;
-    bool cim4 = true;
-    if (std::strcmp(line, "MSG2\n") == 0)
-      cim4 = false;
-    else if (std::strcmp(line, "OTHER\n") == 0) {
-      cim4 = false;
-      color = 0;
-    }
-    g_free(line);
-
-    // Sent time.
-    if ((st = g_io_channel_read_line(chan, &line, nullptr, nullptr, &err)) !=
-      G_IO_STATUS_NORMAL)
-      break;
-    time_t sent_time = atol(line);
-    g_free(line);
-
-    // Show time.
-    if ((st = g_io_channel_read_line(chan, &line, nullptr, nullptr, &err)) !=
-      G_IO_STATUS_NORMAL)
-      break;
-    time_t show_time = atol(line);
-    g_free(line);
-
-    if (!cim4) {
-      // cim5, read only one line and strip it off HTML.
-      if ((st = g_io_channel_read_line(chan, &line, nullptr, nullptr, &err)) !=
-        G_IO_STATUS_NORMAL)
-        break;
-
-      // Validate UTF-8.
-      if (!g_utf8_validate(line, -1, nullptr)) {
-        g_free(line);
-        LOG->error(_("Invalid message detected in conversation logfile"
-                     " '%s'. The message was skipped."),
-          filename_);
-        continue;
-      }
 
-      // Write text to the window.
-      char *nohtml = stripHTML(line);
-      char *time = extractTime(sent_time, show_time);
-      char *msg = g_strdup_printf("%s %s", time, nohtml);
-      view_->append(msg, color);
-      g_free(nohtml);
-      g_free(time);
-      g_free(msg);
-      g_free(line);
-    }
-    else {
-      // cim4, read multiple raw lines.
-      gsize length;
-      std::string msg;
-      while ((st = g_io_channel_read_line(
-                chan, &line, &length, nullptr, &err)) == G_IO_STATUS_NORMAL &&
-        line != nullptr) {
-        if (std::strcmp(line, "\f\n") == 0) {
-          new_msg = true;
-          break;
-        }
-
-        // Strip '\r' if necessary.
-        if (length > 1 && line[length - 2] == '\r') {
-          line[length - 2] = '\n';
-          line[length - 1] = '\0';
-        }
-        msg.append(line);
-        g_free(line);
-      }
+  history_lines_ = 0;
+  history_loader_.start(CONVERSATIONS->getHistoryPool(), filename_, st.st_size);
+}
 
-      if (!new_msg) {
-        // EOL or I/O error.
-        break;
-      }
+void Conversation::onHistoryMessage(
+  const ConversationHistoryLoader::Message &message)
+{
+  if (message.text == nullptr) {
+    LOG->error(_("Invalid message detected in conversation logfile"
+                 " '%s'. The message was skipped."),
+      filename_);
+    return;
+  }
 
-      // Validate UTF-8.
-      if (!g_utf8_validate(msg.c_str(), -1, nullptr)) {
-        LOG->error(_("Invalid message detected in conversation logfile"
-                     " '%s'. The message was skipped."),
-          filename_);
-        continue;
-      }
+  // Add the message to the window, after the already loaded history.
+  char *time = extractTime(message.sent_time, message.show_time);
+  char *msg = g_strdup_printf("%s %s", time, message.text);
+  std::size_t line = history_lines_;
+  std::size_t lines = view_->getLinesNumber();
+  view_->insert(line, msg, message.color);
+  history_lines_ += view_->getLinesNumber() - lines;
+  g_free(time);
+  g_free(msg);
 
-      // Add the message to the window.
-      char *time = extractTime(sent_time, show_time);
-      char *final_msg = g_strdup_printf("%s %s", time, msg.c_str());
-      view_->append(final_msg, color);
-      g_free(time);
-      g_free(final_msg);
-    }
+  MessageLine message_line = {message.offset, line};
+  history_message_lines_.push_back(message_line);
+
+  // Show the message if it was requested.
+  if (log_position_pending_ && message.offset >= log_position_) {
+    log_position_pending_ = false;
+    view_->scrollToLine(line);
   }
+}
 
-  if (st != G_IO_STATUS_EOF) {
-    LOG->error(_("Error reading from conversation logfile '%s' (%s)."),
-      filename_, err->message);
-    g_clear_error(&err);
+bool Conversation::findMessageLine(guint64 offset, std::size_t *line) const
+{
+  auto compare = [](const MessageLine &message_line, guint64 o) {
+    return message_line.offset < o;
+  };
+
+  MessageLines::const_iterator i =
+    std::lower_bound(history_message_lines_.begin(),
+      history_message_lines_.end(), offset, compare);
+  if (i != history_message_lines_.end()) {
+    *line = i->line;
+    return true;
   }
-  g_io_channel_unref(chan);
+
+  // Lines of new messages are not known until the whole history is loaded.
+  if (history_loader_.isLoading())
+    return false;
+
+  i = std::lower_bound(
+    new_message_lines_.begin(), new_message_lines_.end(), offset, compare);
+  if (i != new_message_lines_.end()) {
+    *line = history_lines_ + i->line;
+    return true;
+  }
+
+  return false;
 }
 
 bool Conversation::processCommand(const char *raw, const char *html)
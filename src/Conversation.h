@@ -19,15 +19,23 @@
 #ifndef CONVERSATION_H
 #define CONVERSATION_H
 
+#include "ConversationHistoryLoader.h"
+#include "ConversationLogIndex.h"
 #include "ConversationRoomList.h"
+#include "FileWriter.h"
 #include "Log.h"
+#include "MemoryReport.h"
+#include "Utils.h"
 
 #include <cppconsui/AbstractLine.h>
 #include <cppconsui/TextEdit.h>
 #include <cppconsui/TextView.h>
 #include <cppconsui/VerticalLine.h>
 #include <cppconsui/Window.h>
+#include <deque>
 #include <libpurple/purple.h>
+#include <string>
+#include <vector>
 
 class Conversation : public CppConsUI::Window {
 public:
@@ -50,6 +58,21 @@ public:
   void write(const char *name, const char *alias, const char *message,
     PurpleMessageFlags flags, time_t mtime);
 
+  // Scrolls the view to a message at a given offset in the logfile.
+  void showLogPosition(guint64 offset);
+  // Scrolls the view to the first message shown at or after a given time.
+  // Returns false if there is no such message.
+  bool showLogTime(time_t time);
+
+  // Drops the in-memory scrollback. It is reloaded from the logfile when the
+  // conversation is shown again. Conversations that are still loading or that
+  // show messages which were not logged are left alone.
+  void hibernate();
+  bool isHibernated() const { return hibernated_; }
+
+  // Adds memory held by the scrollback to a report.
+  void reportMemoryUsage(MemoryReport &report) const;
+
   PurpleConversation *getPurpleConversation() const { return conv_; };
 
   ConversationRoomList *getRoomList() const { return room_list_; };
@@ -79,7 +102,42 @@ protected:
   PurpleConversation *conv_;
 
   char *filename_;
-  GIOChannel *logfile_;
+  FileWriter::File *logfile_;
+  ConversationLogIndex log_index_;
+
+  // The history is loaded in the background and inserted before any messages
+  // that arrive in the meantime.
+  ConversationHistoryLoader history_loader_;
+  std::size_t history_lines_;
+
+  // Line numbers of logged messages in the view, used to show a message at
+  // a given log offset.
+  struct MessageLine {
+    guint64 offset;
+    std::size_t line;
+  };
+  typedef std::vector<MessageLine> MessageLines;
+  MessageLines history_message_lines_;
+  // Lines of messages written after the conversation was opened, they are
+  // relative to the end of the history.
+  MessageLines new_message_lines_;
+  // Log offset of a message that should be shown once it is loaded.
+  bool log_position_pending_;
+  guint64 log_position_;
+
+  // The scrollback is not loaded, either yet or because it was dropped. New
+  // logged messages are only written to the logfile until the conversation is
+  // woken up.
+  bool hibernated_;
+
+  // Lines of messages that are not in the logfile. They are kept so that they
+  // can be shown again, after the history, when the conversation wakes up.
+  struct UnloggedLine {
+    std::string text;
+    int color;
+  };
+  typedef std::deque<UnloggedLine> UnloggedLines;
+  UnloggedLines unlogged_lines_;
 
   std::size_t input_text_length_;
 
@@ -87,11 +145,19 @@ protected:
   ConversationRoomList *room_list_;
   CppConsUI::VerticalLine *room_list_line_;
 
-  char *stripHTML(const char *str) const;
+  // Formatters of the sent and show times, each caches its last minute.
+  Utils::TimeFormatter sent_time_formatter_;
+  Utils::TimeFormatter show_time_formatter_;
+
   void destroyPurpleConversation(PurpleConversation *conv);
   void buildLogFilename();
-  char *extractTime(time_t sent_time, time_t show_time) const;
+  char *extractTime(time_t sent_time, time_t show_time);
   void loadHistory();
+  void wakeUp();
+  // Opens the log index, the caller has to flush the logfile first.
+  void openLogIndex();
+  void onHistoryMessage(const ConversationHistoryLoader::Message &message);
+  bool findMessageLine(guint64 offset, std::size_t *line) const;
   bool processCommand(const char *raw, const char *html);
   void onInputTextChange(CppConsUI::TextEdit &activator);
 
@@ -0,0 +1,431 @@
+// Copyright (C) 2016 Petr Pavlu <setup@dagobah.cz>
+//
+// This file is part of CenterIM.
+//
+// CenterIM is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// CenterIM is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with CenterIM.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "ConversationHistoryLoader.h"
+
+#include "ConversationLogFormat.h"
+#include "Log.h"
+#include "Utils.h"
+
+#include "gettext.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <vector>
+
+// Maximum number of parsed messages waiting for the main loop. The worker
+// thread blocks when the limit is reached.
+#define HISTORY_MAX_PENDING_MESSAGES 4096
+// Maximum number of messages passed to the conversation in one main loop
+// iteration.
+#define HISTORY_BATCH_SIZE 128
+
+// State shared by the loader, the worker thread and the delivery sources.
+struct ConversationHistoryLoader::Task {
+  gint ref_count;
+
+  char *filename;
+  guint64 size;
+
+  // Protects all following members.
+  GMutex mutex;
+  // Signalled when messages are taken by the main loop or the task is
+  // cancelled.
+  GCond cond;
+
+  // Owning loader, nullptr if the task was cancelled.
+  ConversationHistoryLoader *loader;
+  std::deque<Message> messages;
+  bool delivery_scheduled;
+  bool finished;
+  char *error;
+};
+
+namespace {
+
+struct Line {
+  const char *start;
+  gsize length;
+
+  bool equals(const char *str) const
+  {
+    return length == std::strlen(str) && std::memcmp(start, str, length) == 0;
+  }
+};
+
+// Reads the next line (including the terminating '\n') from data. Returns false
+// if the end of data was reached.
+bool readLine(const char *data, gsize size, gsize &pos, Line &line)
+{
+  if (pos >= size)
+    return false;
+
+  const char *eol =
+    static_cast<const char *>(std::memchr(data + pos, '\n', size - pos));
+  gsize end = eol != nullptr ? eol - data + 1 : size;
+  line.start = data + pos;
+  line.length = end - pos;
+  pos = end;
+  return true;
+}
+
+} // anonymous namespace
+
+ConversationHistoryLoader::ConversationHistoryLoader() : task_(nullptr)
+{
+}
+
+ConversationHistoryLoader::~ConversationHistoryLoader()
+{
+  cancel();
+}
+
+void ConversationHistoryLoader::start(
+  GThreadPool *pool, const char *filename, guint64 size)
+{
+  g_assert(pool != nullptr);
+  g_assert(filename != nullptr);
+
+  cancel();
+
+  task_ = new Task;
+  // One reference is held by the loader and one by the worker thread.
+  task_->ref_count = 2;
+  task_->filename = g_strdup(filename);
+  task_->size = size;
+  g_mutex_init(&task_->mutex);
+  g_cond_init(&task_->cond);
+  task_->loader = this;
+  task_->delivery_scheduled = false;
+  task_->finished = false;
+  task_->error = nullptr;
+
+  GError *err = nullptr;
+  if (!g_thread_pool_push(pool, task_, &err)) {
+    LOG->error(_("Error loading conversation history from '%s' (%s)."),
+      filename, err->message);
+    g_clear_error(&err);
+    unrefTask(task_);
+    cancel();
+  }
+}
+
+void ConversationHistoryLoader::cancel()
+{
+  if (task_ == nullptr)
+    return;
+
+  g_mutex_lock(&task_->mutex);
+  task_->loader = nullptr;
+  for (Message &message : task_->messages)
+    g_free(message.text);
+  task_->messages.clear();
+  g_cond_signal(&task_->cond);
+  g_mutex_unlock(&task_->mutex);
+
+  unrefTask(task_);
+  task_ = nullptr;
+}
+
+void ConversationHistoryLoader::load(Task *task)
+{
+  // Runs in a worker thread. Note that purple and Log functions cannot be
+  // called here.
+  GError *err = nullptr;
+  GMappedFile *mapped = g_mapped_file_new(task->filename, FALSE, &err);
+  if (mapped == nullptr) {
+    finishTask(task, err->message);
+    g_clear_error(&err);
+    unrefTask(task);
+    return;
+  }
+  const char *data = g_mapped_file_get_contents(mapped);
+  gsize size = std::min<guint64>(g_mapped_file_get_length(mapped), task->size);
+
+  parseLog(data, size, 0, sigc::bind<0>(sigc::ptr_fun(pushMessage), task));
+  g_mapped_file_unref(mapped);
+
+  finishTask(task, nullptr);
+  unrefTask(task);
+}
+
+gsize ConversationHistoryLoader::parseLog(
+  const char *data, gsize size, gsize pos, const MessageSlot &slot)
+{
+  if (ConversationLogFormat::isBinary(data, size))
+    return parseBinaryLog(data, size, pos, slot);
+  return parseTextLog(data, size, pos, slot);
+}
+
+gsize ConversationHistoryLoader::parseBinaryLog(
+  const char *data, gsize size, gsize pos, const MessageSlot &slot)
+{
+  pos = std::max(pos, ConversationLogFormat::HEADER_SIZE);
+  gsize end = pos;
+  while (pos < size) {
+    ConversationLogFormat::Record record;
+    gsize length = ConversationLogFormat::decodeRecord(data, size, pos, record);
+    if (length == 0) {
+      // Skip a corrupted record. Incomplete data at the end of the logfile is
+      // ignored, otherwise the corruption is reported to the slot as an
+      // invalid message.
+      gsize next = ConversationLogFormat::findRecord(data, size, pos + 1);
+      if (next < size) {
+        Message message = {nullptr, 0, 0, 0, pos};
+        if (!slot(message))
+          break;
+      }
+      pos = next;
+      continue;
+    }
+
+    Message message;
+    message.text = g_strndup(record.text, record.text_length);
+    message.color = 0;
+    if (record.flags & ConversationLogFormat::RECORD_OUT)
+      message.color = 1;
+    else if (record.flags & ConversationLogFormat::RECORD_IN)
+      message.color = 2;
+    message.sent_time = record.sent_time;
+    message.show_time = record.show_time;
+    message.offset = pos;
+
+    if (!slot(message))
+      break;
+    pos += length;
+    end = pos;
+  }
+
+  return end;
+}
+
+gsize ConversationHistoryLoader::parseTextLog(
+  const char *data, gsize size, gsize pos, const MessageSlot &slot)
+{
+  Line line;
+  gsize end = pos;
+  bool new_msg = false;
+  std::vector<char> strip_buf;
+  std::string msg;
+  // Parse the conversation logfile line by line.
+  while (new_msg || readLine(data, size, pos, line)) {
+    new_msg = false;
+
+    // Start flag.
+    if (!line.equals("\f\n"))
+      continue;
+
+    Message message;
+    message.text = nullptr;
+    message.offset = line.start - data;
+
+    // Parse direction (in/out).
+    if (!readLine(data, size, pos, line))
+      break;
+    message.color = 0;
+    if (line.equals("OUT\n"))
+      message.color = 1;
+    else if (line.equals("IN\n"))
+      message.color = 2;
+
+    // Handle type.
+    if (!readLine(data, size, pos, line))
+      break;
+    bool cim4 = true;
+    if (line.equals("MSG2\n"))
+      cim4 = false;
+    else if (line.equals("OTHER\n")) {
+      cim4 = false;
+      message.color = 0;
+    }
+
+    // Sent time.
+    if (!readLine(data, size, pos, line))
+      break;
+    message.sent_time = atol(std::string(line.start, line.length).c_str());
+
+    // Show time.
+    if (!readLine(data, size, pos, line))
+      break;
+    message.show_time = atol(std::string(line.start, line.length).c_str());
+
+    gsize msg_end;
+    if (!cim4) {
+      // cim5, read only one line and strip it off HTML.
+      if (!readLine(data, size, pos, line))
+        break;
+      msg.assign(line.start, line.length);
+      msg_end = pos;
+    }
+    else {
+      // cim4, read multiple raw lines.
+      msg.clear();
+      while (readLine(data, size, pos, line)) {
+        if (line.equals("\f\n")) {
+          new_msg = true;
+          break;
+        }
+
+        // Strip '\r' if necessary.
+        if (line.length > 1 && line.start[line.length - 2] == '\r') {
+          msg.append(line.start, line.length - 2);
+          msg.append("\n");
+        }
+        else
+          msg.append(line.start, line.length);
+      }
+
+      // The message ends at the next start flag or at the end of the logfile.
+      msg_end = new_msg ? line.start - data : pos;
+    }
+
+    // Validate UTF-8, an invalid message is reported to the slot with no text.
+    if (g_utf8_validate(msg.c_str(), -1, nullptr)) {
+      if (!cim4) {
+        // The buffer for the stripped text is reused by all messages.
+        strip_buf.resize(std::max(strip_buf.size(), msg.size() + 1));
+        Utils::stripHTML(msg.c_str(), strip_buf.data());
+        message.text = g_strdup(strip_buf.data());
+      }
+      else
+        message.text = g_strdup(msg.c_str());
+    }
+
+    if (!slot(message))
+      break;
+
+    // Only a message terminated by a newline is complete.
+    if (data[msg_end - 1] == '\n')
+      end = msg_end;
+  }
+
+  return end;
+}
+
+bool ConversationHistoryLoader::pushMessage(Task *task, const Message &message)
+{
+  g_mutex_lock(&task->mutex);
+
+  // Wait for the main loop to take some messages if too many are pending.
+  while (task->loader != nullptr &&
+    task->messages.size() >= HISTORY_MAX_PENDING_MESSAGES)
+    g_cond_wait(&task->cond, &task->mutex);
+
+  bool res = task->loader != nullptr;
+  if (res) {
+    task->messages.push_back(message);
+    scheduleDelivery(task);
+  }
+  else
+    g_free(message.text);
+
+  g_mutex_unlock(&task->mutex);
+  return res;
+}
+
+void ConversationHistoryLoader::finishTask(Task *task, const char *error)
+{
+  g_mutex_lock(&task->mutex);
+  task->finished = true;
+  task->error = g_strdup(error);
+  if (task->loader != nullptr)
+    scheduleDelivery(task);
+  g_mutex_unlock(&task->mutex);
+}
+
+void ConversationHistoryLoader::scheduleDelivery(Task *task)
+{
+  // Must be called with the mutex held.
+  if (task->delivery_scheduled)
+    return;
+
+  // The source holds its own reference to the task. The idle priority makes
+  // sure that user input is processed before the history.
+  task->delivery_scheduled = true;
+  refTask(task);
+  g_idle_add_full(G_PRIORITY_DEFAULT_IDLE, deliver_, task, unref_task_);
+}
+
+void ConversationHistoryLoader::refTask(Task *task)
+{
+  g_atomic_int_inc(&task->ref_count);
+}
+
+void ConversationHistoryLoader::unrefTask(Task *task)
+{
+  if (!g_atomic_int_dec_and_test(&task->ref_count))
+    return;
+
+  for (Message &message : task->messages)
+    g_free(message.text);
+  g_free(task->error);
+  g_free(task->filename);
+  g_cond_clear(&task->cond);
+  g_mutex_clear(&task->mutex);
+  delete task;
+}
+
+gboolean ConversationHistoryLoader::deliver(Task *task)
+{
+  // Runs in the main loop.
+  std::vector<Message> batch;
+
+  g_mutex_lock(&task->mutex);
+  ConversationHistoryLoader *loader = task->loader;
+  if (loader == nullptr) {
+    // The task was cancelled.
+    task->delivery_scheduled = false;
+    g_mutex_unlock(&task->mutex);
+    return FALSE;
+  }
+
+  std::size_t count =
+    std::min<std::size_t>(task->messages.size(), HISTORY_BATCH_SIZE);
+  batch.assign(task->messages.begin(), task->messages.begin() + count);
+  task->messages.erase(task->messages.begin(), task->messages.begin() + count);
+  g_cond_signal(&task->cond);
+
+  bool finished = task->finished && task->messages.empty();
+  // Keep the source if more messages are waiting, otherwise the worker thread
+  // schedules a new delivery when needed.
+  bool more = !task->messages.empty();
+  if (!more)
+    task->delivery_scheduled = false;
+  g_mutex_unlock(&task->mutex);
+
+  // Note that the loader can be cancelled by a signal handler.
+  for (const Message &message : batch) {
+    if (task->loader != nullptr)
+      loader->signal_message(message);
+    g_free(message.text);
+  }
+  if (task->loader == nullptr)
+    return FALSE;
+
+  if (finished) {
+    if (task->error != nullptr)
+      LOG->error(_("Error reading from conversation logfile '%s' (%s)."),
+        task->filename, task->error);
+    loader->cancel();
+  }
+
+  return more;
+}
+
+// vim: set tabstop=2 shiftwidth=2 textwidth=80 expandtab:
@@ -0,0 +1,105 @@
+// Copyright (C) 2016 Petr Pavlu <setup@dagobah.cz>
+//
+// This file is part of CenterIM.
+//
+// CenterIM is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// CenterIM is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with CenterIM.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef CONVERSATIONHISTORYLOADER_H
+#define CONVERSATIONHISTORYLOADER_H
+
+#include <cppconsui/CppConsUI.h>
+#include <ctime>
+#include <glib.h>
+
+// Loader of a conversation history. The logfile is parsed on a worker thread
+// which validates and strips the messages. Parsed messages are then passed
+// back to the main loop in bounded batches so the conversation window can be
+// shown immediately and filled progressively.
+class ConversationHistoryLoader {
+public:
+  struct Message {
+    // Message text without HTML markup, nullptr if the message is not valid
+    // UTF-8 and was skipped.
+    char *text;
+    int color;
+    time_t sent_time;
+    time_t show_time;
+    // Byte offset of the message record in the logfile.
+    guint64 offset;
+  };
+
+  // Slot receiving parsed messages, it takes ownership of the message text.
+  // Parsing stops if the slot returns false.
+  typedef sigc::slot<bool, const Message &> MessageSlot;
+
+  ConversationHistoryLoader();
+  ~ConversationHistoryLoader();
+
+  // Starts loading a given logfile using a thread pool. Only the first size
+  // bytes of the logfile are read.
+  void start(GThreadPool *pool, const char *filename, guint64 size);
+  // Stops loading, no more messages are emitted after this call.
+  void cancel();
+
+  bool isLoading() const { return task_ != nullptr; }
+
+  // Emitted from the main loop for every loaded message, in the order they
+  // appear in the logfile.
+  sigc::signal<void, const Message &> signal_message;
+
+  // Parses messages from logfile data starting at a given position. Both the
+  // text and the binary logfile format are supported. Returns the position
+  // after the last complete message that was parsed. The function does not use
+  // any purple or Log functions and can be called from any thread.
+  static gsize parseLog(
+    const char *data, gsize size, gsize pos, const MessageSlot &slot);
+
+  // Worker function for the history thread pool.
+  static void load_(gpointer data, gpointer /*user_data*/)
+  {
+    load(reinterpret_cast<Task *>(data));
+  }
+
+private:
+  struct Task;
+
+  Task *task_;
+
+  CONSUI_DISABLE_COPY(ConversationHistoryLoader);
+
+  static void load(Task *task);
+  static gsize parseTextLog(
+    const char *data, gsize size, gsize pos, const MessageSlot &slot);
+  static gsize parseBinaryLog(
+    const char *data, gsize size, gsize pos, const MessageSlot &slot);
+  static bool pushMessage(Task *task, const Message &message);
+  static void finishTask(Task *task, const char *error);
+  static void scheduleDelivery(Task *task);
+  static void refTask(Task *task);
+  static void unrefTask(Task *task);
+
+  static gboolean deliver_(gpointer data)
+  {
+    return deliver(reinterpret_cast<Task *>(data));
+  }
+  static gboolean deliver(Task *task);
+  static void unref_task_(gpointer data)
+  {
+    unrefTask(reinterpret_cast<Task *>(data));
+  }
+};
+
+#endif // CONVERSATIONHISTORYLOADER_H
+
+// vim: set tabstop=2 shiftwidth=2 textwidth=80 expandtab:
@@ -0,0 +1,290 @@
+// Copyright (C) 2016 Petr Pavlu <setup@dagobah.cz>
+//
+// This file is part of CenterIM.
+//
+// CenterIM is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// CenterIM is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with CenterIM.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "ConversationLogCompactor.h"
+
+#include "ConversationLogFormat.h"
+#include "ConversationLogIndex.h"
+#include "SearchIndex.h"
+
+#include "gettext.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <glib/gstdio.h>
+#include <libpurple/purple.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Maximum number of worker threads.
+#define COMPACTOR_MAX_THREADS 8
+
+ConversationLogCompactor::ConversationLogCompactor()
+  : converted_(0), unchanged_(0), skipped_(0), dropped_(0)
+{
+  clogs_dir_ = g_build_filename(purple_user_dir(), "clogs", nullptr);
+  g_mutex_init(&mutex_);
+}
+
+ConversationLogCompactor::~ConversationLogCompactor()
+{
+  for (char *filename : filenames_)
+    g_free(filename);
+  g_free(clogs_dir_);
+  g_mutex_clear(&mutex_);
+}
+
+int ConversationLogCompactor::run()
+{
+  // Make sure that no running instance writes the logs.
+  int lock = lockLogs(true);
+  if (lock == -1) {
+    if (errno == EWOULDBLOCK)
+      std::fprintf(stderr, _("Conversation logs in '%s' are used by a running "
+                             "CenterIM instance.\n"),
+        clogs_dir_);
+    else
+      std::fprintf(stderr, _("Error locking conversation logs in '%s' (%s).\n"),
+        clogs_dir_, g_strerror(errno));
+    return 1;
+  }
+
+  scanLogs("", 0);
+
+  long threads = sysconf(_SC_NPROCESSORS_ONLN);
+  threads = CLAMP(threads, 1, COMPACTOR_MAX_THREADS);
+
+  GError *err = nullptr;
+  GThreadPool *pool = g_thread_pool_new(compact_, this, threads, TRUE, &err);
+  if (pool == nullptr) {
+    std::fprintf(
+      stderr, _("Error creating worker threads (%s).\n"), err->message);
+    g_clear_error(&err);
+    close(lock);
+    return 1;
+  }
+
+  for (char *filename : filenames_)
+    if (!g_thread_pool_push(pool, filename, &err)) {
+      addError(filename, err->message);
+      g_clear_error(&err);
+    }
+
+  // Wait until all logfiles are processed.
+  g_thread_pool_free(pool, FALSE, TRUE);
+
+  for (const std::string &error : errors_)
+    std::fprintf(stderr, "%s\n", error.c_str());
+  std::printf(_("Converted logfiles: %u, already compact logfiles: %u, skipped "
+                "files: %u, dropped invalid messages: %u.\n"),
+    converted_, unchanged_, skipped_, dropped_);
+  if (converted_ > 0)
+    std::printf(_("HTML markup was removed from messages in the converted "
+                  "logfiles.\n"));
+
+  // Offsets of messages in the converted logfiles changed.
+  if (converted_ > 0)
+    SearchIndex::discard();
+
+  close(lock);
+  return errors_.empty() ? 0 : 1;
+}
+
+int ConversationLogCompactor::lockLogs(bool exclusive)
+{
+  char *filename = g_build_filename(purple_user_dir(), "clogs.lock", nullptr);
+  int fd = g_open(filename, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+  g_free(filename);
+  if (fd == -1)
+    return -1;
+
+  if (flock(fd, (exclusive ? LOCK_EX : LOCK_SH) | LOCK_NB) != 0) {
+    int saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return -1;
+  }
+  return fd;
+}
+
+void ConversationLogCompactor::scanLogs(const char *path, int depth)
+{
+  // Logfiles are stored in the clogs/<protocol>/<account>/<name> hierarchy.
+  char *dirname = g_build_filename(clogs_dir_, path, nullptr);
+  GDir *dir = g_dir_open(dirname, 0, nullptr);
+  g_free(dirname);
+  if (dir == nullptr)
+    return;
+
+  const char *name;
+  while ((name = g_dir_read_name(dir)) != nullptr) {
+    char *child =
+      *path != '\0' ? g_build_filename(path, name, nullptr) : g_strdup(name);
+
+    if (depth < 2)
+      scanLogs(child, depth + 1);
+    else if (!g_str_has_suffix(name, ".idx")) {
+      char *filename = g_build_filename(clogs_dir_, child, nullptr);
+      if (g_file_test(filename, G_FILE_TEST_IS_REGULAR))
+        filenames_.push_back(filename);
+      else
+        g_free(filename);
+    }
+
+    g_free(child);
+  }
+  g_dir_close(dir);
+}
+
+void ConversationLogCompactor::compact(const char *filename)
+{
+  // Runs in a worker thread.
+  GError *err = nullptr;
+  GMappedFile *mapped = g_mapped_file_new(filename, FALSE, &err);
+  if (mapped == nullptr) {
+    addError(filename, err->message);
+    g_clear_error(&err);
+    return;
+  }
+  const char *data = g_mapped_file_get_contents(mapped);
+  gsize size = g_mapped_file_get_length(mapped);
+
+  // Only files that start with a record are converted from the text format,
+  // anything else in the clogs directory is not a logfile. Empty logfiles are
+  // left alone.
+  bool binary = ConversationLogFormat::isBinary(data, size);
+  if (!binary && (size < 2 || std::memcmp(data, "\f\n", 2) != 0)) {
+    g_mapped_file_unref(mapped);
+    g_mutex_lock(&mutex_);
+    ++skipped_;
+    g_mutex_unlock(&mutex_);
+    return;
+  }
+
+  // Encode all valid messages.
+  Output output;
+  output.data.assign(ConversationLogFormat::HEADER,
+    ConversationLogFormat::HEADER + ConversationLogFormat::HEADER_SIZE);
+  output.records = 0;
+  output.dropped = 0;
+  output.last_offset = 0;
+  ConversationHistoryLoader::parseLog(
+    data, size, 0, sigc::bind(sigc::ptr_fun(&appendRecord), &output));
+
+  if (!binary) {
+    // Refuse to rewrite a text logfile if the parser did not reach its last
+    // record, the rest of the logfile would be lost.
+    const char *error = nullptr;
+    if (output.last_offset != findLastTextRecord(data, size))
+      error = _("the last message cannot be parsed");
+    else if (output.records == 0)
+      error = _("no message can be converted");
+    if (error != nullptr) {
+      g_mapped_file_unref(mapped);
+      addError(filename, error);
+      return;
+    }
+  }
+
+  // A binary logfile is rewritten only if it contains some corrupted data.
+  bool rewrite = !binary || output.data.size() != size;
+  bool rewritten = false;
+  bool res;
+  if (rewrite) {
+    res = rewritten = g_file_set_contents(
+      filename, output.data.data(), output.data.size(), &err);
+    if (res)
+      res = ConversationLogIndex::writeIndex(
+        filename, output.data.data(), output.data.size(), &err);
+  }
+  else
+    res = ConversationLogIndex::writeIndex(filename, data, size, &err);
+  g_mapped_file_unref(mapped);
+
+  if (!res) {
+    addError(filename, err->message);
+    g_clear_error(&err);
+  }
+
+  g_mutex_lock(&mutex_);
+  if (rewritten)
+    ++converted_;
+  else if (!rewrite)
+    ++unchanged_;
+  dropped_ += output.dropped;
+  g_mutex_unlock(&mutex_);
+}
+
+void ConversationLogCompactor::addError(
+  const char *filename, const char *message)
+{
+  char *error = g_strdup_printf(
+    _("Error compacting conversation logfile '%s' (%s)."), filename, message);
+  g_mutex_lock(&mutex_);
+  errors_.push_back(error);
+  g_mutex_unlock(&mutex_);
+  g_free(error);
+}
+
+bool ConversationLogCompactor::appendRecord(
+  const ConversationHistoryLoader::Message &message, Output *output)
+{
+  output->last_offset = message.offset;
+
+  // Drop messages that are not valid UTF-8 or are too long to be stored.
+  gsize text_length = message.text != nullptr ? std::strlen(message.text) : 0;
+  if (message.text == nullptr ||
+    text_length > ConversationLogFormat::MAX_TEXT_LENGTH) {
+    ++output->dropped;
+    g_free(message.text);
+    return true;
+  }
+
+  ConversationLogFormat::Record record;
+  if (message.color == 1)
+    record.flags = ConversationLogFormat::RECORD_OUT;
+  else if (message.color == 2)
+    record.flags = ConversationLogFormat::RECORD_IN;
+  else
+    record.flags = ConversationLogFormat::RECORD_OTHER;
+  record.sent_time = message.sent_time;
+  record.show_time = message.show_time;
+  record.text = message.text;
+  record.text_length = text_length;
+
+  gsize length;
+  char *buf = ConversationLogFormat::encodeRecord(record, &length);
+  output->data.insert(output->data.end(), buf, buf + length);
+  ++output->records;
+  g_free(buf);
+  g_free(message.text);
+  return true;
+}
+
+gsize ConversationLogCompactor::findLastTextRecord(const char *data, gsize size)
+{
+  // Find the last start flag, it is a "\f\n" line.
+  for (gsize pos = size - 1; pos > 0; --pos)
+    if (data[pos - 1] == '\f' && data[pos] == '\n' &&
+      (pos == 1 || data[pos - 2] == '\n'))
+      return pos - 1;
+  return 0;
+}
+
+// vim: set tabstop=2 shiftwidth=2 textwidth=80 expandtab:
@@ -0,0 +1,92 @@
+// Copyright (C) 2016 Petr Pavlu <setup@dagobah.cz>
+//
+// This file is part of CenterIM.
+//
+// CenterIM is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// CenterIM is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with CenterIM.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef CONVERSATIONLOGCOMPACTOR_H
+#define CONVERSATIONLOGCOMPACTOR_H
+
+#include "ConversationHistoryLoader.h"
+
+#include <cppconsui/CppConsUI.h>
+#include <glib.h>
+#include <string>
+#include <vector>
+
+// Offline maintenance of conversation logs (the --compact-logs mode). All
+// logfiles in the clogs directory are rewritten in the binary format. Legacy
+// cim4 records are normalized and messages that are not valid UTF-8 are
+// dropped. The conversion is lossy, HTML markup is removed from the messages
+// because the binary format stores only plain text. A fresh sidecar index is
+// written for every logfile. The work is spread across a thread pool, no UI or
+// network is needed.
+//
+// A running CenterIM instance holds a shared lock of the logs, the compaction
+// refuses to start if it cannot take the lock exclusively.
+class ConversationLogCompactor {
+public:
+  ConversationLogCompactor();
+  ~ConversationLogCompactor();
+
+  // Processes all logfiles and prints a summary. Returns the exit status of the
+  // program.
+  int run();
+
+  // Locks the conversation logs of the current user directory. Returns a file
+  // descriptor that holds the lock, or -1 if the lock cannot be taken (errno
+  // is then set). The lock is released by closing the descriptor.
+  static int lockLogs(bool exclusive);
+
+private:
+  // Logfile encoded in the binary format.
+  struct Output {
+    std::vector<char> data;
+    unsigned records;
+    unsigned dropped;
+    // Offset of the last parsed message in the original logfile.
+    guint64 last_offset;
+  };
+
+  char *clogs_dir_;
+  std::vector<char *> filenames_;
+
+  // Protects all following members.
+  GMutex mutex_;
+  unsigned converted_;
+  unsigned unchanged_;
+  unsigned skipped_;
+  unsigned dropped_;
+  std::vector<std::string> errors_;
+
+  CONSUI_DISABLE_COPY(ConversationLogCompactor);
+
+  void scanLogs(const char *path, int depth);
+
+  static void compact_(gpointer data, gpointer user_data)
+  {
+    reinterpret_cast<ConversationLogCompactor *>(user_data)->compact(
+      reinterpret_cast<const char *>(data));
+  }
+  void compact(const char *filename);
+  void addError(const char *filename, const char *message);
+
+  static bool appendRecord(
+    const ConversationHistoryLoader::Message &message, Output *output);
+  static gsize findLastTextRecord(const char *data, gsize size);
+};
+
+#endif // CONVERSATIONLOGCOMPACTOR_H
+
+// vim: set tabstop=2 shiftwidth=2 textwidth=80 expandtab:
@@ -0,0 +1,157 @@
+// Copyright (C) 2016 Petr Pavlu <setup@dagobah.cz>
+//
+// This file is part of CenterIM.
+//
+// CenterIM is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// CenterIM is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with CenterIM.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "ConversationLogFormat.h"
+
+#include <cstring>
+
+#define RECORD_MARKER "\xff" "CIM"
+#define RECORD_MARKER_LENGTH 4
+// Offset of the checksum in the record header, the checksum covers everything
+// before it and the text.
+#define RECORD_CRC_OFFSET 28
+
+namespace ConversationLogFormat {
+
+namespace {
+
+struct CRCTable {
+  guint32 values[256];
+
+  CRCTable()
+  {
+    for (guint32 i = 0; i < 256; ++i) {
+      guint32 c = i;
+      for (int k = 0; k < 8; ++k)
+        c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+      values[i] = c;
+    }
+  }
+};
+
+void putUInt32(char *buf, guint32 value)
+{
+  value = GUINT32_TO_LE(value);
+  std::memcpy(buf, &value, sizeof(value));
+}
+
+void putInt64(char *buf, gint64 value)
+{
+  guint64 v = GUINT64_TO_LE(static_cast<guint64>(value));
+  std::memcpy(buf, &v, sizeof(v));
+}
+
+guint32 getUInt32(const char *buf)
+{
+  guint32 value;
+  std::memcpy(&value, buf, sizeof(value));
+  return GUINT32_FROM_LE(value);
+}
+
+gint64 getInt64(const char *buf)
+{
+  guint64 value;
+  std::memcpy(&value, buf, sizeof(value));
+  return static_cast<gint64>(GUINT64_FROM_LE(value));
+}
+
+} // anonymous namespace
+
+const char HEADER[] = "CIMLOG2\n";
+
+bool isBinary(const char *data, gsize size)
+{
+  return size >= HEADER_SIZE && std::memcmp(data, HEADER, HEADER_SIZE) == 0;
+}
+
+char *encodeRecord(const Record &record, gsize *length)
+{
+  g_assert(record.text_length <= MAX_TEXT_LENGTH);
+
+  *length = RECORD_HEADER_SIZE + record.text_length;
+  char *buf = g_new(char, *length);
+  std::memcpy(buf, RECORD_MARKER, RECORD_MARKER_LENGTH);
+  putUInt32(buf + 4, record.flags);
+  putInt64(buf + 8, record.sent_time);
+  putInt64(buf + 16, record.show_time);
+  putUInt32(buf + 24, record.text_length);
+  std::memcpy(buf + RECORD_HEADER_SIZE, record.text, record.text_length);
+
+  guint32 crc = crc32(0, buf, RECORD_CRC_OFFSET);
+  crc = crc32(crc, buf + RECORD_HEADER_SIZE, record.text_length);
+  putUInt32(buf + RECORD_CRC_OFFSET, crc);
+  return buf;
+}
+
+gsize decodeRecord(const char *data, gsize size, gsize pos, Record &record)
+{
+  if (pos > size || size - pos < RECORD_HEADER_SIZE)
+    return 0;
+
+  const char *buf = data + pos;
+  if (std::memcmp(buf, RECORD_MARKER, RECORD_MARKER_LENGTH) != 0)
+    return 0;
+
+  guint32 text_length = getUInt32(buf + 24);
+  if (text_length > MAX_TEXT_LENGTH ||
+    size - pos - RECORD_HEADER_SIZE < text_length)
+    return 0;
+
+  guint32 crc = crc32(0, buf, RECORD_CRC_OFFSET);
+  crc = crc32(crc, buf + RECORD_HEADER_SIZE, text_length);
+  if (crc != getUInt32(buf + RECORD_CRC_OFFSET))
+    return 0;
+
+  record.flags = getUInt32(buf + 4);
+  record.sent_time = getInt64(buf + 8);
+  record.show_time = getInt64(buf + 16);
+  record.text = buf + RECORD_HEADER_SIZE;
+  record.text_length = text_length;
+  return RECORD_HEADER_SIZE + text_length;
+}
+
+gsize findRecord(const char *data, gsize size, gsize pos)
+{
+  while (pos < size) {
+    const char *p =
+      static_cast<const char *>(std::memchr(data + pos, '\xff', size - pos));
+    if (p == nullptr)
+      break;
+    pos = p - data;
+    if (size - pos >= RECORD_MARKER_LENGTH &&
+      std::memcmp(p, RECORD_MARKER, RECORD_MARKER_LENGTH) == 0)
+      return pos;
+    ++pos;
+  }
+  return size;
+}
+
+guint32 crc32(guint32 crc, const char *data, gsize length)
+{
+  // Function-local statics are initialized in a thread-safe way.
+  static const CRCTable table;
+
+  crc = ~crc;
+  const unsigned char *p = reinterpret_cast<const unsigned char *>(data);
+  for (gsize i = 0; i < length; ++i)
+    crc = table.values[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+  return ~crc;
+}
+
+} // namespace ConversationLogFormat
+
+// vim: set tabstop=2 shiftwidth=2 textwidth=80 expandtab:
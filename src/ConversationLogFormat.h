@@ -0,0 +1,84 @@
+// Copyright (C) 2016 Petr Pavlu <setup@dagobah.cz>
+//
+// This file is part of CenterIM.
+//
+// CenterIM is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// CenterIM is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with CenterIM.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef CONVERSATIONLOGFORMAT_H
+#define CONVERSATIONLOGFORMAT_H
+
+#include <ctime>
+#include <glib.h>
+
+// Binary format of conversation logfiles.
+//
+// A binary logfile starts with an 8-byte magic header which is followed by
+// records. Each record is formed of a fixed-size header and the message text.
+// The record header contains a record marker, flags (little-endian 32-bit
+// integer), the sent time and the show time (little-endian 64-bit integers),
+// length of the text (little-endian 32-bit integer) and a CRC-32 checksum of
+// the record header and the text. The text is stored without HTML markup and
+// it is always valid UTF-8, so it can be shown without any further processing.
+//
+// The record marker contains the 0xff byte which never appears in valid UTF-8
+// text. A reader can therefore find the next record after a corrupted one by
+// searching for the marker.
+namespace ConversationLogFormat {
+
+enum RecordFlag {
+  // Message sent by the user.
+  RECORD_OUT = 1 << 0,
+  // Message received from the other side.
+  RECORD_IN = 1 << 1,
+  // System message.
+  RECORD_OTHER = 1 << 2,
+};
+
+struct Record {
+  guint32 flags;
+  time_t sent_time;
+  time_t show_time;
+  // Text of the message, not nul-terminated.
+  const char *text;
+  gsize text_length;
+};
+
+extern const char HEADER[];
+const gsize HEADER_SIZE = 8;
+const gsize RECORD_HEADER_SIZE = 32;
+// Upper limit of the text length, anything larger is considered corrupted.
+const gsize MAX_TEXT_LENGTH = 16 * 1024 * 1024;
+
+// Returns true if data starts with the binary log header.
+bool isBinary(const char *data, gsize size);
+
+// Encodes a record, the returned buffer should be freed by g_free().
+char *encodeRecord(const Record &record, gsize *length);
+
+// Decodes a record at a given position. Returns the size of the whole record,
+// or 0 if there is no valid record at the position (the record is corrupted or
+// incomplete). The text in the record points into data.
+gsize decodeRecord(const char *data, gsize size, gsize pos, Record &record);
+
+// Returns the position of the next record marker at or after a given position,
+// or size if there is no marker.
+gsize findRecord(const char *data, gsize size, gsize pos);
+
+guint32 crc32(guint32 crc, const char *data, gsize length);
+
+} // namespace ConversationLogFormat
+
+#endif // CONVERSATIONLOGFORMAT_H
+
+// vim: set tabstop=2 shiftwidth=2 textwidth=80 expandtab:
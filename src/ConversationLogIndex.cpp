@@ -0,0 +1,402 @@
+// Copyright (C) 2016 Petr Pavlu <setup@dagobah.cz>
+//
+// This file is part of CenterIM.
+//
+// CenterIM is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// CenterIM is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with CenterIM.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "ConversationLogIndex.h"
+
+#include "ConversationLogFormat.h"
+#include "Log.h"
+
+#include "gettext.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <glib/gstdio.h>
+#include <unistd.h>
+
+#define INDEX_MAGIC "CIMLIDX1"
+#define INDEX_MAGIC_LENGTH 8
+#define INDEX_ENTRY_SIZE 32
+
+ConversationLogIndex::ConversationLogIndex()
+  : log_filename_(nullptr), index_filename_(nullptr), indexfile_(nullptr),
+    log_size_(0), binary_(false), loaded_(false)
+{
+}
+
+ConversationLogIndex::~ConversationLogIndex()
+{
+  close();
+}
+
+void ConversationLogIndex::open(const char *log_filename)
+{
+  g_assert(log_filename != nullptr);
+
+  close();
+  log_filename_ = g_strdup(log_filename);
+  index_filename_ = g_strconcat(log_filename_, ".idx", nullptr);
+
+  // Map the logfile.
+  GError *err = nullptr;
+  GMappedFile *mapped = g_mapped_file_new(log_filename_, FALSE, &err);
+  if (mapped == nullptr) {
+    LOG->error(_("Error opening conversation logfile '%s' (%s)."),
+      log_filename_, err->message);
+    g_clear_error(&err);
+    return;
+  }
+  const char *data = g_mapped_file_get_contents(mapped);
+  gsize size = g_mapped_file_get_length(mapped);
+  log_size_ = size;
+  binary_ = ConversationLogFormat::isBinary(data, size);
+  loaded_ = true;
+
+  // Check that the index matches the logfile. The last indexed record has to
+  // start at a record boundary and the covered part has to end at one too. The
+  // binary format can have a corrupted tail after the covered part, it is
+  // skipped by scanLog().
+  bool changed = false;
+  bool valid = loadIndex();
+  guint64 covered = getCoveredSize();
+  if (valid && !entries_.empty() &&
+    (covered > size || !isRecordStart(data, size, entries_.back().offset) ||
+        (covered < size && !binary_ && !isRecordStart(data, size, covered))))
+    valid = false;
+
+  if (!valid) {
+    // Rebuild the whole index.
+    entries_.clear();
+    covered = 0;
+    changed = true;
+  }
+
+  if (covered < size) {
+    // Index new messages.
+    std::size_t old_count = entries_.size();
+    scanLog(data, size, covered);
+    if (entries_.size() != old_count)
+      changed = true;
+  }
+
+  g_mapped_file_unref(mapped);
+
+  if (changed && !saveIndex())
+    return;
+
+  // Open the index for appending. The index can be always rebuilt so it does
+  // not need to be synced to the disk.
+  indexfile_ = FILEWRITER->openFile(index_filename_, false, &err);
+  if (indexfile_ == nullptr) {
+    LOG->error(_("Error opening conversation log index '%s' (%s)."),
+      index_filename_, err->message);
+    g_clear_error(&err);
+  }
+}
+
+void ConversationLogIndex::openForAppend(const char *log_filename)
+{
+  g_assert(log_filename != nullptr);
+
+  close();
+  log_filename_ = g_strdup(log_filename);
+  index_filename_ = g_strconcat(log_filename_, ".idx", nullptr);
+
+  // Read the size and the format header of the logfile.
+  int fd = g_open(log_filename_, O_RDONLY, 0);
+  GStatBuf st;
+  if (fd == -1 || fstat(fd, &st) != 0) {
+    LOG->error(_("Error opening conversation logfile '%s' (%s)."),
+      log_filename_, g_strerror(errno));
+    if (fd != -1)
+      ::close(fd);
+    return;
+  }
+  char header[ConversationLogFormat::HEADER_SIZE];
+  ssize_t read_size = read(fd, header, sizeof(header));
+  ::close(fd);
+
+  log_size_ = st.st_size;
+  binary_ = read_size > 0 && ConversationLogFormat::isBinary(header, read_size);
+}
+
+void ConversationLogIndex::close()
+{
+  if (indexfile_ != nullptr) {
+    FILEWRITER->closeFile(indexfile_);
+    indexfile_ = nullptr;
+  }
+  g_free(log_filename_);
+  log_filename_ = nullptr;
+  g_free(index_filename_);
+  index_filename_ = nullptr;
+
+  entries_.clear();
+  log_size_ = 0;
+  binary_ = false;
+  loaded_ = false;
+}
+
+void ConversationLogIndex::release()
+{
+  if (indexfile_ != nullptr) {
+    FILEWRITER->closeFile(indexfile_);
+    indexfile_ = nullptr;
+  }
+
+  // Release the memory, clear() keeps the capacity.
+  Entries().swap(entries_);
+  loaded_ = false;
+}
+
+void ConversationLogIndex::startBinaryLog()
+{
+  g_assert(log_size_ == 0);
+
+  log_size_ = ConversationLogFormat::HEADER_SIZE;
+  binary_ = true;
+}
+
+guint64 ConversationLogIndex::append(
+  time_t sent_time, time_t show_time, std::size_t length)
+{
+  Entry entry;
+  entry.offset = log_size_;
+  entry.length = length;
+  entry.sent_time = sent_time;
+  entry.show_time = show_time;
+  log_size_ += length;
+
+  if (!loaded_)
+    return entry.offset;
+
+  entries_.push_back(entry);
+
+  if (indexfile_ == nullptr)
+    return entry.offset;
+
+  char *buf = g_new(char, INDEX_ENTRY_SIZE);
+  encodeEntry(entry, buf);
+  FILEWRITER->write(indexfile_, buf, INDEX_ENTRY_SIZE);
+  return entry.offset;
+}
+
+std::size_t ConversationLogIndex::findByTime(time_t show_time) const
+{
+  Entries::const_iterator i = std::lower_bound(entries_.begin(),
+    entries_.end(), show_time,
+    [](const Entry &entry, time_t t) { return entry.show_time < t; });
+  return i - entries_.begin();
+}
+
+bool ConversationLogIndex::loadIndex()
+{
+  entries_.clear();
+
+  char *contents;
+  gsize length;
+  if (!g_file_get_contents(index_filename_, &contents, &length, nullptr)) {
+    // The index does not exist yet.
+    return false;
+  }
+
+  bool res = false;
+  if (length >= INDEX_MAGIC_LENGTH &&
+    std::memcmp(contents, INDEX_MAGIC, INDEX_MAGIC_LENGTH) == 0 &&
+    (length - INDEX_MAGIC_LENGTH) % INDEX_ENTRY_SIZE == 0) {
+    res = true;
+    std::size_t count = (length - INDEX_MAGIC_LENGTH) / INDEX_ENTRY_SIZE;
+    entries_.reserve(count);
+    guint64 end = 0;
+    for (std::size_t i = 0; i < count; ++i) {
+      Entry entry;
+      decodeEntry(
+        contents + INDEX_MAGIC_LENGTH + i * INDEX_ENTRY_SIZE, entry);
+      // Records must be stored one after another.
+      if (entry.offset < end || entry.length == 0) {
+        res = false;
+        break;
+      }
+      end = entry.offset + entry.length;
+      entries_.push_back(entry);
+    }
+  }
+
+  if (!res) {
+    LOG->debug("Conversation log index '%s' is corrupted, rebuilding it.",
+      index_filename_);
+    entries_.clear();
+  }
+
+  g_free(contents);
+  return res;
+}
+
+bool ConversationLogIndex::writeIndex(
+  const char *log_filename, const char *data, gsize size, GError **error)
+{
+  g_assert(log_filename != nullptr);
+
+  ConversationLogIndex index;
+  index.index_filename_ = g_strconcat(log_filename, ".idx", nullptr);
+  index.binary_ = ConversationLogFormat::isBinary(data, size);
+  index.scanLog(data, size, 0);
+  return index.writeEntries(error);
+}
+
+bool ConversationLogIndex::saveIndex() const
+{
+  GError *err = nullptr;
+  bool res = writeEntries(&err);
+  if (!res) {
+    LOG->error(_("Error writing conversation log index '%s' (%s)."),
+      index_filename_, err->message);
+    g_clear_error(&err);
+  }
+  return res;
+}
+
+bool ConversationLogIndex::writeEntries(GError **error) const
+{
+  gsize length = INDEX_MAGIC_LENGTH + entries_.size() * INDEX_ENTRY_SIZE;
+  char *contents = g_new(char, length);
+  std::memcpy(contents, INDEX_MAGIC, INDEX_MAGIC_LENGTH);
+  char *p = contents + INDEX_MAGIC_LENGTH;
+  for (const Entry &entry : entries_) {
+    encodeEntry(entry, p);
+    p += INDEX_ENTRY_SIZE;
+  }
+
+  bool res = g_file_set_contents(index_filename_, contents, length, error);
+  g_free(contents);
+  return res;
+}
+
+void ConversationLogIndex::scanLog(const char *data, gsize size, gsize pos)
+{
+  if (binary_) {
+    scanBinaryLog(data, size, pos);
+    return;
+  }
+
+  // Skip to the first record.
+  while (pos < size && !isRecordStart(data, size, pos))
+    pos = nextLine(data, size, pos);
+
+  while (pos < size) {
+    Entry entry;
+    entry.offset = pos;
+
+    // A record spans to the next record start (cim4 messages can have multiple
+    // lines).
+    gsize end = nextLine(data, size, pos);
+    while (end < size && !isRecordStart(data, size, end))
+      end = nextLine(data, size, end);
+    entry.length = end - pos;
+
+    // Locate the record header: direction, type, sent time and show time.
+    gsize header[4];
+    gsize p = nextLine(data, size, pos);
+    for (int i = 0; i < 4; ++i) {
+      header[i] = p;
+      p = nextLine(data, size, p);
+    }
+    pos = end;
+
+    // Skip an incomplete record. This can be a message that is just being
+    // written or a result of an unclean exit.
+    if (header[3] >= end || data[end - 1] != '\n')
+      continue;
+
+    entry.sent_time = g_ascii_strtoll(data + header[2], nullptr, 10);
+    entry.show_time = g_ascii_strtoll(data + header[3], nullptr, 10);
+    entries_.push_back(entry);
+  }
+}
+
+void ConversationLogIndex::scanBinaryLog(
+  const char *data, gsize size, gsize pos)
+{
+  pos = std::max(pos, ConversationLogFormat::HEADER_SIZE);
+  while (pos < size) {
+    ConversationLogFormat::Record record;
+    gsize length = ConversationLogFormat::decodeRecord(data, size, pos, record);
+    if (length == 0) {
+      // Skip a corrupted or incomplete record.
+      pos = ConversationLogFormat::findRecord(data, size, pos + 1);
+      continue;
+    }
+
+    Entry entry;
+    entry.offset = pos;
+    entry.length = length;
+    entry.sent_time = record.sent_time;
+    entry.show_time = record.show_time;
+    entries_.push_back(entry);
+    pos += length;
+  }
+}
+
+guint64 ConversationLogIndex::getCoveredSize() const
+{
+  if (entries_.empty())
+    return 0;
+  return entries_.back().offset + entries_.back().length;
+}
+
+bool ConversationLogIndex::isRecordStart(
+  const char *data, gsize size, gsize pos) const
+{
+  if (binary_) {
+    ConversationLogFormat::Record record;
+    return ConversationLogFormat::decodeRecord(data, size, pos, record) != 0;
+  }
+  return pos + 2 <= size && data[pos] == '\f' && data[pos + 1] == '\n';
+}
+
+gsize ConversationLogIndex::nextLine(const char *data, gsize size, gsize pos)
+{
+  if (pos >= size)
+    return size;
+
+  const char *eol =
+    static_cast<const char *>(std::memchr(data + pos, '\n', size - pos));
+  if (eol == nullptr)
+    return size;
+  return eol - data + 1;
+}
+
+void ConversationLogIndex::encodeEntry(const Entry &entry, char *buf)
+{
+  guint64 values[4] = {GUINT64_TO_LE(entry.offset),
+    GUINT64_TO_LE(entry.length),
+    GUINT64_TO_LE(static_cast<guint64>(entry.sent_time)),
+    GUINT64_TO_LE(static_cast<guint64>(entry.show_time))};
+  std::memcpy(buf, values, sizeof(values));
+}
+
+void ConversationLogIndex::decodeEntry(const char *buf, Entry &entry)
+{
+  guint64 values[4];
+  std::memcpy(values, buf, sizeof(values));
+  entry.offset = GUINT64_FROM_LE(values[0]);
+  entry.length = GUINT64_FROM_LE(values[1]);
+  entry.sent_time = static_cast<gint64>(GUINT64_FROM_LE(values[2]));
+  entry.show_time = static_cast<gint64>(GUINT64_FROM_LE(values[3]));
+}
+
+// vim: set tabstop=2 shiftwidth=2 textwidth=80 expandtab:
@@ -0,0 +1,127 @@
+// Copyright (C) 2016 Petr Pavlu <setup@dagobah.cz>
+//
+// This file is part of CenterIM.
+//
+// CenterIM is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// CenterIM is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with CenterIM.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef CONVERSATIONLOGINDEX_H
+#define CONVERSATIONLOGINDEX_H
+
+#include "FileWriter.h"
+
+#include <cppconsui/CppConsUI.h>
+#include <ctime>
+#include <glib.h>
+#include <vector>
+
+// Sidecar index of a conversation logfile. The index is stored next to the
+// logfile (with the ".idx" suffix) and contains a fixed-size entry with a byte
+// offset and timestamps for each message in the log. This makes it possible to
+// access any message in the log without parsing it from the start.
+//
+// The index file consists of a magic header followed by the entries. Each
+// entry is formed of four 64-bit little-endian integers: the offset of the
+// message record in the logfile, the length of the record, the sent time and
+// the show time. The index is append-only, the covered part of the logfile is
+// determined by the end of the last record.
+class ConversationLogIndex {
+public:
+  struct Entry {
+    // Byte offset of the record start (the "\f\n" line in the text format) in
+    // the logfile.
+    guint64 offset;
+    // Length of the whole record in bytes.
+    guint64 length;
+    time_t sent_time;
+    time_t show_time;
+  };
+
+  ConversationLogIndex();
+  ~ConversationLogIndex();
+
+  // Opens the index for a given logfile. If the index does not exist or it is
+  // stale then it is rebuilt (or only extended if the logfile was merely
+  // appended to).
+  void open(const char *log_filename);
+  // Opens the index for a given logfile in the released state (see release()).
+  // Only the size and format of the logfile are read, the index itself is not
+  // loaded or checked.
+  void openForAppend(const char *log_filename);
+  void close();
+  // Drops the loaded entries and closes the index file but keeps the logfile
+  // size so append() can still report offsets of new messages. Such messages
+  // are not written to the index, open() picks them up from the logfile.
+  void release();
+  bool isOpen() const { return log_filename_ != nullptr; }
+  bool isLoaded() const { return loaded_; }
+
+  // Records that a new message of a given length was appended to the logfile.
+  // The index entry is written asynchronously by FileWriter, a released index
+  // only advances the logfile size. Returns the offset of the message record in
+  // the logfile.
+  guint64 append(time_t sent_time, time_t show_time, std::size_t length);
+
+  // Records that the binary format header was written to an empty logfile.
+  void startBinaryLog();
+
+  bool isBinaryLog() const { return binary_; }
+  guint64 getLogSize() const { return log_size_; }
+
+  std::size_t getMessageCount() const { return entries_.size(); }
+  const Entry &getEntry(std::size_t i) const { return entries_[i]; }
+
+  // Builds and saves an index for logfile data that is held in memory. Returns
+  // false and sets error on failure. The function does not use any purple or
+  // Log functions and can be called from any thread.
+  static bool writeIndex(
+    const char *log_filename, const char *data, gsize size, GError **error);
+
+  // Returns index of the first message that was shown at or after a given
+  // time, or the number of messages if there is no such message.
+  std::size_t findByTime(time_t show_time) const;
+
+protected:
+  typedef std::vector<Entry> Entries;
+
+  char *log_filename_;
+  char *index_filename_;
+  FileWriter::File *indexfile_;
+
+  Entries entries_;
+  // Size of the logfile in bytes, this is where the next record will start.
+  guint64 log_size_;
+  // The logfile uses the binary format.
+  bool binary_;
+  // The entries are loaded and new ones are written to the index file.
+  bool loaded_;
+
+  bool loadIndex();
+  bool saveIndex() const;
+  bool writeEntries(GError **error) const;
+  void scanLog(const char *data, gsize size, gsize pos);
+  void scanBinaryLog(const char *data, gsize size, gsize pos);
+  guint64 getCoveredSize() const;
+
+  bool isRecordStart(const char *data, gsize size, gsize pos) const;
+  static gsize nextLine(const char *data, gsize size, gsize pos);
+  static void encodeEntry(const Entry &entry, char *buf);
+  static void decodeEntry(const char *buf, Entry &entry);
+
+private:
+  CONSUI_DISABLE_COPY(ConversationLogIndex);
+};
+
+#endif // CONVERSATIONLOGINDEX_H
+
+// vim: set tabstop=2 shiftwidth=2 textwidth=80 expandtab:
@@ -17,52 +17,58 @@
 
 #include "ConversationRoomList.h"
 
+#include <cstring>
+
 // Move the widget to a position according to sorting function.
-void ConversationRoomList::moveToSortedPosition(Buddy *new_buddy)
+void ConversationRoomList::moveToSortedPosition(Buddy *buddy)
 {
-  Buddy *buddy = nullptr;
-  CppConsUI::Widgets::iterator iter;
-
-  g_assert(new_buddy != nullptr);
-
-  for (iter = children_.begin(); iter != children_.end(); ++iter) {
-    buddy = dynamic_cast<Buddy *>(*iter);
-    g_assert(buddy != nullptr);
-
-    // If buddy is in the list already, skip it.
-    if (*buddy == *new_buddy)
-      continue;
-
-    // Break once insertion point is found.
-    if (!Buddy::less_than_op_away_name(*buddy, *new_buddy))
-      break;
-  }
+  g_assert(buddy != nullptr);
 
-  // Do not change anything if wanting to put into the same position (also
-  // returns on single node case).
-  if (*buddy == *new_buddy)
-    return;
+  // Re-insert the buddy into the index with an updated key. The key cannot
+  // change while the buddy is in the index.
+  sorted_buddies_.erase(buddy);
+  buddy->updateSortKey();
+  SortedBuddies::iterator i = sorted_buddies_.insert(buddy).first;
+
+  // Move the widget next to its new neighbour.
+  SortedBuddies::iterator next = i;
+  ++next;
+  if (next != sorted_buddies_.end())
+    moveWidgetBefore(*buddy, **next);
+  else if (i != sorted_buddies_.begin())
+    moveWidgetAfter(*buddy, **--i);
+}
 
-  // Insert after if at end.
-  if (iter == children_.end())
-    moveWidgetAfter(*new_buddy, *buddy);
-  else
-    moveWidgetBefore(*new_buddy, *buddy);
+void ConversationRoomList::applySortedOrder()
+{
+  // All children are buddies so they can be put in the order of the index in
+  // one pass.
+  g_assert(children_.size() == sorted_buddies_.size());
+  children_.assign(sorted_buddies_.begin(), sorted_buddies_.end());
+
+  updateFocusChain();
+  updateArea();
+  redraw();
 }
 
 void ConversationRoomList::add_users(GList *cbuddies, gboolean /*new_arrivals*/)
 {
+  // Add all users to the index first and then sort the widgets at once. This
+  // matters when joining a room with thousands of users.
+  beginUpdate();
   for (GList *l = cbuddies; l != nullptr; l = l->next) {
     PurpleConvChatBuddy *pbuddy = static_cast<PurpleConvChatBuddy *>(l->data);
 
     auto buddy = new Buddy(pbuddy);
     buddy->setButtonText();
+    buddy->updateSortKey();
     buddies_[pbuddy->name] = buddy;
+    sorted_buddies_.insert(buddy);
 
     appendWidget(*buddy);
-
-    moveToSortedPosition(buddy);
   }
+  applySortedOrder();
+  endUpdate();
 }
 
 void ConversationRoomList::rename_user(
@@ -99,6 +105,7 @@ void ConversationRoomList::rename_user(
 
 void ConversationRoomList::remove_users(GList *users)
 {
+  beginUpdate();
   for (GList *l = users; l != nullptr; l = l->next) {
     const char *name = static_cast<const char *>(l->data);
 
@@ -108,11 +115,14 @@ void ConversationRoomList::remove_users(GList *users)
     Buddies::iterator iter = buddies_.find(name);
 
     if (buddies_.end() != iter) {
+      Buddy *buddy = iter->second;
       buddies_.erase(iter);
+      sorted_buddies_.erase(buddy);
       // NOTE: this deletes the buddy object.
-      removeWidget(*iter->second);
+      removeWidget(*buddy);
     }
   }
+  endUpdate();
 }
 
 void ConversationRoomList::update_user(const char *user)
@@ -134,7 +144,8 @@ void ConversationRoomList::update_user(const char *user)
 }
 
 ConversationRoomList::Buddy::Buddy(PurpleConvChatBuddy *pbuddy)
-  : CppConsUI::Button(AUTOSIZE, 1, ""), pbuddy_(pbuddy)
+  : CppConsUI::Button(AUTOSIZE, 1, ""), pbuddy_(pbuddy), sort_op_(false),
+    sort_away_(false), sort_key_(nullptr)
 {
   // Set ui data.
   // NOTE: PurpleConvChatBuddy::ui_data is pidgin 2.9!!
@@ -143,6 +154,7 @@ ConversationRoomList::Buddy::Buddy(PurpleConvChatBuddy *pbuddy)
 
 ConversationRoomList::Buddy::~Buddy()
 {
+  g_free(sort_key_);
 }
 
 void ConversationRoomList::Buddy::readFlags(
@@ -200,11 +212,6 @@ const char *ConversationRoomList::Buddy::displayName() const
     return pbuddy_->name;
 }
 
-bool ConversationRoomList::Buddy::operator==(const Buddy &rhs)
-{
-  return pbuddy_ == rhs.pbuddy_;
-}
-
 void ConversationRoomList::Buddy::setPurpleBuddy(PurpleConvChatBuddy *pbuddy)
 {
   pbuddy_ = pbuddy;
@@ -212,6 +219,15 @@ void ConversationRoomList::Buddy::setPurpleBuddy(PurpleConvChatBuddy *pbuddy)
   // pbuddy_->ui_data = static_cast<void*>(this);
 }
 
+void ConversationRoomList::Buddy::updateSortKey()
+{
+  bool is_typing;
+  readFlags(sort_op_, is_typing, sort_away_);
+
+  g_free(sort_key_);
+  sort_key_ = g_utf8_collate_key(displayName(), -1);
+}
+
 bool ConversationRoomList::Buddy::less_than_op_away_name(
   const Buddy &lhs, const Buddy &rhs)
 {
@@ -221,27 +237,25 @@ bool ConversationRoomList::Buddy::less_than_op_away_name(
   // 2. online (vs away)
   // 3. name/alias
 
-  bool lhs_is_op, lhs_is_typing, lhs_is_away;
-  bool rhs_is_op, rhs_is_typing, rhs_is_away;
-
-  lhs.readFlags(lhs_is_op, lhs_is_typing, lhs_is_away);
-  rhs.readFlags(rhs_is_op, rhs_is_typing, rhs_is_away);
+  // The cached sort keys are compared so the order of buddies in the sorted
+  // index does not change until they are re-inserted.
+  if (lhs.sort_op_ != rhs.sort_op_)
+    return lhs.sort_op_;
+  if (lhs.sort_away_ != rhs.sort_away_)
+    return !lhs.sort_away_;
+  return std::strcmp(lhs.sort_key_, rhs.sort_key_) < 0;
+}
 
-  // Probably a more elegant way to do this.
-  if (lhs_is_op && !rhs_is_op)
+bool ConversationRoomList::BuddyLess::operator()(
+  const Buddy *lhs, const Buddy *rhs) const
+{
+  if (Buddy::less_than_op_away_name(*lhs, *rhs))
     return true;
-  else if (!lhs_is_op && rhs_is_op)
+  if (Buddy::less_than_op_away_name(*rhs, *lhs))
     return false;
-  // Equal op or non-op status.
-  else {
-    if (lhs_is_away && !rhs_is_away)
-      return false;
-    else if (!lhs_is_away && rhs_is_away)
-      return true;
-    // On equal online/away status.
-    else
-      return g_utf8_collate(lhs.displayName(), rhs.displayName()) < 0;
-  }
+
+  // Keep buddies with the same name and flags apart.
+  return lhs < rhs;
 }
 
 // vim: set tabstop=2 shiftwidth=2 textwidth=80 expandtab:
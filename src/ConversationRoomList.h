@@ -23,6 +23,7 @@
 #include <libpurple/purple.h>
 
 #include <map>
+#include <set>
 
 class ConversationRoomList : public CppConsUI::ListBox {
 public:
@@ -63,24 +64,38 @@ protected:
     // Update purple buddy (for rename case).
     void setPurpleBuddy(PurpleConvChatBuddy *pbuddy);
 
+    // Recomputes the cached sort key from pbuddy info. Must not be called
+    // while the buddy is stored in the sorted index.
+    void updateSortKey();
+
     // Sorting method for: op/away/display_name
     // if less than: give priority
     // The idea that if more sorting methods are desired, they can be swapped
     // out at runtime based on config.
     static bool less_than_op_away_name(const Buddy &lhs, const Buddy &rhs);
 
-    bool operator==(const Buddy &rhs);
-
   private:
     void readFlags(bool &is_op, bool &is_typing, bool &is_away) const;
 
     // Note: When remove_users op is called, this pointer is invalidated!.
     PurpleConvChatBuddy *pbuddy_;
 
+    // Cached sort key.
+    bool sort_op_;
+    bool sort_away_;
+    // Collation key of displayName().
+    char *sort_key_;
+
     CONSUI_DISABLE_COPY(Buddy);
   };
 
+  // Strict ordering of buddies for the sorted index.
+  struct BuddyLess {
+    bool operator()(const Buddy *lhs, const Buddy *rhs) const;
+  };
+
   typedef std::map<std::string, Buddy *> Buddies;
+  typedef std::set<Buddy *, BuddyLess> SortedBuddies;
 
   PurpleConversation *conv_;
 
@@ -92,9 +107,15 @@ protected:
   // versions this map is required anyways... :/
   Buddies buddies_;
 
+  // All buddies in the order in which they are shown.
+  SortedBuddies sorted_buddies_;
+
   // Move buddy to sorted position.
   void moveToSortedPosition(Buddy *buddy);
 
+  // Reorder all widgets according to the sorted index.
+  void applySortedOrder();
+
 private:
   CONSUI_DISABLE_COPY(ConversationRoomList);
 };
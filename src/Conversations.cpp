@@ -19,8 +19,14 @@
 #include "Conversations.h"
 
 #include "gettext.h"
+#include <cstdio>
 #include <cstring>
 
+// Number of threads loading conversation histories.
+#define CONVERSATIONS_HISTORY_THREADS 2
+// How often idle conversations are checked for hibernation (in seconds).
+#define CONVERSATIONS_HIBERNATE_CHECK_INTERVAL 60
+
 Conversations *Conversations::my_instance_ = nullptr;
 
 Conversations *Conversations::instance()
@@ -97,6 +103,11 @@ Conversations::Conversations()
 {
   setColorScheme(CenterIM::SCHEME_CONVERSATION);
 
+  // Create the history loading pool. Only a few threads are used because the
+  // loading is mostly I/O bound.
+  history_pool_ = g_thread_pool_new(ConversationHistoryLoader::load_, nullptr,
+    CONVERSATIONS_HISTORY_THREADS, FALSE, nullptr);
+
   outer_list_ = new CppConsUI::HorizontalListBox(AUTOSIZE, 1);
   addWidget(*outer_list_, 0, 0);
 
@@ -113,6 +124,16 @@ Conversations::Conversations()
   purple_prefs_add_int(CONF_PREFIX "/chat/partitioning", 80);
   purple_prefs_add_int(CONF_PREFIX "/chat/roomlist_partitioning", 80);
   purple_prefs_add_bool(CONF_PREFIX "/chat/beep_on_msg", false);
+  purple_prefs_add_string(CONF_PREFIX "/chat/log_sync", "idle");
+  purple_prefs_add_int(CONF_PREFIX "/chat/log_sync_interval", 1000);
+  purple_prefs_add_string(CONF_PREFIX "/chat/log_format", "text");
+  purple_prefs_add_int(CONF_PREFIX "/chat/hibernate_timeout", 60);
+
+  updateLogSyncMode();
+  purple_prefs_connect_callback(
+    this, CONF_PREFIX "/chat/log_sync", log_sync_pref_change_, this);
+  purple_prefs_connect_callback(
+    this, CONF_PREFIX "/chat/log_sync_interval", log_sync_pref_change_, this);
 
   // send_typing caching.
   send_typing_ = purple_prefs_get_bool("/purple/conversations/im/send_typing");
@@ -151,16 +172,33 @@ Conversations::Conversations()
   purple_signal_connect(connections_handle, "signed-on", this,
     PURPLE_CALLBACK(account_signed_on_), this);
 
+  hibernate_timer_id_ =
+    g_timeout_add_seconds(CONVERSATIONS_HIBERNATE_CHECK_INTERVAL,
+      hibernate_idle_conversations_, this);
+
+  jump_cmd_id_ = purple_cmd_register("jump", "s", PURPLE_CMD_P_DEFAULT,
+    static_cast<PurpleCmdFlag>(PURPLE_CMD_FLAG_IM | PURPLE_CMD_FLAG_CHAT),
+    nullptr, PURPLE_CMD_FUNC(jump_cmd_),
+    _("jump &lt;date&gt;: Scroll to the first message shown on or after a "
+      "given date (YYYY-MM-DD)."),
+    this);
+
   onScreenResized();
 }
 
 Conversations::~Conversations()
 {
+  g_source_remove(hibernate_timer_id_);
+  purple_cmd_unregister(jump_cmd_id_);
+
   // Close all opened conversations.
   while (!conversations_.empty())
     purple_conversation_destroy(
       conversations_.front().conv->getPurpleConversation());
 
+  // All loaders were cancelled so this finishes quickly.
+  g_thread_pool_free(history_pool_, FALSE, TRUE);
+
   purple_conversations_set_ui_ops(nullptr);
   purple_prefs_disconnect_by_handle(this);
   purple_signals_disconnect_by_handle(this);
@@ -184,11 +222,12 @@ void Conversations::finalize()
 
 int Conversations::findConversation(PurpleConversation *conv)
 {
-  for (int i = 0; i < static_cast<int>(conversations_.size()); ++i)
-    if (conversations_[i].conv->getPurpleConversation() == conv)
-      return i;
+  ConversationsIndex::const_iterator i = conversations_index_.find(conv);
+  if (i == conversations_index_.end())
+    return -1;
 
-  return -1;
+  g_assert(conversations_[i->second].conv->getPurpleConversation() == conv);
+  return i->second;
 }
 
 int Conversations::prevActiveConversation(int current)
@@ -248,6 +287,7 @@ void Conversations::activateConversation(int i)
   if (active_ != -1) {
     conversations_[active_].label->setColorScheme(0);
     conversations_[active_].conv->hide();
+    conversations_[active_].last_active = time(nullptr);
   }
 
   active_ = i;
@@ -273,6 +313,51 @@ void Conversations::updateLabels()
     updateLabel(i);
 }
 
+void Conversations::reportMemoryUsage(MemoryReport &report) const
+{
+  for (const ConvChild &conv_child : conversations_)
+    conv_child.conv->reportMemoryUsage(report);
+}
+
+void Conversations::hibernateIdleConversations()
+{
+  int timeout = purple_prefs_get_int(CONF_PREFIX "/chat/hibernate_timeout");
+  if (timeout <= 0)
+    return;
+
+  time_t limit = time(nullptr) - timeout * 60;
+  for (int i = 0; i < static_cast<int>(conversations_.size()); ++i)
+    if (i != active_ && conversations_[i].last_active <= limit)
+      conversations_[i].conv->hibernate();
+}
+
+PurpleCmdRet Conversations::jump_cmd(
+  PurpleConversation *conv, char **args, char **error)
+{
+  Conversation *conversation = static_cast<Conversation *>(conv->ui_data);
+  if (conversation == nullptr)
+    return PURPLE_CMD_RET_FAILED;
+
+  struct tm tm;
+  std::memset(&tm, 0, sizeof(tm));
+  char rest;
+  if (std::sscanf(args[0], "%d-%d-%d%c", &tm.tm_year, &tm.tm_mon,
+        &tm.tm_mday, &rest) != 3) {
+    *error = g_strdup(_("The date has to be in the YYYY-MM-DD format."));
+    return PURPLE_CMD_RET_FAILED;
+  }
+  tm.tm_year -= 1900;
+  tm.tm_mon -= 1;
+  tm.tm_isdst = -1;
+
+  time_t t = mktime(&tm);
+  if (t == static_cast<time_t>(-1) || !conversation->showLogTime(t)) {
+    *error = g_strdup(_("No message was shown on or after the date."));
+    return PURPLE_CMD_RET_FAILED;
+  }
+  return PURPLE_CMD_RET_OK;
+}
+
 void Conversations::create_conversation(PurpleConversation *conv)
 {
   g_return_if_fail(conv != nullptr);
@@ -293,8 +378,10 @@ void Conversations::create_conversation(PurpleConversation *conv)
   c.conv = conversation;
   c.label = new CppConsUI::Label(AUTOSIZE, 1);
   c.typing_status = ' ';
+  c.last_active = time(nullptr);
   conv_list_->appendWidget(*c.label);
   conversations_.push_back(c);
+  conversations_index_[conv] = conversations_.size() - 1;
   updateLabels();
 
   // Show the first conversation if there is not any already.
@@ -329,6 +416,12 @@ void Conversations::destroy_conversation(PurpleConversation *conv)
   conv_list_->removeWidget(*conversations_[i].label);
   conversations_.erase(conversations_.begin() + i);
 
+  // Fix up positions of the following conversations.
+  conversations_index_.erase(conv);
+  for (ConversationsIndex::value_type &entry : conversations_index_)
+    if (entry.second > i)
+      --entry.second;
+
   if (active_ > i) {
     // Fix up the number of the active conversation.
     --active_;
@@ -466,6 +559,22 @@ void Conversations::account_signed_on(PurpleConnection *gc)
   }
 }
 
+void Conversations::updateLogSyncMode()
+{
+  const char *mode = purple_prefs_get_string(CONF_PREFIX "/chat/log_sync");
+  int interval = purple_prefs_get_int(CONF_PREFIX "/chat/log_sync_interval");
+
+  FileWriter::SyncMode sync_mode;
+  if (std::strcmp(mode, "interval") == 0)
+    sync_mode = FileWriter::SYNC_INTERVAL;
+  else if (std::strcmp(mode, "message") == 0)
+    sync_mode = FileWriter::SYNC_MESSAGE;
+  else
+    sync_mode = FileWriter::SYNC_IDLE;
+
+  FILEWRITER->setSyncMode(sync_mode, interval);
+}
+
 void Conversations::send_typing_pref_change(
   const char *name, PurplePrefType /*type*/, gconstpointer /*val*/)
 {
@@ -473,4 +582,10 @@ void Conversations::send_typing_pref_change(
   send_typing_ = purple_prefs_get_bool(name);
 }
 
+void Conversations::log_sync_pref_change(const char * /*name*/,
+  PurplePrefType /*type*/, gconstpointer /*val*/)
+{
+  updateLogSyncMode();
+}
+
 // vim: set tabstop=2 shiftwidth=2 textwidth=80 expandtab:
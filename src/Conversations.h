@@ -26,6 +26,7 @@
 #include <cppconsui/Spacer.h>
 #include <cppconsui/Window.h>
 #include <libpurple/purple.h>
+#include <map>
 #include <vector>
 
 #define CONVERSATIONS (Conversations::instance())
@@ -46,17 +47,31 @@ public:
 
   bool getSendTypingPref() const { return send_typing_; }
 
+  // Thread pool used for loading conversation histories.
+  GThreadPool *getHistoryPool() const { return history_pool_; }
+
+  // Adds memory held by all open conversations to a report.
+  void reportMemoryUsage(MemoryReport &report) const;
+
 private:
   struct ConvChild {
     Conversation *conv;
     CppConsUI::Label *label;
     char typing_status;
+    // Time when the conversation was last shown.
+    time_t last_active;
   };
 
   typedef std::vector<ConvChild> ConversationsVector;
+  typedef std::map<PurpleConversation *, int> ConversationsIndex;
 
   ConversationsVector conversations_;
 
+  // Position of each conversation in conversations_, it is kept in sync with
+  // the vector so that dispatching of conversation callbacks does not need to
+  // scan all open conversations.
+  ConversationsIndex conversations_index_;
+
   // Active conversation, -1 if none.
   int active_;
 
@@ -70,6 +85,13 @@ private:
 
   PurpleConversationUiOps centerim_conv_ui_ops_;
 
+  GThreadPool *history_pool_;
+
+  // Timer that hibernates idle conversations.
+  guint hibernate_timer_id_;
+
+  PurpleCmdId jump_cmd_id_;
+
   static Conversations *my_instance_;
 
   Conversations();
@@ -93,6 +115,27 @@ private:
   // Update all conversation labels.
   void updateLabels();
 
+  // Passes the log sync preferences to FileWriter.
+  void updateLogSyncMode();
+
+  static gboolean hibernate_idle_conversations_(gpointer data)
+  {
+    reinterpret_cast<Conversations *>(data)->hibernateIdleConversations();
+    return TRUE;
+  }
+  // Drops the scrollback of conversations that were not shown for longer than
+  // the "hibernate_timeout" preference.
+  void hibernateIdleConversations();
+
+  // Handler of the "/jump <date>" command.
+  static PurpleCmdRet jump_cmd_(PurpleConversation *conv,
+    const char * /*cmd*/, char **args, char **error, void *data)
+  {
+    return reinterpret_cast<Conversations *>(data)->jump_cmd(
+      conv, args, error);
+  }
+  PurpleCmdRet jump_cmd(PurpleConversation *conv, char **args, char **error);
+
   static void create_conversation_(PurpleConversation *conv)
   {
     CONVERSATIONS->create_conversation(conv);
@@ -168,6 +211,16 @@ private:
   }
   void send_typing_pref_change(
     const char *name, PurplePrefType type, gconstpointer val);
+
+  // Called when "log_sync" or "log_sync_interval" preference changes.
+  static void log_sync_pref_change_(
+    const char *name, PurplePrefType type, gconstpointer val, gpointer data)
+  {
+    reinterpret_cast<Conversations *>(data)->log_sync_pref_change(
+      name, type, val);
+  }
+  void log_sync_pref_change(
+    const char *name, PurplePrefType type, gconstpointer val);
 };
 
 #endif // CONVERSATIONS_H
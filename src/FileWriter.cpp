@@ -0,0 +1,396 @@
+// Copyright (C) 2016 Petr Pavlu <setup@dagobah.cz>
+//
+// This file is part of CenterIM.
+//
+// CenterIM is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// CenterIM is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with CenterIM.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "FileWriter.h"
+
+#include "Log.h"
+
+#include "gettext.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdarg>
+#include <fcntl.h>
+#include <glib/gstdio.h>
+#include <unistd.h>
+
+// Maximum number of queued requests before write() blocks.
+#define FILEWRITER_MAX_REQUESTS 1024
+// Maximum number of queued bytes before write() blocks.
+#define FILEWRITER_MAX_QUEUED_BYTES (1024 * 1024)
+// Maximum number of buffers passed to a single writev() call.
+#define FILEWRITER_MAX_IOV 64
+
+struct FileWriter::File {
+  int fd;
+  char *filename;
+  bool durable;
+  // Data was written to the file but it was not synced yet.
+  bool dirty;
+  // An error was already reported for the file. Only the first error is
+  // reported so a failing file (for example, the debug logfile) does not
+  // flood the log.
+  bool error_reported;
+  // Sequence number of the last request queued for the file (or of the last
+  // request queued before the file was opened) and of the last request written
+  // to it. Protected by the mutex.
+  guint64 queued_seq;
+  guint64 written_seq;
+};
+
+FileWriter *FileWriter::my_instance_ = nullptr;
+
+FileWriter *FileWriter::instance()
+{
+  return my_instance_;
+}
+
+FileWriter::File *FileWriter::openFile(
+  const char *filename, bool durable, GError **error)
+{
+  g_assert(filename != nullptr);
+
+  int fd = g_open(filename, O_WRONLY | O_APPEND | O_CREAT, 0666);
+  if (fd == -1) {
+    int errsv = errno;
+    g_set_error_literal(error, G_FILE_ERROR, g_file_error_from_errno(errsv),
+      g_strerror(errsv));
+    return nullptr;
+  }
+
+  File *file = new File;
+  file->fd = fd;
+  file->filename = g_strdup(filename);
+  file->durable = durable;
+  file->dirty = false;
+  file->error_reported = false;
+  file->written_seq = 0;
+
+  // Pending writes to the same filename (for instance, of a previously closed
+  // file) have to be waited for too when the file is flushed.
+  g_mutex_lock(&mutex_);
+  file->queued_seq = queued_seq_;
+  g_mutex_unlock(&mutex_);
+  return file;
+}
+
+void FileWriter::closeFile(File *file)
+{
+  g_assert(file != nullptr);
+
+  g_mutex_lock(&mutex_);
+  while (isQueueFull())
+    g_cond_wait(&done_cond_, &mutex_);
+  queueRequest(file, nullptr, 0);
+  g_mutex_unlock(&mutex_);
+}
+
+void FileWriter::write(File *file, char *data, std::size_t length)
+{
+  g_assert(file != nullptr);
+  g_assert(data != nullptr);
+
+  g_mutex_lock(&mutex_);
+  while (isQueueFull())
+    g_cond_wait(&done_cond_, &mutex_);
+  queueRequest(file, data, length);
+  g_mutex_unlock(&mutex_);
+}
+
+void FileWriter::flush()
+{
+  g_mutex_lock(&mutex_);
+  guint64 target = queued_seq_;
+  if (written_seq_ < target) {
+    // Do not wait for the sync interval to elapse.
+    flush_requested_ = true;
+    g_cond_signal(&queue_cond_);
+    while (written_seq_ < target)
+      g_cond_wait(&done_cond_, &mutex_);
+  }
+  g_mutex_unlock(&mutex_);
+}
+
+void FileWriter::flush(File *file)
+{
+  g_assert(file != nullptr);
+
+  g_mutex_lock(&mutex_);
+  guint64 target = file->queued_seq;
+  if (file->written_seq < target && written_seq_ < target) {
+    // Do not wait for the sync interval to elapse.
+    flush_requested_ = true;
+    g_cond_signal(&queue_cond_);
+    while (file->written_seq < target && written_seq_ < target)
+      g_cond_wait(&done_cond_, &mutex_);
+  }
+  g_mutex_unlock(&mutex_);
+}
+
+void FileWriter::setSyncMode(SyncMode mode, int interval)
+{
+  g_mutex_lock(&mutex_);
+  sync_mode_ = mode;
+  sync_interval_ = static_cast<gint64>(MAX(interval, 0)) * 1000;
+  // Let the writer thread re-evaluate its deadline.
+  g_cond_signal(&queue_cond_);
+  g_mutex_unlock(&mutex_);
+}
+
+FileWriter::FileWriter()
+  : queued_bytes_(0), queue_start_time_(0), queued_seq_(0), written_seq_(0),
+    flush_requested_(false), stop_(false), sync_mode_(SYNC_IDLE),
+    sync_interval_(0), errors_report_id_(0)
+{
+  g_mutex_init(&mutex_);
+  g_cond_init(&queue_cond_);
+  g_cond_init(&done_cond_);
+
+  thread_ = g_thread_new("filewriter", writer_thread_, this);
+}
+
+FileWriter::~FileWriter()
+{
+  // Let the writer thread write out all queued data and wait for it to exit.
+  g_mutex_lock(&mutex_);
+  stop_ = true;
+  g_cond_signal(&queue_cond_);
+  g_mutex_unlock(&mutex_);
+  g_thread_join(thread_);
+
+  // Report any last errors directly.
+  if (errors_report_id_ != 0)
+    g_source_remove(errors_report_id_);
+  reportErrors();
+
+  g_cond_clear(&done_cond_);
+  g_cond_clear(&queue_cond_);
+  g_mutex_clear(&mutex_);
+}
+
+void FileWriter::init()
+{
+  g_assert(my_instance_ == nullptr);
+
+  my_instance_ = new FileWriter;
+}
+
+void FileWriter::finalize()
+{
+  g_assert(my_instance_ != nullptr);
+
+  delete my_instance_;
+  my_instance_ = nullptr;
+}
+
+void FileWriter::writer_thread()
+{
+  g_mutex_lock(&mutex_);
+  while (true) {
+    while (queue_.empty() && !stop_)
+      g_cond_wait(&queue_cond_, &mutex_);
+    if (queue_.empty()) {
+      // Stop was requested and everything is written.
+      break;
+    }
+
+    // In the interval mode, collect more data until the interval elapses.
+    while (sync_mode_ == SYNC_INTERVAL && !stop_ && !flush_requested_ &&
+      !isQueueFull())
+      if (!g_cond_wait_until(
+            &queue_cond_, &mutex_, queue_start_time_ + sync_interval_))
+        break;
+
+    Requests batch;
+    batch.swap(queue_);
+    queued_bytes_ = 0;
+    guint64 seq = queued_seq_;
+    SyncMode mode = sync_mode_;
+    flush_requested_ = false;
+
+    // Wake up anyone waiting for free space in the queue.
+    g_cond_broadcast(&done_cond_);
+    g_mutex_unlock(&mutex_);
+
+    writeBatch(batch, mode);
+
+    g_mutex_lock(&mutex_);
+    written_seq_ = seq;
+    g_cond_broadcast(&done_cond_);
+  }
+  g_mutex_unlock(&mutex_);
+}
+
+bool FileWriter::isQueueFull() const
+{
+  return queue_.size() >= FILEWRITER_MAX_REQUESTS ||
+    queued_bytes_ >= FILEWRITER_MAX_QUEUED_BYTES;
+}
+
+void FileWriter::queueRequest(File *file, char *data, std::size_t length)
+{
+  // Must be called with the mutex held.
+  if (queue_.empty())
+    queue_start_time_ = g_get_monotonic_time();
+
+  Request request = {file, data, length, ++queued_seq_};
+  queue_.push_back(request);
+  queued_bytes_ += length;
+  file->queued_seq = queued_seq_;
+
+  g_cond_signal(&queue_cond_);
+}
+
+void FileWriter::writeBatch(Requests &batch, SyncMode mode)
+{
+  iovec iov[FILEWRITER_MAX_IOV];
+  std::vector<File *> dirty_files;
+
+  Requests::iterator i = batch.begin();
+  while (i != batch.end()) {
+    File *file = i->file;
+
+    if (i->data == nullptr) {
+      // Close request.
+      if (file->dirty) {
+        syncFile(file);
+        dirty_files.erase(
+          std::remove(dirty_files.begin(), dirty_files.end(), file),
+          dirty_files.end());
+      }
+      if (close(file->fd) != 0)
+        addError(file, _("Error closing file '%s' (%s)."), file->filename,
+          g_strerror(errno));
+      g_free(file->filename);
+      delete file;
+      ++i;
+      continue;
+    }
+
+    // Gather consecutive writes to the same file. Every message is written
+    // separately in the message sync mode.
+    bool sync_each = mode == SYNC_MESSAGE && file->durable;
+    int iovcnt = 0;
+    guint64 seq = 0;
+    while (i != batch.end() && i->file == file && i->data != nullptr &&
+      iovcnt < FILEWRITER_MAX_IOV) {
+      iov[iovcnt].iov_base = i->data;
+      iov[iovcnt].iov_len = i->length;
+      seq = i->seq;
+      ++iovcnt;
+      ++i;
+      if (sync_each)
+        break;
+    }
+
+    bool written = writeAll(file, iov, iovcnt);
+
+    // The data can be read back now, let flush() of this file return without
+    // waiting for the rest of the batch. A failed write is not retried so it
+    // counts as done too.
+    g_mutex_lock(&mutex_);
+    file->written_seq = seq;
+    g_cond_broadcast(&done_cond_);
+    g_mutex_unlock(&mutex_);
+
+    if (!written || !file->durable)
+      continue;
+
+    if (mode == SYNC_MESSAGE)
+      syncFile(file);
+    else if (mode == SYNC_INTERVAL && !file->dirty) {
+      file->dirty = true;
+      dirty_files.push_back(file);
+    }
+  }
+
+  for (File *file : dirty_files)
+    syncFile(file);
+
+  for (Request &request : batch)
+    g_free(request.data);
+}
+
+bool FileWriter::writeAll(File *file, iovec *iov, int iovcnt)
+{
+  while (iovcnt > 0) {
+    ssize_t written = writev(file->fd, iov, iovcnt);
+    if (written == -1) {
+      if (errno == EINTR)
+        continue;
+      addError(file, _("Error writing to file '%s' (%s)."), file->filename,
+        g_strerror(errno));
+      return false;
+    }
+
+    // Skip completely written buffers and adjust a partially written one.
+    std::size_t left = written;
+    while (iovcnt > 0 && left >= iov->iov_len) {
+      left -= iov->iov_len;
+      ++iov;
+      --iovcnt;
+    }
+    if (iovcnt > 0) {
+      iov->iov_base = static_cast<char *>(iov->iov_base) + left;
+      iov->iov_len -= left;
+    }
+  }
+  return true;
+}
+
+void FileWriter::syncFile(File *file)
+{
+  if (fsync(file->fd) != 0)
+    addError(file, _("Error syncing file '%s' (%s)."), file->filename,
+      g_strerror(errno));
+  file->dirty = false;
+}
+
+void FileWriter::addError(File *file, const char *fmt, ...)
+{
+  if (file->error_reported)
+    return;
+  file->error_reported = true;
+
+  va_list args;
+  va_start(args, fmt);
+  char *text = g_strdup_vprintf(fmt, args);
+  va_end(args);
+
+  // The Log class is not thread-safe so errors have to be reported from the
+  // main loop.
+  g_mutex_lock(&mutex_);
+  errors_.push_back(text);
+  if (errors_report_id_ == 0)
+    errors_report_id_ = g_idle_add(report_errors_, this);
+  g_mutex_unlock(&mutex_);
+
+  g_free(text);
+}
+
+void FileWriter::reportErrors()
+{
+  Errors errors;
+  g_mutex_lock(&mutex_);
+  errors.swap(errors_);
+  errors_report_id_ = 0;
+  g_mutex_unlock(&mutex_);
+
+  for (const std::string &error : errors)
+    LOG->error("%s", error.c_str());
+}
+
+// vim: set tabstop=2 shiftwidth=2 textwidth=80 expandtab:
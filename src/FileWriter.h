@@ -0,0 +1,142 @@
+// Copyright (C) 2016 Petr Pavlu <setup@dagobah.cz>
+//
+// This file is part of CenterIM.
+//
+// CenterIM is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// CenterIM is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with CenterIM.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef FILEWRITER_H
+#define FILEWRITER_H
+
+#include <cppconsui/CppConsUI.h>
+#include <deque>
+#include <glib.h>
+#include <string>
+#include <sys/uio.h>
+#include <vector>
+
+#define FILEWRITER (FileWriter::instance())
+
+// Asynchronous writer of append-only files (conversation logs, their indexes
+// and the debug logfile). Data is handed over to a writer thread through
+// a bounded queue so that disk latency does not block the user interface. The
+// writer thread batches all queued data and writes it out using writev().
+class FileWriter {
+public:
+  enum SyncMode {
+    // Write data as soon as possible but never explicitly sync it to the disk.
+    SYNC_IDLE,
+    // Collect data for a given interval, then write and sync it.
+    SYNC_INTERVAL,
+    // Write and sync data after every message.
+    SYNC_MESSAGE,
+  };
+
+  struct File;
+
+  static FileWriter *instance();
+
+  // Opens a file for appending. Data written to a durable file is synced to
+  // the disk according to the current sync mode. Returns nullptr and sets
+  // error on failure.
+  File *openFile(const char *filename, bool durable, GError **error);
+  // Closes a file after all pending data is written to it.
+  void closeFile(File *file);
+
+  // Queues data to be appended to a file. The method takes ownership of data
+  // which must be allocated by g_malloc(). Blocks if the queue is full.
+  void write(File *file, char *data, std::size_t length);
+  // Waits until all queued data is written.
+  void flush();
+  // Waits until all data queued for a given file (and all data queued before
+  // the file was opened) is written to it. The data does not have to be synced
+  // yet so the wait does not include syncs of the whole batch.
+  void flush(File *file);
+
+  void setSyncMode(SyncMode mode, int interval);
+
+private:
+  struct Request {
+    File *file;
+    // Data to write, nullptr requests to close the file.
+    char *data;
+    std::size_t length;
+    guint64 seq;
+  };
+
+  typedef std::deque<Request> Requests;
+  typedef std::vector<std::string> Errors;
+
+  GThread *thread_;
+  // Protects all following members.
+  GMutex mutex_;
+  // Signalled when new requests are queued.
+  GCond queue_cond_;
+  // Signalled when a batch of requests is written.
+  GCond done_cond_;
+
+  Requests queue_;
+  std::size_t queued_bytes_;
+  // Time when the first request in the queue was queued.
+  gint64 queue_start_time_;
+  // Sequence numbers of the last queued request and the last written request.
+  guint64 queued_seq_;
+  guint64 written_seq_;
+  bool flush_requested_;
+  bool stop_;
+
+  SyncMode sync_mode_;
+  // Sync interval in microseconds.
+  gint64 sync_interval_;
+
+  // Errors reported by the writer thread, they are logged from the main loop.
+  Errors errors_;
+  guint errors_report_id_;
+
+  static FileWriter *my_instance_;
+
+  FileWriter();
+  ~FileWriter();
+  CONSUI_DISABLE_COPY(FileWriter);
+
+  static void init();
+  static void finalize();
+  friend class CenterIM;
+
+  static gpointer writer_thread_(gpointer data)
+  {
+    reinterpret_cast<FileWriter *>(data)->writer_thread();
+    return nullptr;
+  }
+  void writer_thread();
+
+  bool isQueueFull() const;
+  void queueRequest(File *file, char *data, std::size_t length);
+
+  void writeBatch(Requests &batch, SyncMode mode);
+  bool writeAll(File *file, iovec *iov, int iovcnt);
+  void syncFile(File *file);
+  void addError(File *file, const char *fmt, ...)
+    CPPCONSUI_GNUC_ATTRIBUTE((format(printf, 3, 4)));
+
+  static gboolean report_errors_(gpointer data)
+  {
+    reinterpret_cast<FileWriter *>(data)->reportErrors();
+    return FALSE;
+  }
+  void reportErrors();
+};
+
+#endif // FILEWRITER_H
+
+// vim: set tabstop=2 shiftwidth=2 textwidth=80 expandtab:
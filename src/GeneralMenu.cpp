@@ -22,8 +22,10 @@
 #include "AccountWindow.h"
 #include "Accounts.h"
 #include "Log.h"
+#include "MemoryWindow.h"
 #include "OptionWindow.h"
 #include "PluginWindow.h"
+#include "SearchWindow.h"
 
 #include "gettext.h"
 
@@ -47,6 +49,10 @@ GeneralMenu::GeneralMenu() : MenuWindow(0, 0, AUTOSIZE, AUTOSIZE)
     sigc::mem_fun(this, &GeneralMenu::openOptionWindow));
   appendItem(
     _("Plugins..."), sigc::mem_fun(this, &GeneralMenu::openPluginWindow));
+  appendItem(_("Search conversations..."),
+    sigc::mem_fun(this, &GeneralMenu::openSearchWindow));
+  appendItem(_("Memory usage..."),
+    sigc::mem_fun(this, &GeneralMenu::openMemoryWindow));
   appendSeparator();
 #ifdef DEBUG
   auto submenu = new MenuWindow(0, 0, AUTOSIZE, AUTOSIZE);
@@ -125,6 +131,20 @@ void GeneralMenu::openPluginWindow(CppConsUI::Button & /*activator*/)
   close();
 }
 
+void GeneralMenu::openSearchWindow(CppConsUI::Button & /*activator*/)
+{
+  auto win = new SearchWindow;
+  win->show();
+  close();
+}
+
+void GeneralMenu::openMemoryWindow(CppConsUI::Button & /*activator*/)
+{
+  auto win = new MemoryWindow;
+  win->show();
+  close();
+}
+
 #ifdef DEBUG
 void GeneralMenu::openRequestInputTest(CppConsUI::Button & /*activator*/)
 {
@@ -42,6 +42,8 @@ private:
   void openPendingRequests(CppConsUI::Button &activator);
   void openOptionWindow(CppConsUI::Button &activator);
   void openPluginWindow(CppConsUI::Button &activator);
+  void openSearchWindow(CppConsUI::Button &activator);
+  void openMemoryWindow(CppConsUI::Button &activator);
 
 #ifdef DEBUG
   void openRequestInputTest(CppConsUI::Button &activator);
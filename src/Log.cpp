@@ -58,6 +58,14 @@
 // Maximum number of buffered messages in the normal phase.
 #define LOG_MAX_BUFFERED_MESSAGES 200
 
+// Maximum number of messages waiting to be output in the normal phase.
+#define LOG_MAX_PENDING_MESSAGES 256
+
+// Maximum number of messages per category in a rate limiting interval.
+#define LOG_RATE_LIMIT_MESSAGES 100
+// Rate limiting interval in microseconds.
+#define LOG_RATE_LIMIT_INTERVAL G_USEC_PER_SEC
+
 Log *Log::my_instance_ = nullptr;
 
 Log *Log::instance()
@@ -87,31 +95,11 @@ WRITE_METHOD(debug, LEVEL_DEBUG)
 
 #undef WRITE_METHOD
 
-static const char *now_formatted( void )
+void Log::logv(enum Level level, const char *fmt, va_list args)
 {
-    time_t now;
-    struct tm nowtm;
-    const char *formatted_time;
-
-    now = time( nullptr );
-    if( now != 0 && localtime_r(&now, &nowtm) != nullptr )
-      formatted_time = purple_date_format_long(&nowtm);
-    else
-      formatted_time = _("Unknown");
-
-    return formatted_time;
-}
-
-void Log::logv( enum Level level, const char *fmt, va_list args )
-{
-    char *text, *all;
-
-    text = g_strdup_vprintf(fmt, args);
-    all = g_strconcat( now_formatted(), " ", text, NULL );
-
-    write(TYPE_CIM, level, all);
-    g_free(text);
-    g_free(all);
+  char *text = g_strdup_vprintf(fmt, args);
+  write(TYPE_CIM, level, time(nullptr), text);
+  g_free(text);
 }
 
 void Log::clearAllBufferedMessages()
@@ -121,6 +109,24 @@ void Log::clearAllBufferedMessages()
   clearBufferedMessages(log_items_);
 }
 
+void Log::reportMemoryUsage(MemoryReport &report) const
+{
+  CppConsUI::MemoryUsage buffers;
+  for (const LogBufferItems *items : {&init_log_items_, &log_items_})
+    for (LogBufferItem *item : *items)
+      buffers.add(sizeof(LogBufferItem) + std::strlen(item->getText()) + 1);
+
+  // The pending array is allocated upfront, only the texts are counted as
+  // separate objects.
+  buffers.bytes += pending_array_.size() * sizeof(PendingMessage);
+  for (std::size_t i = 0; i < pending_count_; ++i)
+    buffers.add(std::strlen(pending_array_[i].text) + 1);
+  report.add(_("Log buffers"), buffers);
+
+  if (log_window_ != nullptr)
+    report.add(_("Log window"), log_window_->getMemoryUsage());
+}
+
 Log::LogWindow::LogWindow() : Window(0, 0, 80, 24, nullptr, TYPE_NON_FOCUSABLE)
 {
   setColorScheme(CenterIM::SCHEME_LOG);
@@ -155,8 +161,16 @@ void Log::LogWindow::append(const char *text)
   }
 }
 
-Log::LogBufferItem::LogBufferItem(Type type, Level level, const char *text)
-  : type_(type), level_(level)
+CppConsUI::MemoryUsage Log::LogWindow::getMemoryUsage() const
+{
+  CppConsUI::MemoryUsage usage = textview_->getLinesMemoryUsage();
+  usage += textview_->getScreenLinesMemoryUsage();
+  return usage;
+}
+
+Log::LogBufferItem::LogBufferItem(
+  Type type, Level level, time_t time, const char *text)
+  : type_(type), level_(level), time_(time)
 {
   text_ = g_strdup(text);
 }
@@ -167,10 +181,14 @@ Log::LogBufferItem::~LogBufferItem()
 }
 
 Log::Log()
-  : phase_(PHASE_INITIALIZATION), log_window_(nullptr), logfile_(nullptr),
+  : pending_array_(LOG_MAX_PENDING_MESSAGES), pending_count_(0),
+    pending_output_id_(0), formatted_time_(0), phase_(PHASE_INITIALIZATION),
+    log_window_(nullptr), logfile_(nullptr),
     log_level_cim_(LEVEL_DEBUG), log_level_glib_(LEVEL_DEBUG),
     log_level_purple_(LEVEL_DEBUG)
 {
+  rate_limits_ = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
 #define REGISTER_G_LOG_HANDLER(name, handler)                                  \
   g_log_set_handler((name), (GLogLevelFlags)G_LOG_LEVEL_MASK, (handler), this)
 
@@ -193,6 +211,8 @@ Log::~Log()
 
   outputAllBufferedMessages();
   clearAllBufferedMessages();
+
+  g_hash_table_destroy(rate_limits_);
 }
 
 void Log::init()
@@ -247,7 +267,8 @@ void Log::initNormalPhase()
     Level loglevel = getLogLevel(item->getType());
 
     if (loglevel >= item->getLevel())
-      write(item->getType(), item->getLevel(), item->getText(), false);
+      write(item->getType(), item->getLevel(), item->getTime(),
+        item->getText(), false);
 
     delete item;
   }
@@ -261,6 +282,13 @@ void Log::finalizeNormalPhase()
   // finishes.
   g_assert(phase_ == PHASE_NORMAL);
 
+  // Output all pending messages.
+  if (pending_output_id_ != 0) {
+    g_source_remove(pending_output_id_);
+    pending_output_id_ = 0;
+  }
+  outputPendingMessages();
+
   // Delete the log window.
   g_assert(log_window_ != nullptr);
   delete log_window_;
@@ -269,8 +297,10 @@ void Log::finalizeNormalPhase()
   purple_prefs_disconnect_by_handle(this);
 
   // Close the log file (if it is opened).
-  if (logfile_ != nullptr)
-    g_io_channel_unref(logfile_);
+  if (logfile_ != nullptr) {
+    FILEWRITER->closeFile(logfile_);
+    logfile_ = nullptr;
+  }
 
   // Done with the normal phase.
   phase_ = PHASE_FINALIZATION;
@@ -289,20 +319,27 @@ void Log::purple_print(
               "not defined."));
   }
 
-  char *text = g_strdup_printf("%s libpurple/%s: %s",
-      now_formatted(), category, arg_s);
-  write(TYPE_PURPLE, level, text);
+  // The rate limit was already checked by purple_is_enabled() which libpurple
+  // consults before it formats the message.
+  char *text = g_strdup_printf("libpurple/%s: %s", category, arg_s);
+  write(TYPE_PURPLE, level, time(nullptr), text);
   g_free(text);
 }
 
 gboolean Log::purple_is_enabled(
-  PurpleDebugLevel purplelevel, const char * /*category*/)
+  PurpleDebugLevel purplelevel, const char *category)
 {
   Level level = convertPurpleDebugLevel(purplelevel);
 
   if (log_level_purple_ < level)
     return FALSE;
 
+  // Check the rate limit before libpurple formats the message.
+  if (category == nullptr)
+    category = "misc";
+  if (!checkRateLimit(TYPE_PURPLE, level, category))
+    return FALSE;
+
   return TRUE;
 }
 
@@ -316,9 +353,13 @@ void Log::default_log_handler(
   if (log_level_glib_ < level)
     return; // Do not show this message.
 
-  char *text = g_strdup_printf("%s %s: %s",
-      now_formatted(), domain ? domain : "g_log", msg);
-  write(TYPE_GLIB, level, text);
+  if (domain == nullptr)
+    domain = "g_log";
+  if (!checkRateLimit(TYPE_GLIB, level, domain))
+    return;
+
+  char *text = g_strdup_printf("%s: %s", domain, msg);
+  write(TYPE_GLIB, level, time(nullptr), text);
   g_free(text);
 }
 
@@ -332,9 +373,13 @@ void Log::glib_log_handler(
   if (log_level_glib_ < level)
     return; // Do not show this message.
 
-  char *text = g_strdup_printf("%s %s: %s",
-      now_formatted(), domain ? domain : "g_log", msg);
-  write(TYPE_GLIB, level, text);
+  if (domain == nullptr)
+    domain = "g_log";
+  if (!checkRateLimit(TYPE_GLIB, level, domain))
+    return;
+
+  char *text = g_strdup_printf("%s: %s", domain, msg);
+  write(TYPE_GLIB, level, time(nullptr), text);
   g_free(text);
 }
 
@@ -355,7 +400,7 @@ void Log::updateCachedPreference(const char *name)
         purple_prefs_get_string(CONF_PREFIX "/log/filename"), nullptr);
       GError *err = nullptr;
 
-      logfile_ = g_io_channel_new_file(filename, "a", &err);
+      logfile_ = FILEWRITER->openFile(filename, false, &err);
       if (logfile_ == nullptr) {
         error(_("centerim/log: Error opening logfile '%s' (%s)."), filename,
           err->message);
@@ -364,8 +409,10 @@ void Log::updateCachedPreference(const char *name)
       g_free(filename);
     }
     else if (!logfile_enabled && logfile_ != nullptr) {
-      // Debug was disabled so close logfile if it is opened.
-      g_io_channel_unref(logfile_);
+      // Debug was disabled so close logfile if it is opened. Output pending
+      // messages first so they still end up in the file.
+      outputPendingMessages();
+      FILEWRITER->closeFile(logfile_);
       logfile_ = nullptr;
     }
   }
@@ -377,75 +424,143 @@ void Log::updateCachedPreference(const char *name)
     log_level_glib_ = stringToLevel(purple_prefs_get_string(name));
 }
 
-void Log::write(Type type, Level level, const char *text, bool buffer)
+void Log::write(
+  Type type, Level level, time_t time, const char *text, bool buffer)
 {
   if (buffer)
-    bufferMessage(type, level, text);
+    bufferMessage(type, level, time, text);
 
   // If the normal phase is not active then only buffer the message.
   if (phase_ != PHASE_NORMAL)
     return;
 
-  g_assert(log_window_ != nullptr);
-  log_window_->append(text);
-  writeToFile(text);
+  queueMessage(time, text);
 }
 
-void Log::writeErrorToWindow(const char *fmt, ...)
+void Log::queueMessage(time_t time, const char *text)
 {
-  // Can be called only if the normal phase is active.
-  g_assert(phase_ == PHASE_NORMAL);
+  // Make room for the message if the pending array is full.
+  if (pending_count_ == pending_array_.size())
+    outputPendingMessages();
+
+  PendingMessage &message = pending_array_[pending_count_++];
+  message.time = time;
+  message.text = g_strdup(text);
+
+  // Output the messages in the next main loop iteration, together with any
+  // other messages that arrive before it.
+  if (pending_output_id_ == 0)
+    pending_output_id_ =
+      g_timeout_add_full(G_PRIORITY_DEFAULT, 0, output_pending_messages_, this,
+        nullptr);
+}
+
+void Log::outputPendingMessages()
+{
+  if (pending_count_ == 0)
+    return;
+
   g_assert(log_window_ != nullptr);
 
-  va_list args;
+  // Only the most recent messages would remain in the Log window so do not
+  // bother adding the older ones.
+  std::size_t window_start = 0;
+  if (pending_count_ > LOG_WINDOW_MAX_LINES)
+    window_start = pending_count_ - LOG_WINDOW_MAX_LINES;
 
-  if (log_level_cim_ < LEVEL_ERROR)
-    return; // Do not show this message.
+  // Output to the logfile is done in one batch by FileWriter.
+  GString *file_text = nullptr;
+  if (logfile_ != nullptr)
+    file_text = g_string_sized_new(128 * pending_count_);
 
-  va_start(args, fmt);
-  char *text = g_strdup_vprintf(fmt, args);
-  va_end(args);
+  GString *line = g_string_sized_new(128);
+  for (std::size_t i = 0; i < pending_count_; ++i) {
+    PendingMessage &message = pending_array_[i];
 
-  log_window_->append(text);
-  g_free(text);
-}
+    g_string_assign(line, formatTime(message.time));
+    g_string_append_c(line, ' ');
+    g_string_append(line, message.text);
 
-void Log::writeToFile(const char *text)
-{
-  // Writing to a file is possible only in the normal phase.
-  g_assert(phase_ == PHASE_NORMAL);
+    if (i >= window_start)
+      log_window_->append(line->str);
 
-  if (text == nullptr || logfile_ == nullptr)
-    return;
+    if (file_text != nullptr) {
+      g_string_append_len(file_text, line->str, line->len);
+      // If necessary write missing EOL character.
+      if (line->len > 0 && line->str[line->len - 1] != '\n')
+        g_string_append_c(file_text, '\n');
+    }
+
+    g_free(message.text);
+    message.text = nullptr;
+  }
+  g_string_free(line, TRUE);
 
-  // Write text into logfile.
-  GError *err = nullptr;
+  pending_count_ = 0;
 
-  if (g_io_channel_write_chars(logfile_, text, -1, nullptr, &err) !=
-    G_IO_STATUS_NORMAL) {
-    writeErrorToWindow(
-      _("centerim/log: Error writing to logfile (%s)."), err->message);
-    g_clear_error(&err);
+  if (file_text != nullptr) {
+    gsize length = file_text->len;
+    FILEWRITER->write(logfile_, g_string_free(file_text, FALSE), length);
+  }
+}
+
+bool Log::checkRateLimit(Type type, Level level, const char *category)
+{
+  auto limit =
+    static_cast<RateLimit *>(g_hash_table_lookup(rate_limits_, category));
+  if (limit == nullptr) {
+    limit = g_new0(RateLimit, 1);
+    g_hash_table_insert(rate_limits_, g_strdup(category), limit);
   }
-  else {
-    // If necessary write missing EOL character.
-    std::size_t len = std::strlen(text);
-    if (len > 0 && text[len - 1] != '\n') {
-      // Ignore all errors.
-      g_io_channel_write_chars(logfile_, "\n", -1, nullptr, nullptr);
+
+  gint64 now = g_get_monotonic_time();
+  if (now - limit->window_start >= LOG_RATE_LIMIT_INTERVAL) {
+    // Start a new interval and report how many messages were dropped in the
+    // previous one.
+    unsigned suppressed = limit->suppressed;
+    limit->window_start = now;
+    limit->count = 0;
+    limit->suppressed = 0;
+
+    if (suppressed > 0) {
+      char *text = g_strdup_printf(
+        ngettext("centerim/log: %u message of category '%s' was suppressed.",
+          "centerim/log: %u messages of category '%s' were suppressed.",
+          suppressed),
+        suppressed, category);
+      write(type, level, time(nullptr), text);
+      g_free(text);
     }
   }
 
-  if (g_io_channel_flush(logfile_, &err) != G_IO_STATUS_NORMAL) {
-    writeErrorToWindow(
-      _("centerim/log: Error flushing logfile (%s)."), err->message);
-    g_clear_error(&err);
+  if (limit->count >= LOG_RATE_LIMIT_MESSAGES) {
+    ++limit->suppressed;
+    return false;
   }
+
+  ++limit->count;
+  return true;
+}
+
+const char *Log::formatTime(time_t time)
+{
+  // Messages come in bursts so remember the last formatted time.
+  if (time == formatted_time_ && !formatted_time_text_.empty())
+    return formatted_time_text_.c_str();
+
+  struct tm tm;
+  if (time != 0 && localtime_r(&time, &tm) != nullptr)
+    formatted_time_text_ = purple_date_format_long(&tm);
+  else
+    formatted_time_text_ = _("Unknown");
+  formatted_time_ = time;
+
+  return formatted_time_text_.c_str();
 }
 
-void Log::bufferMessage(Type type, Level level, const char *text)
+void Log::bufferMessage(Type type, Level level, time_t time, const char *text)
 {
-  auto item = new LogBufferItem(type, level, text);
+  auto item = new LogBufferItem(type, level, time, text);
   if (phase_ == PHASE_INITIALIZATION)
     init_log_items_.push_back(item);
   else
@@ -482,7 +597,7 @@ void Log::outputBufferedMessages(LogBufferItems &items)
       const char *text = item->getText();
       g_assert(text != nullptr);
 
-      std::fprintf(stderr, "%s", text);
+      std::fprintf(stderr, "%s %s", formatTime(item->getTime()), text);
 
       // If necessary write missing EOL character.
       std::size_t len = std::strlen(text);
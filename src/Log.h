@@ -20,12 +20,15 @@
 #define LOG_H
 
 #include "CenterIM.h"
+#include "FileWriter.h"
+#include "MemoryReport.h"
 
 #include <cppconsui/TextView.h>
 #include <cppconsui/Window.h>
 #include <deque>
 #include <libpurple/purple.h>
 #include <string>
+#include <vector>
 
 #define LOG (Log::instance())
 
@@ -57,10 +60,13 @@ public:
   void debug(const char *fmt, ...)
     CPPCONSUI_GNUC_ATTRIBUTE((format(printf, 2, 3)));
 
-  void logv( enum Level level, const char *fmt, va_list args );
+  void logv(enum Level level, const char *fmt, va_list args);
 
   void clearAllBufferedMessages();
 
+  // Adds memory held by the message buffers and the Log window to a report.
+  void reportMemoryUsage(MemoryReport &report) const;
+
 private:
   enum Type {
     TYPE_CIM,
@@ -84,6 +90,9 @@ private:
 
     void append(const char *text);
 
+    // Returns memory held by the lines and screen lines of the window.
+    CppConsUI::MemoryUsage getMemoryUsage() const;
+
   protected:
     CppConsUI::TextView *textview_;
 
@@ -93,16 +102,18 @@ private:
 
   class LogBufferItem {
   public:
-    LogBufferItem(Type type, Level level, const char *text);
+    LogBufferItem(Type type, Level level, time_t time, const char *text);
     ~LogBufferItem();
 
     Type getType() const { return type_; }
     Level getLevel() const { return level_; }
+    time_t getTime() const { return time_; }
     const char *getText() const { return text_; }
 
   protected:
     Type type_;
     Level level_;
+    time_t time_;
     char *text_;
 
   private:
@@ -113,6 +124,33 @@ private:
   LogBufferItems init_log_items_;
   LogBufferItems log_items_;
 
+  // Message waiting to be output to the Log window and the logfile.
+  struct PendingMessage {
+    time_t time;
+    char *text;
+  };
+
+  // Fixed-size array of pending messages in the normal phase. It is filled
+  // from the start and the whole batch is output at once from the main loop,
+  // or earlier when the array is full.
+  std::vector<PendingMessage> pending_array_;
+  std::size_t pending_count_;
+  guint pending_output_id_;
+
+  // Per-category rate limiting state.
+  struct RateLimit {
+    gint64 window_start;
+    unsigned count;
+    unsigned suppressed;
+  };
+
+  // Maps a category name to its RateLimit.
+  GHashTable *rate_limits_;
+
+  // Cache for formatTime().
+  time_t formatted_time_;
+  std::string formatted_time_text_;
+
   guint default_handler_;
   guint glib_handler_;
   guint gmodule_handler_;
@@ -124,7 +162,7 @@ private:
 
   Phase phase_;
   LogWindow *log_window_;
-  GIOChannel *logfile_;
+  FileWriter::File *logfile_;
 
   Level log_level_cim_;
   Level log_level_glib_;
@@ -173,10 +211,19 @@ private:
     const char *name, PurplePrefType type, gconstpointer val);
 
   void updateCachedPreference(const char *name);
-  void write(Type type, Level level, const char *text, bool buffer = true);
-  void writeErrorToWindow(const char *fmt, ...);
-  void writeToFile(const char *text);
-  void bufferMessage(Type type, Level level, const char *text);
+  void write(Type type, Level level, time_t time, const char *text,
+    bool buffer = true);
+  void queueMessage(time_t time, const char *text);
+  static gboolean output_pending_messages_(gpointer data)
+  {
+    reinterpret_cast<Log *>(data)->pending_output_id_ = 0;
+    reinterpret_cast<Log *>(data)->outputPendingMessages();
+    return FALSE;
+  }
+  void outputPendingMessages();
+  bool checkRateLimit(Type type, Level level, const char *category);
+  const char *formatTime(time_t time);
+  void bufferMessage(Type type, Level level, time_t time, const char *text);
   void clearBufferedMessages(LogBufferItems &items);
   void outputBufferedMessages(LogBufferItems &items);
   void outputAllBufferedMessages();
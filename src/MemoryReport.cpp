@@ -0,0 +1,78 @@
+// Copyright (C) 2016 Petr Pavlu <setup@dagobah.cz>
+//
+// This file is part of CenterIM.
+//
+// CenterIM is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// CenterIM is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with CenterIM.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "MemoryReport.h"
+
+#include "BuddyList.h"
+#include "Conversations.h"
+#include "Log.h"
+
+#include "gettext.h"
+#include <cppconsui/ColorScheme.h>
+#include <cppconsui/KeyConfig.h>
+
+void MemoryReport::collect()
+{
+  entries_.clear();
+
+  BUDDYLIST->reportMemoryUsage(*this);
+  CONVERSATIONS->reportMemoryUsage(*this);
+  LOG->reportMemoryUsage(*this);
+  add(_("Key bindings"), KEYCONFIG->getMemoryUsage());
+  add(_("Color schemes"), COLORSCHEME->getMemoryUsage());
+}
+
+void MemoryReport::add(const char *name, const CppConsUI::MemoryUsage &usage)
+{
+  Entry entry;
+  entry.name = name;
+  entry.usage = usage;
+  entries_.push_back(entry);
+}
+
+std::string MemoryReport::toString() const
+{
+  std::string res;
+  CppConsUI::MemoryUsage total;
+  for (const Entry &entry : entries_) {
+    char *line = formatEntry(entry.name.c_str(), entry.usage);
+    res.append(line);
+    res.append("\n");
+    g_free(line);
+    total += entry.usage;
+  }
+
+  char *line = formatEntry(_("Total"), total);
+  res.append(line);
+  g_free(line);
+  return res;
+}
+
+void MemoryReport::log() const
+{
+  LOG->debug("Memory usage report:\n%s", toString().c_str());
+}
+
+char *MemoryReport::formatEntry(
+  const char *name, const CppConsUI::MemoryUsage &usage)
+{
+  return g_strdup_printf(_("%s: %lu objects, %lu bytes"), name,
+    static_cast<unsigned long>(usage.objects),
+    static_cast<unsigned long>(usage.bytes));
+}
+
+// vim: set tabstop=2 shiftwidth=2 textwidth=80 expandtab:
@@ -0,0 +1,61 @@
+// Copyright (C) 2016 Petr Pavlu <setup@dagobah.cz>
+//
+// This file is part of CenterIM.
+//
+// CenterIM is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// CenterIM is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with CenterIM.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MEMORYREPORT_H
+#define MEMORYREPORT_H
+
+#include <cppconsui/CppConsUI.h>
+#include <string>
+#include <vector>
+
+// Report of memory held by the main subsystems. The numbers are computed on
+// demand by walking the live data structures so keeping them costs nothing
+// when no report is requested. Only the payload is counted, allocator
+// overhead is not included.
+class MemoryReport {
+public:
+  MemoryReport() {}
+
+  // Collects the memory usage of all subsystems.
+  void collect();
+
+  void add(const char *name, const CppConsUI::MemoryUsage &usage);
+
+  // Returns the report as text, one subsystem per line followed by the total.
+  std::string toString() const;
+
+  // Writes the report to the debug log.
+  void log() const;
+
+private:
+  struct Entry {
+    std::string name;
+    CppConsUI::MemoryUsage usage;
+  };
+  typedef std::vector<Entry> Entries;
+
+  Entries entries_;
+
+  CONSUI_DISABLE_COPY(MemoryReport);
+
+  static char *formatEntry(
+    const char *name, const CppConsUI::MemoryUsage &usage);
+};
+
+#endif // MEMORYREPORT_H
+
+// vim: set tabstop=2 shiftwidth=2 textwidth=80 expandtab:
@@ -0,0 +1,80 @@
+// Copyright (C) 2016 Petr Pavlu <setup@dagobah.cz>
+//
+// This file is part of CenterIM.
+//
+// CenterIM is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// CenterIM is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with CenterIM.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "MemoryWindow.h"
+
+#include "CenterIM.h"
+#include "MemoryReport.h"
+
+#include "gettext.h"
+#include <cppconsui/Label.h>
+
+MemoryWindow::MemoryWindow() : SplitDialog(0, 0, 80, 24, _("Memory usage"))
+{
+  setColorScheme(CenterIM::SCHEME_GENERALWINDOW);
+
+  treeview_ = new CppConsUI::TreeView(AUTOSIZE, AUTOSIZE);
+  setContainer(*treeview_);
+
+  buttons_->appendItem(
+    _("Refresh"), sigc::mem_fun(this, &MemoryWindow::onRefresh));
+  buttons_->appendSeparator();
+  buttons_->appendItem(
+    _("Write to log"), sigc::mem_fun(this, &MemoryWindow::onWriteToLog));
+  buttons_->appendSeparator();
+  buttons_->appendItem(
+    _("Done"), sigc::hide(sigc::mem_fun(this, &MemoryWindow::close)));
+
+  onScreenResized();
+  refresh();
+}
+
+void MemoryWindow::onScreenResized()
+{
+  moveResizeRect(CENTERIM->getScreenArea(CenterIM::CHAT_AREA));
+}
+
+void MemoryWindow::refresh()
+{
+  treeview_->clear();
+
+  MemoryReport report;
+  report.collect();
+
+  // Add one label per line of the report.
+  std::string text = report.toString();
+  char **lines = g_strsplit(text.c_str(), "\n", 0);
+  for (char **line = lines; *line != nullptr; ++line)
+    if (**line != '\0')
+      treeview_->appendNode(
+        treeview_->getRootNode(), *(new CppConsUI::Label(*line)));
+  g_strfreev(lines);
+}
+
+void MemoryWindow::onRefresh(CppConsUI::Button & /*activator*/)
+{
+  refresh();
+}
+
+void MemoryWindow::onWriteToLog(CppConsUI::Button & /*activator*/)
+{
+  MemoryReport report;
+  report.collect();
+  report.log();
+}
+
+// vim: set tabstop=2 shiftwidth=2 textwidth=80 expandtab:
@@ -0,0 +1,46 @@
+// Copyright (C) 2016 Petr Pavlu <setup@dagobah.cz>
+//
+// This file is part of CenterIM.
+//
+// CenterIM is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// CenterIM is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with CenterIM.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MEMORYWINDOW_H
+#define MEMORYWINDOW_H
+
+#include <cppconsui/Button.h>
+#include <cppconsui/SplitDialog.h>
+#include <cppconsui/TreeView.h>
+
+// Window showing memory held by the main subsystems.
+class MemoryWindow : public CppConsUI::SplitDialog {
+public:
+  MemoryWindow();
+  virtual ~MemoryWindow() override {}
+
+  // FreeWindow
+  virtual void onScreenResized() override;
+
+private:
+  CppConsUI::TreeView *treeview_;
+
+  CONSUI_DISABLE_COPY(MemoryWindow);
+
+  void refresh();
+  void onRefresh(CppConsUI::Button &activator);
+  void onWriteToLog(CppConsUI::Button &activator);
+};
+
+#endif // MEMORYWINDOW_H
+
+// vim: set tabstop=2 shiftwidth=2 textwidth=80 expandtab:
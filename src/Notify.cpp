@@ -17,6 +17,7 @@
 
 #include "Notify.h"
 
+#include "BuddyList.h"
 #include "Log.h"
 
 #include "gettext.h"
@@ -88,8 +89,7 @@ void Notify::UserInfoDialog::update(
     treeview_->appendNode(parent, *button);
 
     // Last activity.
-    saved_time = static_cast<time_t>(
-      purple_blist_node_get_int(PURPLE_BLIST_NODE(buddy), "last_activity"));
+    saved_time = BUDDYLIST->getLastActivity(buddy);
     if (saved_time != 0 && localtime_r(&saved_time, &local_time) != nullptr)
       formatted_time = purple_date_format_long(&local_time);
     else
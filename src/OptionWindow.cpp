@@ -101,6 +101,22 @@ OptionWindow::OptionWindow() : SplitDialog(0, 0, 80, 24, _("Config options"))
   treeview->appendNode(
     parent, *(new BooleanOption(_("Send typing notification"),
               "/purple/conversations/im/send_typing")));
+  c = new ChoiceOption(_("Log synchronization"), CONF_PREFIX "/chat/log_sync");
+  c->addOption(_("When idle"), "idle");
+  c->addOption(_("Periodically"), "interval");
+  c->addOption(_("After every message"), "message");
+  treeview->appendNode(parent, *c);
+  treeview->appendNode(
+    parent, *(new IntegerOption(_("Log synchronization interval (ms)"),
+              CONF_PREFIX "/chat/log_sync_interval")));
+  c = new ChoiceOption(_("Format of new logs"), CONF_PREFIX "/chat/log_format");
+  c->addOption(_("Text"), "text");
+  c->addOption(_("Binary"), "binary");
+  treeview->appendNode(parent, *c);
+  treeview->appendNode(
+    parent, *(new IntegerOption(_("Unload idle conversations after"),
+              CONF_PREFIX "/chat/hibernate_timeout",
+              sigc::mem_fun(this, &OptionWindow::getMinUnit))));
 
   parent = treeview->appendNode(treeview->getRootNode(),
     *(new CppConsUI::TreeView::ToggleCollapseButton(_("System logging"))));
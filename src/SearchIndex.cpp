@@ -0,0 +1,1177 @@
+// Copyright (C) 2016 Petr Pavlu <setup@dagobah.cz>
+//
+// This file is part of CenterIM.
+//
+// CenterIM is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// CenterIM is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with CenterIM.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "SearchIndex.h"
+
+#include "Log.h"
+
+#include "gettext.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <glib/gstdio.h>
+#include <libpurple/purple.h>
+#include <numeric>
+#include <sys/stat.h>
+
+// Version 2 sorts postings of each term in a segment by the message.
+#define MANIFEST_MAGIC "CIMSIDX2"
+#define SEGMENT_MAGIC "CIMSSEG1"
+#define SEGMENT_MAGIC_LENGTH 8
+#define SEGMENT_HEADER_SIZE 16
+#define SEGMENT_TERM_SIZE 16
+#define SEGMENT_POSTING_SIZE 24
+#define SEGMENT_PREFIX "segment-"
+
+// Longer words are not indexed.
+#define SEARCHINDEX_MAX_TERM_LENGTH 64
+// Number of postings collected in memory before they are written to a segment.
+#define SEARCHINDEX_MAX_MEMORY_POSTINGS 100000
+// Maximum number of segments before the smallest ones are merged.
+#define SEARCHINDEX_MAX_SEGMENTS 8
+#define SEARCHINDEX_MERGE_SEGMENTS 4
+// Number of messages indexed in one main loop iteration during the catch-up.
+#define SEARCHINDEX_CATCH_UP_MESSAGES 1000
+// Sanity limit for logfile identifiers read from the manifest.
+#define SEARCHINDEX_MAX_FILE_ID (1 << 24)
+
+namespace {
+
+int compareTerms(
+  const char *a, std::size_t a_length, const char *b, std::size_t b_length)
+{
+  int res = std::memcmp(a, b, MIN(a_length, b_length));
+  if (res != 0)
+    return res;
+  if (a_length != b_length)
+    return a_length < b_length ? -1 : 1;
+  return 0;
+}
+
+} // anonymous namespace
+
+SearchIndex *SearchIndex::my_instance_ = nullptr;
+
+SearchIndex *SearchIndex::instance()
+{
+  return my_instance_;
+}
+
+void SearchIndex::addMessage(const char *filename, guint64 offset,
+  std::size_t length, time_t time, const char *text)
+{
+  g_assert(filename != nullptr);
+  g_assert(text != nullptr);
+
+  guint32 file_id;
+  if (!findLogFile(filename, &file_id))
+    return;
+
+  // Index only a message that directly follows the indexed part of the
+  // logfile. Other messages are indexed by the catch-up.
+  LogFile &file = files_[file_id];
+  if (file.indexed_size != offset)
+    return;
+  file.indexed_size += length;
+  manifest_dirty_ = true;
+  indexMessage(file_id, offset, time, text);
+}
+
+void SearchIndex::addLogHeader(const char *filename, std::size_t length)
+{
+  g_assert(filename != nullptr);
+
+  guint32 file_id;
+  if (!findLogFile(filename, &file_id))
+    return;
+
+  // The header has to be covered by the index so that the first message is
+  // indexed directly by addMessage().
+  LogFile &file = files_[file_id];
+  if (file.indexed_size != 0)
+    return;
+  file.indexed_size = length;
+  manifest_dirty_ = true;
+}
+
+SearchIndex::Hits SearchIndex::search(
+  const char *query, std::size_t max_hits) const
+{
+  g_assert(query != nullptr);
+
+  std::map<std::string, guint32> terms;
+  tokenize(query, terms);
+  if (terms.empty())
+    return Hits();
+
+  // Locate postings of all terms. Only their numbers are needed to find the
+  // rarest term.
+  std::vector<QueryTerm> query_terms(terms.size());
+  std::size_t t = 0;
+  for (const std::pair<const std::string, guint32> &term : terms)
+    findQueryTerm(term.first, query_terms[t++]);
+  std::sort(query_terms.begin(), query_terms.end(),
+    [](const QueryTerm &a, const QueryTerm &b) { return a.count < b.count; });
+
+  // Decode only postings of the rarest term, the other terms are looked up for
+  // its messages. A message can be present in more than one segment after an
+  // unclean exit so the candidates are deduplicated.
+  const QueryTerm &rarest = query_terms[0];
+  Postings candidates(rarest.memory);
+  candidates.reserve(rarest.count);
+  for (const PostingRange &range : rarest.ranges)
+    for (guint32 i = 0; i < range.count; ++i) {
+      Posting posting;
+      decodePosting(
+        range.segment->postings + (range.first + i) * SEGMENT_POSTING_SIZE,
+        posting);
+      candidates.push_back(posting);
+    }
+  std::sort(candidates.begin(), candidates.end(), postingLess);
+  candidates.erase(
+    std::unique(candidates.begin(), candidates.end(), postingEqual),
+    candidates.end());
+
+  // Score the terms using TF-IDF.
+  std::vector<double> idfs;
+  for (const QueryTerm &query_term : query_terms)
+    idfs.push_back(std::log(
+      1.0 + static_cast<double>(message_count_) / (query_term.count + 1)));
+
+  Hits res;
+  for (const Posting &candidate : candidates) {
+    if (!isLive(candidate.file_id))
+      continue;
+
+    double score =
+      (1.0 + std::log(static_cast<double>(candidate.frequency))) * idfs[0];
+    bool matched = true;
+    for (std::size_t i = 1; matched && i < query_terms.size(); ++i) {
+      Posting posting;
+      matched = findPosting(query_terms[i], candidate, &posting);
+      if (matched)
+        score +=
+          (1.0 + std::log(static_cast<double>(posting.frequency))) * idfs[i];
+    }
+    if (!matched)
+      continue;
+
+    Hit hit = {candidate.file_id, candidate.offset,
+      static_cast<time_t>(candidate.time), score};
+    res.push_back(hit);
+  }
+
+  // Order the hits by their score, newer messages first if the score is equal.
+  std::sort(res.begin(), res.end(), [](const Hit &a, const Hit &b) {
+    if (a.score != b.score)
+      return a.score > b.score;
+    return a.time > b.time;
+  });
+  if (res.size() > max_hits)
+    res.resize(max_hits);
+  return res;
+}
+
+void SearchIndex::discard()
+{
+  // Unused segments are removed when the index is opened.
+  char *filename =
+    g_build_filename(purple_user_dir(), "clogs-index", "manifest", nullptr);
+  g_unlink(filename);
+  g_free(filename);
+}
+
+const char *SearchIndex::getLogPath(guint32 file_id) const
+{
+  if (!isLive(file_id))
+    return nullptr;
+  return files_[file_id].path.c_str();
+}
+
+char *SearchIndex::getLogFilename(guint32 file_id) const
+{
+  if (!isLive(file_id))
+    return nullptr;
+  return g_build_filename(clogs_dir_, files_[file_id].path.c_str(), nullptr);
+}
+
+SearchIndex::SearchIndex()
+  : message_count_(0), manifest_dirty_(false), next_segment_(0),
+    memory_posting_count_(0), scan_thread_(nullptr), scan_job_(nullptr),
+    catch_up_id_(0), merge_thread_(nullptr), merge_job_(nullptr),
+    flush_pending_(false)
+{
+  clogs_dir_ = g_build_filename(purple_user_dir(), "clogs", nullptr);
+  index_dir_ = g_build_filename(purple_user_dir(), "clogs-index", nullptr);
+
+  if (g_mkdir_with_parents(index_dir_, S_IRUSR | S_IWUSR | S_IXUSR) == -1)
+    LOG->error(_("Error creating directory '%s'."), index_dir_);
+
+  if (!loadManifest()) {
+    // Build the index from scratch.
+    reset();
+  }
+  removeUnusedSegments();
+
+  // Find logfiles with new data and the ones that were removed, the whole
+  // clogs directory is walked so it is done in the background.
+  scan_job_ = new ScanJob;
+  scan_job_->index = this;
+  scan_job_->clogs_dir = g_strdup(clogs_dir_);
+  scan_thread_ = g_thread_new("search-scan", scan_, scan_job_);
+}
+
+SearchIndex::~SearchIndex()
+{
+  // Wait for the background jobs. The scan result is discarded, a written
+  // segment is kept.
+  if (scan_job_ != nullptr) {
+    g_thread_join(scan_thread_);
+    g_source_remove_by_user_data(scan_job_);
+    g_free(scan_job_->clogs_dir);
+    delete scan_job_;
+  }
+  if (merge_job_ != nullptr) {
+    g_thread_join(merge_thread_);
+    g_source_remove_by_user_data(merge_job_);
+    finishJob();
+  }
+
+  if (catch_up_id_ != 0)
+    g_source_remove(catch_up_id_);
+  for (ConversationHistoryLoader::Message &message : catch_up_messages_)
+    g_free(message.text);
+
+  // Write the remaining postings directly, the main loop does not run anymore.
+  MergeJob *job = prepareFlush();
+  if (job != nullptr) {
+    writeJob(job);
+    if (job->error != nullptr)
+      reportJobError(job);
+    freeMergeJob(job);
+  }
+
+  for (Segment &segment : segments_)
+    closeSegment(segment, false);
+
+  g_free(index_dir_);
+  g_free(clogs_dir_);
+}
+
+void SearchIndex::init()
+{
+  g_assert(my_instance_ == nullptr);
+
+  my_instance_ = new SearchIndex;
+}
+
+void SearchIndex::finalize()
+{
+  g_assert(my_instance_ != nullptr);
+
+  delete my_instance_;
+  my_instance_ = nullptr;
+}
+
+bool SearchIndex::loadManifest()
+{
+  char *filename = g_build_filename(index_dir_, "manifest", nullptr);
+  char *contents;
+  if (!g_file_get_contents(filename, &contents, nullptr, nullptr)) {
+    // The index does not exist yet.
+    g_free(filename);
+    return false;
+  }
+
+  char **lines = g_strsplit(contents, "\n", 0);
+  g_free(contents);
+
+  bool res = lines[0] != nullptr && std::strcmp(lines[0], MANIFEST_MAGIC) == 0;
+  for (int i = 1; res && lines[i] != nullptr; ++i) {
+    char *line = lines[i];
+    if (*line == '\0')
+      continue;
+
+    char *value = std::strchr(line, ' ');
+    if (value == nullptr) {
+      res = false;
+      break;
+    }
+    *value++ = '\0';
+
+    if (std::strcmp(line, "next_segment") == 0)
+      next_segment_ = g_ascii_strtoull(value, nullptr, 10);
+    else if (std::strcmp(line, "messages") == 0)
+      message_count_ = g_ascii_strtoull(value, nullptr, 10);
+    else if (std::strcmp(line, "segment") == 0)
+      res = openSegment(value);
+    else if (std::strcmp(line, "file") == 0) {
+      // File entry: <id> <indexed size> <path>.
+      char *end;
+      guint64 id = g_ascii_strtoull(value, &end, 10);
+      if (*end != ' ' || id >= SEARCHINDEX_MAX_FILE_ID) {
+        res = false;
+        break;
+      }
+      guint64 size = g_ascii_strtoull(end + 1, &end, 10);
+      if (*end != ' ' || end[1] == '\0') {
+        res = false;
+        break;
+      }
+
+      if (id >= files_.size()) {
+        LogFile empty = {std::string(), 0, 0};
+        files_.resize(id + 1, empty);
+      }
+      files_[id].path = end + 1;
+      files_[id].indexed_size = size;
+      files_[id].flushed_size = size;
+      file_ids_[files_[id].path] = id;
+    }
+    else
+      res = false;
+  }
+  g_strfreev(lines);
+
+  if (!res)
+    LOG->debug("Search index manifest '%s' is corrupted, rebuilding the index.",
+      filename);
+  g_free(filename);
+  return res;
+}
+
+char *SearchIndex::buildManifest(const char *new_segment) const
+{
+  GString *contents = g_string_new(MANIFEST_MAGIC "\n");
+  g_string_append_printf(contents, "next_segment %u\n", next_segment_);
+  g_string_append_printf(
+    contents, "messages %" G_GUINT64_FORMAT "\n", message_count_);
+  for (const Segment &segment : segments_)
+    g_string_append_printf(contents, "segment %s\n", segment.name);
+  if (new_segment != nullptr)
+    g_string_append_printf(contents, "segment %s\n", new_segment);
+  for (guint32 i = 0; i < files_.size(); ++i)
+    if (isLive(i))
+      g_string_append_printf(contents, "file %u %" G_GUINT64_FORMAT " %s\n", i,
+        files_[i].flushed_size, files_[i].path.c_str());
+  return g_string_free(contents, FALSE);
+}
+
+bool SearchIndex::saveManifest() const
+{
+  char *contents = buildManifest(nullptr);
+  char *filename = g_build_filename(index_dir_, "manifest", nullptr);
+  GError *err = nullptr;
+  bool res = g_file_set_contents(filename, contents, -1, &err);
+  if (!res) {
+    LOG->error(_("Error writing search index manifest '%s' (%s)."), filename,
+      err->message);
+    g_clear_error(&err);
+  }
+
+  g_free(filename);
+  g_free(contents);
+  return res;
+}
+
+bool SearchIndex::openSegment(const char *name)
+{
+  char *filename = getSegmentFilename(name);
+  GError *err = nullptr;
+  GMappedFile *mapped = g_mapped_file_new(filename, FALSE, &err);
+  if (mapped == nullptr) {
+    LOG->error(_("Error opening search index segment '%s' (%s)."), filename,
+      err->message);
+    g_clear_error(&err);
+    g_free(filename);
+    return false;
+  }
+
+  Segment segment;
+  segment.name = g_strdup(name);
+  segment.mapped = mapped;
+  const char *data = g_mapped_file_get_contents(mapped);
+  segment.size = g_mapped_file_get_length(mapped);
+
+  // Check the header and that all terms point inside the segment.
+  bool valid = segment.size >= SEGMENT_HEADER_SIZE &&
+    std::memcmp(data, SEGMENT_MAGIC, SEGMENT_MAGIC_LENGTH) == 0;
+  if (valid) {
+    guint32 counts[2];
+    std::memcpy(counts, data + SEGMENT_MAGIC_LENGTH, sizeof(counts));
+    segment.term_count = GUINT32_FROM_LE(counts[0]);
+    segment.posting_count = GUINT32_FROM_LE(counts[1]);
+
+    guint64 strings_start = SEGMENT_HEADER_SIZE +
+      static_cast<guint64>(segment.term_count) * SEGMENT_TERM_SIZE +
+      static_cast<guint64>(segment.posting_count) * SEGMENT_POSTING_SIZE;
+    valid = strings_start <= segment.size;
+    if (valid) {
+      segment.terms = data + SEGMENT_HEADER_SIZE;
+      segment.postings =
+        segment.terms + segment.term_count * SEGMENT_TERM_SIZE;
+      segment.strings = data + strings_start;
+      segment.strings_size = segment.size - strings_start;
+    }
+
+    for (guint32 i = 0; valid && i < segment.term_count; ++i) {
+      guint32 entry[4];
+      decodeTermEntry(segment.terms + i * SEGMENT_TERM_SIZE, entry);
+      valid =
+        static_cast<guint64>(entry[0]) + entry[1] <= segment.strings_size &&
+        static_cast<guint64>(entry[2]) + entry[3] <= segment.posting_count;
+    }
+  }
+
+  if (!valid) {
+    LOG->error(_("Search index segment '%s' is corrupted."), filename);
+    g_free(filename);
+    closeSegment(segment, false);
+    return false;
+  }
+
+  g_free(filename);
+  segments_.push_back(segment);
+  return true;
+}
+
+void SearchIndex::closeSegment(Segment &segment, bool remove)
+{
+  g_mapped_file_unref(segment.mapped);
+  if (remove) {
+    char *filename = getSegmentFilename(segment.name);
+    g_unlink(filename);
+    g_free(filename);
+  }
+  g_free(segment.name);
+}
+
+void SearchIndex::removeUnusedSegments()
+{
+  // Remove segments left behind by an unclean exit or an interrupted merge.
+  GDir *dir = g_dir_open(index_dir_, 0, nullptr);
+  if (dir == nullptr)
+    return;
+
+  const char *name;
+  while ((name = g_dir_read_name(dir)) != nullptr) {
+    if (!g_str_has_prefix(name, SEGMENT_PREFIX))
+      continue;
+
+    bool used = false;
+    for (const Segment &segment : segments_)
+      if (std::strcmp(segment.name, name) == 0) {
+        used = true;
+        break;
+      }
+    if (used)
+      continue;
+
+    char *filename = getSegmentFilename(name);
+    g_unlink(filename);
+    g_free(filename);
+  }
+  g_dir_close(dir);
+}
+
+void SearchIndex::reset()
+{
+  for (Segment &segment : segments_)
+    closeSegment(segment, false);
+  segments_.clear();
+
+  files_.clear();
+  file_ids_.clear();
+  message_count_ = 0;
+  manifest_dirty_ = true;
+}
+
+void SearchIndex::scan(ScanJob *job)
+{
+  // Runs in a worker thread. Note that purple and Log functions cannot be
+  // called here.
+  scanLogs(job->clogs_dir, "", 0, job->logs);
+  g_idle_add(scan_finished_, job);
+}
+
+void SearchIndex::scanLogs(
+  const char *clogs_dir, const char *path, int depth, ScannedLogs &logs)
+{
+  // Logfiles are stored in the clogs/<protocol>/<account>/<name> hierarchy.
+  char *dirname = g_build_filename(clogs_dir, path, nullptr);
+  GDir *dir = g_dir_open(dirname, 0, nullptr);
+  g_free(dirname);
+  if (dir == nullptr)
+    return;
+
+  const char *name;
+  while ((name = g_dir_read_name(dir)) != nullptr) {
+    char *child =
+      *path != '\0' ? g_build_filename(path, name, nullptr) : g_strdup(name);
+
+    if (depth < 2)
+      scanLogs(clogs_dir, child, depth + 1, logs);
+    else if (!g_str_has_suffix(name, ".idx")) {
+      char *filename = g_build_filename(clogs_dir, child, nullptr);
+      GStatBuf st;
+      if (g_stat(filename, &st) == 0 && S_ISREG(st.st_mode))
+        logs.push_back(std::make_pair(child, st.st_size));
+      g_free(filename);
+    }
+
+    g_free(child);
+  }
+  g_dir_close(dir);
+}
+
+void SearchIndex::scanFinished()
+{
+  g_thread_join(scan_thread_);
+  scan_thread_ = nullptr;
+  ScanJob *job = scan_job_;
+  scan_job_ = nullptr;
+
+  // Find logfiles with new data and forget the ones that were removed. Note
+  // that the known logfiles did not change during the scan because
+  // addMessage() does not index anything while it is running.
+  std::vector<bool> seen(files_.size(), false);
+  for (const ScannedLogs::value_type &log : job->logs) {
+    const std::string &path = log.first;
+    guint64 size = log.second;
+
+    guint32 file_id;
+    LogFileIDs::iterator i = file_ids_.find(path);
+    if (i == file_ids_.end())
+      file_id = addLogFile(path);
+    else {
+      file_id = i->second;
+      if (size < files_[file_id].indexed_size) {
+        // The logfile was rewritten, index it again under a new identifier.
+        files_[file_id].path.clear();
+        file_ids_.erase(i);
+        file_id = addLogFile(path);
+      }
+    }
+
+    if (file_id < seen.size())
+      seen[file_id] = true;
+
+    if (size > files_[file_id].indexed_size)
+      pending_files_.push_back(file_id);
+  }
+  g_free(job->clogs_dir);
+  delete job;
+
+  for (guint32 i = 0; i < seen.size(); ++i)
+    if (!seen[i] && isLive(i)) {
+      file_ids_.erase(files_[i].path);
+      files_[i].path.clear();
+      manifest_dirty_ = true;
+    }
+
+  // Logfiles written during the scan could have grown after they were seen.
+  for (const std::string &path : scan_dirty_files_) {
+    LogFileIDs::iterator i = file_ids_.find(path);
+    guint32 file_id = i != file_ids_.end() ? i->second : addLogFile(path);
+    if (std::find(pending_files_.begin(), pending_files_.end(), file_id) ==
+      pending_files_.end())
+      pending_files_.push_back(file_id);
+  }
+  scan_dirty_files_.clear();
+
+  // Index the new data in the background.
+  if (!pending_files_.empty())
+    catch_up_id_ = g_idle_add(catch_up_, this);
+}
+
+bool SearchIndex::findLogFile(const char *filename, guint32 *file_id)
+{
+  // Get the path relative to the clogs directory.
+  std::size_t dir_length = std::strlen(clogs_dir_);
+  if (std::strncmp(filename, clogs_dir_, dir_length) != 0 ||
+    filename[dir_length] != G_DIR_SEPARATOR)
+    return false;
+  std::string path(filename + dir_length + 1);
+
+  // The set of logfiles is not known until the startup scan finishes. The
+  // new data is indexed by the catch-up afterwards.
+  if (scan_job_ != nullptr) {
+    scan_dirty_files_.insert(path);
+    return false;
+  }
+
+  LogFileIDs::iterator i = file_ids_.find(path);
+  *file_id = i != file_ids_.end() ? i->second : addLogFile(path);
+  return true;
+}
+
+guint32 SearchIndex::addLogFile(const std::string &path)
+{
+  guint32 file_id = files_.size();
+  LogFile file = {path, 0, 0};
+  files_.push_back(file);
+  file_ids_[path] = file_id;
+  manifest_dirty_ = true;
+  return file_id;
+}
+
+gboolean SearchIndex::catchUp()
+{
+  if (pending_files_.empty()) {
+    // Everything is indexed.
+    catch_up_id_ = 0;
+    flush();
+    mergeSegments();
+    return FALSE;
+  }
+
+  guint32 file_id = pending_files_.back();
+  char *filename = getLogFilename(file_id);
+  GError *err = nullptr;
+  GMappedFile *mapped = g_mapped_file_new(filename, FALSE, &err);
+  if (mapped == nullptr) {
+    // The logfile could have been removed in the meantime.
+    LOG->debug("Error opening conversation logfile '%s' for indexing (%s).",
+      filename, err->message);
+    g_clear_error(&err);
+    g_free(filename);
+    pending_files_.pop_back();
+    return TRUE;
+  }
+  g_free(filename);
+
+  // Parse the next chunk of messages.
+  LogFile &file = files_[file_id];
+  gsize end = ConversationHistoryLoader::parseLog(
+    g_mapped_file_get_contents(mapped), g_mapped_file_get_length(mapped),
+    file.indexed_size, sigc::mem_fun(this, &SearchIndex::collectMessage));
+  g_mapped_file_unref(mapped);
+
+  bool finished = catch_up_messages_.size() < SEARCHINDEX_CATCH_UP_MESSAGES;
+  guint64 start = file.indexed_size;
+  file.indexed_size = MAX(file.indexed_size, end);
+  manifest_dirty_ = true;
+
+  // Index only complete messages.
+  for (ConversationHistoryLoader::Message &message : catch_up_messages_) {
+    if (message.text != nullptr && message.offset >= start &&
+      message.offset < end)
+      indexMessage(file_id, message.offset, message.show_time, message.text);
+    g_free(message.text);
+  }
+  catch_up_messages_.clear();
+
+  if (finished)
+    pending_files_.pop_back();
+  return TRUE;
+}
+
+bool SearchIndex::collectMessage(
+  const ConversationHistoryLoader::Message &message)
+{
+  if (catch_up_messages_.size() >= SEARCHINDEX_CATCH_UP_MESSAGES) {
+    g_free(message.text);
+    return false;
+  }
+
+  catch_up_messages_.push_back(message);
+  return true;
+}
+
+void SearchIndex::indexMessage(
+  guint32 file_id, guint64 offset, time_t time, const char *text)
+{
+  std::map<std::string, guint32> terms;
+  tokenize(text, terms);
+  for (const std::pair<const std::string, guint32> &term : terms) {
+    Posting posting = {file_id, term.second, offset, time};
+    memory_postings_[term.first].push_back(posting);
+  }
+  memory_posting_count_ += terms.size();
+  ++message_count_;
+
+  if (memory_posting_count_ >= SEARCHINDEX_MAX_MEMORY_POSTINGS) {
+    flush();
+    mergeSegments();
+  }
+}
+
+void SearchIndex::flush()
+{
+  // Only one job runs at a time, the flush is started when the running one
+  // finishes.
+  if (merge_job_ != nullptr) {
+    flush_pending_ = true;
+    return;
+  }
+
+  MergeJob *job = prepareFlush();
+  if (job == nullptr)
+    return;
+
+  merge_job_ = job;
+  merge_thread_ = g_thread_new("search-merge", merge_, job);
+}
+
+SearchIndex::MergeJob *SearchIndex::prepareFlush()
+{
+  flush_pending_ = false;
+  if (memory_postings_.empty() && !manifest_dirty_)
+    return nullptr;
+
+  MergeJob *job = new MergeJob;
+  job->index = this;
+  if (!memory_postings_.empty()) {
+    // Hand the collected postings over to a new segment.
+    job->postings.swap(memory_postings_);
+    memory_posting_count_ = 0;
+    job->name = g_strdup_printf(SEGMENT_PREFIX "%u", next_segment_++);
+    job->filename = getSegmentFilename(job->name);
+  }
+
+  // The manifest is written after the segment and it covers only messages
+  // that are in the segments. If the segment cannot be written then the
+  // manifest is not updated so at least messages indexed since the last flush
+  // are indexed again at the next startup.
+  for (LogFile &file : files_)
+    file.flushed_size = file.indexed_size;
+  job->manifest = buildManifest(job->name);
+  job->manifest_filename = g_build_filename(index_dir_, "manifest", nullptr);
+  manifest_dirty_ = false;
+  return job;
+}
+
+void SearchIndex::mergeSegments()
+{
+  // Only one merge runs at a time, the number of segments is checked again
+  // when it finishes.
+  if (segments_.size() <= SEARCHINDEX_MAX_SEGMENTS || merge_job_ != nullptr)
+    return;
+
+  // Pick the smallest segments.
+  std::vector<std::size_t> order(segments_.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [this](std::size_t a, std::size_t b) {
+    return segments_[a].size < segments_[b].size;
+  });
+  order.resize(SEARCHINDEX_MERGE_SEGMENTS);
+
+  MergeJob *job = new MergeJob;
+  job->index = this;
+  for (std::size_t i : order) {
+    Segment segment = segments_[i];
+    segment.name = nullptr;
+    g_mapped_file_ref(segment.mapped);
+    job->segments.push_back(segment);
+  }
+  job->live.resize(files_.size());
+  for (guint32 i = 0; i < files_.size(); ++i)
+    job->live[i] = isLive(i);
+  job->name = g_strdup_printf(SEGMENT_PREFIX "%u", next_segment_++);
+  job->filename = getSegmentFilename(job->name);
+
+  merge_job_ = job;
+  merge_thread_ = g_thread_new("search-merge", merge_, job);
+}
+
+void SearchIndex::merge(MergeJob *job)
+{
+  writeJob(job);
+  g_idle_add(merge_finished_, job);
+}
+
+void SearchIndex::writeJob(MergeJob *job)
+{
+  // Runs in a worker thread. Note that purple and Log functions cannot be
+  // called here.
+
+  if (job->filename != nullptr) {
+    SegmentData data;
+    data.term_count = 0;
+    data.posting_count = 0;
+    if (!job->segments.empty())
+      mergeTerms(*job, data);
+    else
+      for (const MemoryPostings::value_type &term : job->postings) {
+        // The postings are searched from the main thread at the same time,
+        // sort a copy of them.
+        Postings postings(term.second);
+        std::sort(postings.begin(), postings.end(), postingLess);
+        addSegmentTerm(data, term.first, postings);
+      }
+
+    GError *err = nullptr;
+    if (!writeSegment(data, job->filename, &err)) {
+      job->error = g_strdup(err->message);
+      g_clear_error(&err);
+      return;
+    }
+  }
+
+  if (job->manifest != nullptr) {
+    GError *err = nullptr;
+    if (!g_file_set_contents(job->manifest_filename, job->manifest, -1, &err)) {
+      job->error = g_strdup(err->message);
+      job->manifest_error = true;
+      g_clear_error(&err);
+    }
+  }
+}
+
+void SearchIndex::mergeTerms(const MergeJob &job, SegmentData &data)
+{
+  // Merge the sorted terms, postings of removed logfiles are dropped.
+  const Segments &segments = job.segments;
+  std::vector<guint32> cursors(segments.size(), 0);
+  while (true) {
+    // Find the smallest term.
+    std::string term;
+    bool found = false;
+    for (std::size_t k = 0; k < segments.size(); ++k) {
+      if (cursors[k] >= segments[k].term_count)
+        continue;
+      std::string cur = getTerm(segments[k], cursors[k]);
+      if (!found || cur < term) {
+        term = cur;
+        found = true;
+      }
+    }
+    if (!found)
+      break;
+
+    Postings postings;
+    for (std::size_t k = 0; k < segments.size(); ++k) {
+      const Segment &segment = segments[k];
+      if (cursors[k] >= segment.term_count ||
+        getTerm(segment, cursors[k]) != term)
+        continue;
+
+      guint32 entry[4];
+      decodeTermEntry(segment.terms + cursors[k] * SEGMENT_TERM_SIZE, entry);
+      for (guint32 i = 0; i < entry[3]; ++i) {
+        Posting posting;
+        decodePosting(
+          segment.postings + (entry[2] + i) * SEGMENT_POSTING_SIZE, posting);
+        if (posting.file_id < job.live.size() && job.live[posting.file_id])
+          postings.push_back(posting);
+      }
+      ++cursors[k];
+    }
+
+    // Keep the postings sorted and drop duplicates left by an unclean exit.
+    std::sort(postings.begin(), postings.end(), postingLess);
+    postings.erase(std::unique(postings.begin(), postings.end(), postingEqual),
+      postings.end());
+    if (!postings.empty())
+      addSegmentTerm(data, term, postings);
+  }
+}
+
+void SearchIndex::mergeFinished()
+{
+  g_thread_join(merge_thread_);
+  merge_thread_ = nullptr;
+  finishJob();
+
+  // Postings could have been collected and segments added in the meantime.
+  if (flush_pending_)
+    flush();
+  mergeSegments();
+}
+
+void SearchIndex::finishJob()
+{
+  MergeJob *job = merge_job_;
+  merge_job_ = nullptr;
+
+  if (job->error != nullptr)
+    reportJobError(job);
+
+  // The segment is written first, only the manifest can fail after it.
+  if (job->name == nullptr ||
+    (job->error != nullptr && !job->manifest_error)) {
+    freeMergeJob(job);
+    return;
+  }
+
+  if (job->segments.empty()) {
+    // A flushed segment is already recorded in the manifest.
+    openSegment(job->name);
+  }
+  else if (openSegment(job->name)) {
+    // Replace the merged segments in the manifest before they are removed.
+    // Segments are only removed by a merge so all of them are still present.
+    Segments removed;
+    for (const Segment &merged : job->segments)
+      for (Segments::iterator i = segments_.begin(); i != segments_.end(); ++i)
+        if (i->mapped == merged.mapped) {
+          removed.push_back(*i);
+          segments_.erase(i);
+          break;
+        }
+    bool saved = saveManifest();
+    for (Segment &segment : removed)
+      closeSegment(segment, saved);
+  }
+  freeMergeJob(job);
+}
+
+void SearchIndex::reportJobError(const MergeJob *job) const
+{
+  if (job->manifest_error)
+    LOG->error(_("Error writing search index manifest '%s' (%s)."),
+      job->manifest_filename, job->error);
+  else
+    LOG->error(_("Error writing search index segment '%s' (%s)."),
+      job->filename, job->error);
+}
+
+void SearchIndex::freeMergeJob(MergeJob *job)
+{
+  for (Segment &segment : job->segments)
+    g_mapped_file_unref(segment.mapped);
+  g_free(job->name);
+  g_free(job->filename);
+  g_free(job->manifest);
+  g_free(job->manifest_filename);
+  g_free(job->error);
+  delete job;
+}
+
+bool SearchIndex::writeSegment(
+  const SegmentData &data, const char *filename, GError **err)
+{
+  gsize length = SEGMENT_HEADER_SIZE + data.terms.size() +
+    data.postings.size() + data.strings.size();
+  char *contents = g_new(char, length);
+
+  std::memcpy(contents, SEGMENT_MAGIC, SEGMENT_MAGIC_LENGTH);
+  guint32 counts[2] = {
+    GUINT32_TO_LE(data.term_count), GUINT32_TO_LE(data.posting_count)};
+  std::memcpy(contents + SEGMENT_MAGIC_LENGTH, counts, sizeof(counts));
+  char *p = contents + SEGMENT_HEADER_SIZE;
+  p = std::copy(data.terms.begin(), data.terms.end(), p);
+  p = std::copy(data.postings.begin(), data.postings.end(), p);
+  std::copy(data.strings.begin(), data.strings.end(), p);
+
+  bool res = g_file_set_contents(filename, contents, length, err);
+  g_free(contents);
+  return res;
+}
+
+char *SearchIndex::getSegmentFilename(const char *name) const
+{
+  return g_build_filename(index_dir_, name, nullptr);
+}
+
+void SearchIndex::findQueryTerm(
+  const std::string &term, QueryTerm &query_term) const
+{
+  query_term.count = 0;
+  for (const Segment &segment : segments_) {
+    PostingRange range;
+    if (!findTerm(segment, term, &range.first, &range.count))
+      continue;
+
+    range.segment = &segment;
+    query_term.ranges.push_back(range);
+    query_term.count += range.count;
+  }
+
+  MemoryPostings::const_iterator i = memory_postings_.find(term);
+  if (i != memory_postings_.end())
+    query_term.memory = i->second;
+  if (merge_job_ != nullptr) {
+    // Postings that are being flushed.
+    i = merge_job_->postings.find(term);
+    if (i != merge_job_->postings.end())
+      query_term.memory.insert(
+        query_term.memory.end(), i->second.begin(), i->second.end());
+  }
+  if (!query_term.memory.empty()) {
+    std::sort(
+      query_term.memory.begin(), query_term.memory.end(), postingLess);
+    query_term.count += query_term.memory.size();
+  }
+}
+
+bool SearchIndex::findPosting(
+  const QueryTerm &query_term, const Posting &key, Posting *posting)
+{
+  Postings::const_iterator i = std::lower_bound(query_term.memory.begin(),
+    query_term.memory.end(), key, postingLess);
+  if (i != query_term.memory.end() && postingEqual(*i, key)) {
+    *posting = *i;
+    return true;
+  }
+
+  // Binary search in the sorted postings of each segment.
+  for (const PostingRange &range : query_term.ranges) {
+    guint32 low = range.first;
+    guint32 high = range.first + range.count;
+    while (low < high) {
+      guint32 mid = low + (high - low) / 2;
+      decodePosting(
+        range.segment->postings + mid * SEGMENT_POSTING_SIZE, *posting);
+      if (postingEqual(*posting, key))
+        return true;
+      if (postingLess(*posting, key))
+        low = mid + 1;
+      else
+        high = mid;
+    }
+  }
+  return false;
+}
+
+bool SearchIndex::findTerm(const Segment &segment, const std::string &term,
+  guint32 *first, guint32 *count) const
+{
+  // Binary search in the sorted terms.
+  guint32 low = 0;
+  guint32 high = segment.term_count;
+  while (low < high) {
+    guint32 mid = low + (high - low) / 2;
+    guint32 entry[4];
+    decodeTermEntry(segment.terms + mid * SEGMENT_TERM_SIZE, entry);
+
+    int res = compareTerms(
+      segment.strings + entry[0], entry[1], term.data(), term.size());
+    if (res == 0) {
+      *first = entry[2];
+      *count = entry[3];
+      return true;
+    }
+    if (res < 0)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  return false;
+}
+
+std::string SearchIndex::getTerm(const Segment &segment, guint32 i)
+{
+  guint32 entry[4];
+  decodeTermEntry(segment.terms + i * SEGMENT_TERM_SIZE, entry);
+  return std::string(segment.strings + entry[0], entry[1]);
+}
+
+bool SearchIndex::isLive(guint32 file_id) const
+{
+  return file_id < files_.size() && !files_[file_id].path.empty();
+}
+
+bool SearchIndex::postingLess(const Posting &a, const Posting &b)
+{
+  if (a.file_id != b.file_id)
+    return a.file_id < b.file_id;
+  return a.offset < b.offset;
+}
+
+bool SearchIndex::postingEqual(const Posting &a, const Posting &b)
+{
+  return a.file_id == b.file_id && a.offset == b.offset;
+}
+
+void SearchIndex::tokenize(
+  const char *text, std::map<std::string, guint32> &terms)
+{
+  // Words are formed of alphanumeric characters and are lowercased.
+  const char *p = text;
+  while (*p != '\0') {
+    const char *start = p;
+    while (*p != '\0') {
+      gunichar uc = g_utf8_get_char_validated(p, -1);
+      if (uc == static_cast<gunichar>(-1) || uc == static_cast<gunichar>(-2) ||
+        !g_unichar_isalnum(uc))
+        break;
+      p = g_utf8_next_char(p);
+    }
+
+    if (p == start) {
+      // Skip a separator or an invalid byte.
+      gunichar uc = g_utf8_get_char_validated(p, -1);
+      if (uc == static_cast<gunichar>(-1) || uc == static_cast<gunichar>(-2))
+        ++p;
+      else
+        p = g_utf8_next_char(p);
+      continue;
+    }
+
+    if (p - start > SEARCHINDEX_MAX_TERM_LENGTH)
+      continue;
+
+    char *term = g_utf8_strdown(start, p - start);
+    ++terms[term];
+    g_free(term);
+  }
+}
+
+void SearchIndex::addSegmentTerm(
+  SegmentData &data, const std::string &term, const Postings &postings)
+{
+  guint32 entry[4] = {GUINT32_TO_LE(static_cast<guint32>(data.strings.size())),
+    GUINT32_TO_LE(static_cast<guint32>(term.size())),
+    GUINT32_TO_LE(data.posting_count),
+    GUINT32_TO_LE(static_cast<guint32>(postings.size()))};
+  const char *buf = reinterpret_cast<const char *>(entry);
+  data.terms.insert(data.terms.end(), buf, buf + sizeof(entry));
+  data.strings.insert(data.strings.end(), term.begin(), term.end());
+
+  for (const Posting &posting : postings) {
+    char posting_buf[SEGMENT_POSTING_SIZE];
+    encodePosting(posting, posting_buf);
+    data.postings.insert(
+      data.postings.end(), posting_buf, posting_buf + SEGMENT_POSTING_SIZE);
+  }
+
+  ++data.term_count;
+  data.posting_count += postings.size();
+}
+
+void SearchIndex::decodeTermEntry(const char *buf, guint32 *values)
+{
+  std::memcpy(values, buf, 4 * sizeof(guint32));
+  for (int i = 0; i < 4; ++i)
+    values[i] = GUINT32_FROM_LE(values[i]);
+}
+
+void SearchIndex::encodePosting(const Posting &posting, char *buf)
+{
+  guint32 values32[2] = {
+    GUINT32_TO_LE(posting.file_id), GUINT32_TO_LE(posting.frequency)};
+  guint64 values64[2] = {GUINT64_TO_LE(posting.offset),
+    GUINT64_TO_LE(static_cast<guint64>(posting.time))};
+  std::memcpy(buf, values32, sizeof(values32));
+  std::memcpy(buf + sizeof(values32), values64, sizeof(values64));
+}
+
+void SearchIndex::decodePosting(const char *buf, Posting &posting)
+{
+  guint32 values32[2];
+  guint64 values64[2];
+  std::memcpy(values32, buf, sizeof(values32));
+  std::memcpy(values64, buf + sizeof(values32), sizeof(values64));
+  posting.file_id = GUINT32_FROM_LE(values32[0]);
+  posting.frequency = GUINT32_FROM_LE(values32[1]);
+  posting.offset = GUINT64_FROM_LE(values64[0]);
+  posting.time = static_cast<gint64>(GUINT64_FROM_LE(values64[1]));
+}
+
+// vim: set tabstop=2 shiftwidth=2 textwidth=80 expandtab:
@@ -0,0 +1,309 @@
+// Copyright (C) 2016 Petr Pavlu <setup@dagobah.cz>
+//
+// This file is part of CenterIM.
+//
+// CenterIM is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// CenterIM is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with CenterIM.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SEARCHINDEX_H
+#define SEARCHINDEX_H
+
+#include "ConversationHistoryLoader.h"
+
+#include <cppconsui/CppConsUI.h>
+#include <ctime>
+#include <glib.h>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define SEARCHINDEX (SearchIndex::instance())
+
+// Full-text index of all conversation logs. The index is an inverted index
+// mapping lowercased words to the messages containing them. It is stored in
+// the "clogs-index" directory as a set of immutable segments which are
+// memory-mapped when searching. New messages are collected in memory and
+// written out as a new segment when enough of them accumulate. Small segments
+// are merged together to keep the number of segments low.
+//
+// The manifest file in the index directory records the list of segments and
+// for every indexed logfile its identifier and the size that is covered by the
+// index. Logfiles are indexed incrementally, new data in logfiles is picked up
+// at startup and messages written by conversations are added directly.
+//
+// Walking the clogs directory at startup and writing and merging segments are
+// done on worker threads. Their results are applied in the main loop.
+class SearchIndex {
+public:
+  struct Hit {
+    guint32 file_id;
+    // Byte offset of the message record in the logfile.
+    guint64 offset;
+    time_t time;
+    double score;
+  };
+  typedef std::vector<Hit> Hits;
+
+  static SearchIndex *instance();
+
+  // Records a message that was appended to a conversation logfile at a given
+  // offset.
+  void addMessage(const char *filename, guint64 offset, std::size_t length,
+    time_t time, const char *text);
+  // Records a header of a given length that was written at the start of a new
+  // logfile.
+  void addLogHeader(const char *filename, std::size_t length);
+
+  // Returns the best hits for a query, ordered by their score. All words in the
+  // query have to be present in a message for it to match.
+  Hits search(const char *query, std::size_t max_hits) const;
+
+  // Discards the index stored on the disk so that it is rebuilt from scratch
+  // at the next start. This is needed when logfiles are rewritten offline.
+  static void discard();
+
+  // Returns the path of a logfile relative to the clogs directory, or nullptr
+  // if the file identifier is unknown.
+  const char *getLogPath(guint32 file_id) const;
+  // Returns the absolute filename of a logfile, it should be freed by g_free().
+  char *getLogFilename(guint32 file_id) const;
+
+private:
+  struct Posting {
+    guint32 file_id;
+    // Number of occurrences of the term in the message.
+    guint32 frequency;
+    guint64 offset;
+    gint64 time;
+  };
+
+  typedef std::vector<Posting> Postings;
+  // Terms have to be sorted when they are written to a segment.
+  typedef std::map<std::string, Postings> MemoryPostings;
+
+  struct LogFile {
+    // Path relative to the clogs directory, empty if the identifier is no
+    // longer used.
+    std::string path;
+    // Size of the logfile that is covered by the index.
+    guint64 indexed_size;
+    // Part of indexed_size whose postings were handed over to be written to
+    // a segment, this is what the manifest records.
+    guint64 flushed_size;
+  };
+
+  typedef std::vector<LogFile> LogFiles;
+  typedef std::map<std::string, guint32> LogFileIDs;
+
+  struct Segment {
+    char *name;
+    GMappedFile *mapped;
+    gsize size;
+    guint32 term_count;
+    guint32 posting_count;
+    const char *terms;
+    const char *postings;
+    const char *strings;
+    gsize strings_size;
+  };
+
+  typedef std::vector<Segment> Segments;
+
+  // Location of postings of a term in a segment.
+  struct PostingRange {
+    const Segment *segment;
+    guint32 first;
+    guint32 count;
+  };
+
+  // Postings of a query term. Postings in segments are decoded only when they
+  // are needed, postings that are not written to a segment yet are copied.
+  struct QueryTerm {
+    std::vector<PostingRange> ranges;
+    // Sorted by postingLess().
+    Postings memory;
+    // Total number of postings.
+    std::size_t count;
+  };
+
+  // Paths relative to the clogs directory and sizes of found logfiles.
+  typedef std::vector<std::pair<std::string, guint64>> ScannedLogs;
+
+  // Scan of the clogs directory running in a worker thread.
+  struct ScanJob {
+    SearchIndex *index;
+    char *clogs_dir;
+    ScannedLogs logs;
+  };
+
+  // Merge of segments or a flush of postings collected in memory running in
+  // a worker thread. The job writes the new segment and then the manifest, if
+  // it has one.
+  struct MergeJob {
+    SearchIndex *index;
+    // Merged segments, each holds its own reference to the mapped file.
+    Segments segments;
+    // Whether logfiles were live when the merge started.
+    std::vector<bool> live;
+    // Flushed postings, they are searched until the new segment is opened.
+    MemoryPostings postings;
+    // New segment, nullptr if the job writes only the manifest.
+    char *name;
+    char *filename;
+    char *manifest;
+    char *manifest_filename;
+    // Error message if the segment or the manifest could not be written.
+    char *error;
+    bool manifest_error;
+
+    MergeJob()
+      : index(nullptr), name(nullptr), filename(nullptr), manifest(nullptr),
+        manifest_filename(nullptr), error(nullptr), manifest_error(false)
+    {
+    }
+  };
+
+  // Encoded segment that is being built.
+  struct SegmentData {
+    std::vector<char> terms;
+    std::vector<char> postings;
+    std::vector<char> strings;
+    guint32 term_count;
+    guint32 posting_count;
+  };
+
+  char *clogs_dir_;
+  char *index_dir_;
+
+  // Logfiles indexed by their identifiers.
+  LogFiles files_;
+  LogFileIDs file_ids_;
+  guint64 message_count_;
+  // The manifest does not reflect the current state.
+  bool manifest_dirty_;
+
+  Segments segments_;
+  guint32 next_segment_;
+
+  MemoryPostings memory_postings_;
+  std::size_t memory_posting_count_;
+
+  // Logfiles that have data which is not indexed yet.
+  std::vector<guint32> pending_files_;
+  GThread *scan_thread_;
+  ScanJob *scan_job_;
+  // Logfiles that received messages while the scan was running.
+  std::set<std::string> scan_dirty_files_;
+  guint catch_up_id_;
+  std::vector<ConversationHistoryLoader::Message> catch_up_messages_;
+
+  GThread *merge_thread_;
+  MergeJob *merge_job_;
+  // A flush was requested while a job was running.
+  bool flush_pending_;
+
+  static SearchIndex *my_instance_;
+
+  SearchIndex();
+  ~SearchIndex();
+  CONSUI_DISABLE_COPY(SearchIndex);
+
+  static void init();
+  static void finalize();
+  friend class CenterIM;
+
+  bool loadManifest();
+  char *buildManifest(const char *new_segment) const;
+  bool saveManifest() const;
+  bool openSegment(const char *name);
+  void closeSegment(Segment &segment, bool remove);
+  void removeUnusedSegments();
+  void reset();
+
+  static gpointer scan_(gpointer data)
+  {
+    scan(reinterpret_cast<ScanJob *>(data));
+    return nullptr;
+  }
+  static void scan(ScanJob *job);
+  static void scanLogs(
+    const char *clogs_dir, const char *path, int depth, ScannedLogs &logs);
+  static gboolean scan_finished_(gpointer data)
+  {
+    ScanJob *job = reinterpret_cast<ScanJob *>(data);
+    job->index->scanFinished();
+    return FALSE;
+  }
+  void scanFinished();
+  bool findLogFile(const char *filename, guint32 *file_id);
+  guint32 addLogFile(const std::string &path);
+
+  static gboolean catch_up_(gpointer data)
+  {
+    return reinterpret_cast<SearchIndex *>(data)->catchUp();
+  }
+  gboolean catchUp();
+  bool collectMessage(const ConversationHistoryLoader::Message &message);
+  void indexMessage(
+    guint32 file_id, guint64 offset, time_t time, const char *text);
+
+  void flush();
+  MergeJob *prepareFlush();
+  void mergeSegments();
+  static gpointer merge_(gpointer data)
+  {
+    merge(reinterpret_cast<MergeJob *>(data));
+    return nullptr;
+  }
+  static void merge(MergeJob *job);
+  static void writeJob(MergeJob *job);
+  static void mergeTerms(const MergeJob &job, SegmentData &data);
+  static gboolean merge_finished_(gpointer data)
+  {
+    MergeJob *job = reinterpret_cast<MergeJob *>(data);
+    job->index->mergeFinished();
+    return FALSE;
+  }
+  void mergeFinished();
+  void finishJob();
+  void reportJobError(const MergeJob *job) const;
+  void freeMergeJob(MergeJob *job);
+  static bool writeSegment(
+    const SegmentData &data, const char *filename, GError **err);
+  char *getSegmentFilename(const char *name) const;
+
+  void findQueryTerm(const std::string &term, QueryTerm &query_term) const;
+  static bool findPosting(
+    const QueryTerm &query_term, const Posting &key, Posting *posting);
+  bool findTerm(const Segment &segment, const std::string &term,
+    guint32 *first, guint32 *count) const;
+  static std::string getTerm(const Segment &segment, guint32 i);
+  bool isLive(guint32 file_id) const;
+  // Orders postings by the message, this is the order of postings of a term in
+  // a segment.
+  static bool postingLess(const Posting &a, const Posting &b);
+  static bool postingEqual(const Posting &a, const Posting &b);
+
+  static void tokenize(const char *text, std::map<std::string, guint32> &terms);
+  static void addSegmentTerm(
+    SegmentData &data, const std::string &term, const Postings &postings);
+  static void decodeTermEntry(const char *buf, guint32 *values /*[4]*/);
+  static void encodePosting(const Posting &posting, char *buf);
+  static void decodePosting(const char *buf, Posting &posting);
+};
+
+#endif // SEARCHINDEX_H
+
+// vim: set tabstop=2 shiftwidth=2 textwidth=80 expandtab:
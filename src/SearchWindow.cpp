@@ -0,0 +1,245 @@
+// Copyright (C) 2016 Petr Pavlu <setup@dagobah.cz>
+//
+// This file is part of CenterIM.
+//
+// CenterIM is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// CenterIM is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with CenterIM.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "SearchWindow.h"
+
+#include "Conversation.h"
+#include "Log.h"
+
+#include "gettext.h"
+#include <cppconsui/Label.h>
+#include <cstring>
+
+// Maximum number of shown hits.
+#define SEARCHWINDOW_MAX_HITS 100
+// Maximum length of a message snippet in bytes.
+#define SEARCHWINDOW_SNIPPET_LENGTH 160
+
+SearchWindow::SearchWindow()
+  : SplitDialog(0, 0, 80, 24, _("Search conversations"))
+{
+  setColorScheme(CenterIM::SCHEME_GENERALWINDOW);
+
+  treeview_ = new CppConsUI::TreeView(AUTOSIZE, AUTOSIZE);
+  setContainer(*treeview_);
+
+  buttons_->appendItem(
+    _("Search"), sigc::mem_fun(this, &SearchWindow::openQueryDialog));
+  buttons_->appendSeparator();
+  buttons_->appendItem(
+    _("Done"), sigc::hide(sigc::mem_fun(this, &SearchWindow::close)));
+
+  onScreenResized();
+}
+
+void SearchWindow::onScreenResized()
+{
+  moveResizeRect(CENTERIM->getScreenArea(CenterIM::CHAT_AREA));
+}
+
+void SearchWindow::openQueryDialog(CppConsUI::Button & /*activator*/)
+{
+  auto dialog = new CppConsUI::InputDialog(_("Search for"), "");
+  dialog->signal_response.connect(
+    sigc::mem_fun(this, &SearchWindow::onQueryResponse));
+  dialog->show();
+}
+
+void SearchWindow::onQueryResponse(
+  CppConsUI::InputDialog &activator, AbstractDialog::ResponseType response)
+{
+  if (response != AbstractDialog::RESPONSE_OK)
+    return;
+
+  search(activator.getText());
+}
+
+void SearchWindow::search(const char *query)
+{
+  treeview_->clear();
+
+  gint64 start = g_get_monotonic_time();
+  hits_ = SEARCHINDEX->search(query, SEARCHWINDOW_MAX_HITS);
+  int duration = (g_get_monotonic_time() - start) / 1000;
+
+  char *summary = g_strdup_printf(
+    ngettext("Found %u message in %d ms.", "Found %u messages in %d ms.",
+      hits_.size()),
+    static_cast<unsigned>(hits_.size()), duration);
+  treeview_->appendNode(
+    treeview_->getRootNode(), *(new CppConsUI::Label(summary)));
+  g_free(summary);
+
+  for (std::size_t i = 0; i < hits_.size(); ++i) {
+    const SearchIndex::Hit &hit = hits_[i];
+    const char *path = SEARCHINDEX->getLogPath(hit.file_id);
+
+    // Logfile paths are in the <protocol>/<account>/<name> form.
+    char **parts = g_strsplit(path, G_DIR_SEPARATOR_S, 3);
+    char *name;
+    if (g_strv_length(parts) == 3) {
+      char *account = g_strdup(purple_unescape_filename(parts[1]));
+      name = g_strdup_printf(
+        "%s (%s)", purple_unescape_filename(parts[2]), account);
+      g_free(account);
+    }
+    else
+      name = g_strdup(path);
+    g_strfreev(parts);
+
+    struct tm time_local;
+    if (localtime_r(&hit.time, &time_local) == nullptr)
+      std::memset(&time_local, 0, sizeof(time_local));
+
+    char *snippet = getSnippet(hit);
+    char *text = g_strdup_printf("%s %s\n  %s", name,
+      purple_date_format_long(&time_local),
+      snippet != nullptr ? snippet : _("(message is not available)"));
+    auto button = new CppConsUI::Button(text);
+    g_free(text);
+    g_free(snippet);
+    g_free(name);
+
+    button->signal_activate.connect(
+      sigc::bind(sigc::mem_fun(this, &SearchWindow::onHitActivate), i));
+    treeview_->appendNode(treeview_->getRootNode(), *button);
+  }
+}
+
+void SearchWindow::onHitActivate(
+  CppConsUI::Button & /*activator*/, std::size_t i)
+{
+  const SearchIndex::Hit &hit = hits_[i];
+  const char *path = SEARCHINDEX->getLogPath(hit.file_id);
+  if (path == nullptr)
+    return;
+
+  char **parts = g_strsplit(path, G_DIR_SEPARATOR_S, 3);
+  PurpleAccount *account = nullptr;
+  if (g_strv_length(parts) == 3)
+    account = findAccount(parts[0], parts[1]);
+  if (account == nullptr) {
+    LOG->error(_("No account found for conversation logfile '%s'."), path);
+    g_strfreev(parts);
+    return;
+  }
+
+  // Open the conversation and show the message. The logfile does not record
+  // whether it belongs to an IM or a chat so the type of a conversation that
+  // is not open is derived from the buddy list.
+  char *name = g_strdup(purple_unescape_filename(parts[2]));
+  g_strfreev(parts);
+  PurpleConversation *conv =
+    purple_find_conversation_with_account(PURPLE_CONV_TYPE_ANY, name, account);
+  if (conv == nullptr) {
+    PurpleChat *chat = purple_blist_find_chat(account, name);
+    if (chat != nullptr) {
+      // Joining is asynchronous, the conversation is presented when the chat
+      // is joined but the message cannot be shown.
+      PurpleConnection *gc = purple_account_get_connection(account);
+      if (gc != nullptr)
+        serv_join_chat(gc, purple_chat_get_components(chat));
+      else
+        LOG->error(_("Account of chat '%s' is not connected."), name);
+      g_free(name);
+      close();
+      return;
+    }
+
+    if (purple_find_buddy(account, name) == nullptr) {
+      // Opening an IM could send messages to a chat (for instance, to an IRC
+      // channel) so only IMs with known buddies are opened.
+      LOG->error(_("Conversation '%s' is not open and it was not found in the "
+                   "buddy list."),
+        name);
+      g_free(name);
+      return;
+    }
+
+    conv = purple_conversation_new(PURPLE_CONV_TYPE_IM, account, name);
+  }
+  g_free(name);
+  purple_conversation_present(conv);
+
+  Conversation *conversation = static_cast<Conversation *>(conv->ui_data);
+  if (conversation != nullptr)
+    conversation->showLogPosition(hit.offset);
+
+  close();
+}
+
+char *SearchWindow::getSnippet(const SearchIndex::Hit &hit) const
+{
+  char *filename = SEARCHINDEX->getLogFilename(hit.file_id);
+  if (filename == nullptr)
+    return nullptr;
+
+  GMappedFile *mapped = g_mapped_file_new(filename, FALSE, nullptr);
+  g_free(filename);
+  if (mapped == nullptr)
+    return nullptr;
+
+  // Parse the message at the hit offset.
+  char *text = nullptr;
+  gsize size = g_mapped_file_get_length(mapped);
+  if (hit.offset < size)
+    ConversationHistoryLoader::parseLog(g_mapped_file_get_contents(mapped),
+      size, hit.offset,
+      sigc::bind(sigc::ptr_fun(&SearchWindow::snippet_message_), &text));
+  g_mapped_file_unref(mapped);
+
+  if (text == nullptr)
+    return nullptr;
+
+  // Show only the beginning of the first line.
+  char *eol = std::strchr(text, '\n');
+  if (eol != nullptr)
+    *eol = '\0';
+  if (std::strlen(text) > SEARCHWINDOW_SNIPPET_LENGTH) {
+    char *end = g_utf8_find_prev_char(text, text + SEARCHWINDOW_SNIPPET_LENGTH);
+    if (end != nullptr)
+      *end = '\0';
+  }
+  return text;
+}
+
+bool SearchWindow::snippet_message_(
+  const ConversationHistoryLoader::Message &message, char **text)
+{
+  // Take the first message and stop parsing.
+  *text = message.text;
+  return false;
+}
+
+PurpleAccount *SearchWindow::findAccount(
+  const char *protocol, const char *username)
+{
+  // Match the way Conversation builds logfile names.
+  for (GList *l = purple_accounts_get_all(); l != nullptr; l = l->next) {
+    PurpleAccount *account = reinterpret_cast<PurpleAccount *>(l->data);
+    if (std::strcmp(purple_account_get_protocol_name(account), protocol) != 0)
+      continue;
+
+    const char *name = purple_escape_filename(
+      purple_normalize(account, purple_account_get_username(account)));
+    if (std::strcmp(name, username) == 0)
+      return account;
+  }
+  return nullptr;
+}
+
+// vim: set tabstop=2 shiftwidth=2 textwidth=80 expandtab:
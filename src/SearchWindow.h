@@ -0,0 +1,59 @@
+// Copyright (C) 2016 Petr Pavlu <setup@dagobah.cz>
+//
+// This file is part of CenterIM.
+//
+// CenterIM is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// CenterIM is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with CenterIM.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SEARCHWINDOW_H
+#define SEARCHWINDOW_H
+
+#include "SearchIndex.h"
+
+#include <cppconsui/Button.h>
+#include <cppconsui/InputDialog.h>
+#include <cppconsui/SplitDialog.h>
+#include <cppconsui/TreeView.h>
+#include <libpurple/purple.h>
+
+// Window for searching in all conversation logs. Activating a hit opens the
+// conversation and scrolls it to the message.
+class SearchWindow : public CppConsUI::SplitDialog {
+public:
+  SearchWindow();
+  virtual ~SearchWindow() override {}
+
+  // FreeWindow
+  virtual void onScreenResized() override;
+
+private:
+  CppConsUI::TreeView *treeview_;
+  SearchIndex::Hits hits_;
+
+  CONSUI_DISABLE_COPY(SearchWindow);
+
+  void openQueryDialog(CppConsUI::Button &activator);
+  void onQueryResponse(CppConsUI::InputDialog &activator,
+    CppConsUI::AbstractDialog::ResponseType response);
+  void search(const char *query);
+  void onHitActivate(CppConsUI::Button &activator, std::size_t i);
+
+  char *getSnippet(const SearchIndex::Hit &hit) const;
+  static bool snippet_message_(
+    const ConversationHistoryLoader::Message &message, char **text);
+  static PurpleAccount *findAccount(const char *protocol, const char *username);
+};
+
+#endif // SEARCHWINDOW_H
+
+// vim: set tabstop=2 shiftwidth=2 textwidth=80 expandtab:
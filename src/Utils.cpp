@@ -22,9 +22,160 @@
 #include "gettext.h"
 #include <cerrno>
 #include <cstdlib>
+#include <cstring>
 
 namespace Utils {
 
+namespace {
+
+enum HTMLTagAction {
+  // Unknown tag, it is only stripped.
+  HTML_TAG_OTHER,
+  // Link start, its address is remembered.
+  HTML_TAG_ANCHOR,
+  // Link end, the remembered address is output.
+  HTML_TAG_ANCHOR_END,
+  // Tag converted to a newline.
+  HTML_TAG_BREAK,
+  // Tag converted to a newline unless it is at the beginning of the text.
+  HTML_TAG_BLOCK,
+  // Table cell start, separated by a tab from a previous cell.
+  HTML_TAG_CELL,
+  // Table cell end.
+  HTML_TAG_CELL_END,
+  // Element whose content is not displayed.
+  HTML_TAG_SCRIPT,
+  HTML_TAG_STYLE,
+};
+
+struct HTMLTag {
+  const char *name;
+  std::size_t length;
+  HTMLTagAction action;
+};
+
+#define HTML_TAG(name, action)                                                 \
+  {                                                                            \
+    name, sizeof(name) - 1, action                                             \
+  }
+
+const HTMLTag html_tags[] = {
+  HTML_TAG("a", HTML_TAG_ANCHOR),
+  HTML_TAG("/a", HTML_TAG_ANCHOR_END),
+  HTML_TAG("br", HTML_TAG_BREAK),
+  HTML_TAG("/table", HTML_TAG_BREAK),
+  HTML_TAG("p", HTML_TAG_BLOCK),
+  HTML_TAG("div", HTML_TAG_BLOCK),
+  HTML_TAG("hr", HTML_TAG_BLOCK),
+  HTML_TAG("li", HTML_TAG_BLOCK),
+  HTML_TAG("tr", HTML_TAG_BLOCK),
+  HTML_TAG("td", HTML_TAG_CELL),
+  HTML_TAG("/td", HTML_TAG_CELL_END),
+  HTML_TAG("script", HTML_TAG_SCRIPT),
+  HTML_TAG("style", HTML_TAG_STYLE),
+};
+
+#undef HTML_TAG
+
+struct HTMLEntity {
+  const char *name;
+  std::size_t length;
+  const char *text;
+};
+
+#define HTML_ENTITY(name, text)                                                \
+  {                                                                            \
+    name, sizeof(name) - 1, text                                               \
+  }
+
+// The same set of named entities as recognized by
+// purple_markup_unescape_entity().
+const HTMLEntity html_entities[] = {
+  HTML_ENTITY("amp", "&"),
+  HTML_ENTITY("lt", "<"),
+  HTML_ENTITY("gt", ">"),
+  HTML_ENTITY("nbsp", " "),
+  HTML_ENTITY("copy", "\302\251"),
+  HTML_ENTITY("quot", "\""),
+  HTML_ENTITY("reg", "\302\256"),
+  HTML_ENTITY("apos", "'"),
+};
+
+#undef HTML_ENTITY
+
+HTMLTagAction findHTMLTag(const char *name, std::size_t length)
+{
+  for (const HTMLTag &tag : html_tags)
+    if (tag.length == length &&
+      g_ascii_strncasecmp(name, tag.name, length) == 0)
+      return tag.action;
+  return HTML_TAG_OTHER;
+}
+
+// Decodes an HTML entity at the start of str (which points to the '&'
+// character). Returns the decoded text and sets length to the number of
+// consumed characters, or returns nullptr if str does not start with a valid
+// entity. The buf array is used to store a decoded numeric entity.
+const char *decodeHTMLEntity(const char *str, std::size_t *length, char *buf)
+{
+  g_assert(*str == '&');
+
+  for (const HTMLEntity &entity : html_entities)
+    if (g_ascii_strncasecmp(str + 1, entity.name, entity.length) == 0 &&
+      str[entity.length + 1] == ';') {
+      *length = entity.length + 2;
+      return entity.text;
+    }
+
+  // Numeric character reference.
+  if (str[1] != '#')
+    return nullptr;
+
+  const char *p = str + 2;
+  bool hex = *p == 'x';
+  if (hex)
+    ++p;
+  const char *digits = p;
+  gunichar value = 0;
+  while (hex ? g_ascii_isxdigit(*p) : g_ascii_isdigit(*p)) {
+    value = value * (hex ? 16 : 10) +
+      (hex ? g_ascii_xdigit_value(*p) : g_ascii_digit_value(*p));
+    if (value > 0x10ffff)
+      return nullptr;
+    ++p;
+  }
+  if (p == digits || *p != ';' || value == 0 || !g_unichar_validate(value))
+    return nullptr;
+
+  *length = p + 1 - str;
+  buf[g_unichar_to_utf8(value, buf)] = '\0';
+  return buf;
+}
+
+// Writes str of a given length to out while decoding HTML entities. Returns
+// a pointer past the last written character.
+char *unescapeHTML(const char *str, std::size_t length, char *out)
+{
+  const char *end = str + length;
+  while (str < end) {
+    if (*str == '&') {
+      std::size_t entity_length;
+      char entity_buf[8];
+      const char *text = decodeHTMLEntity(str, &entity_length, entity_buf);
+      if (text != nullptr && str + entity_length <= end) {
+        while (*text != '\0')
+          *out++ = *text++;
+        str += entity_length;
+        continue;
+      }
+    }
+    *out++ = *str++;
+  }
+  return out;
+}
+
+} // anonymous namespace
+
 const char *getStatusIndicator(PurpleStatus *status)
 {
   PurpleStatusType *status_type = purple_status_get_type(status);
@@ -97,6 +248,261 @@ bool stringToNumber(const char *text, long min, long max, long *out)
   return true;
 }
 
+std::size_t stripHTML(const char *str, char *buf)
+{
+  // Based on libpurple/util.c:purple_markup_strip_html(), but this version
+  // does not convert tab character to a space and processes the input in one
+  // pass without any allocations.
+  //
+  // Note that the output is never longer than the input. Every tag is replaced
+  // by at most one character, an entity is always longer than its decoded
+  // text, and a link address output at the end of a link (in the form
+  // " (addr)") is shorter than the opening <a href=addr> tag which produces no
+  // output.
+
+  g_assert(str != nullptr);
+  g_assert(buf != nullptr);
+
+  const char *p = str;
+  char *o = buf;
+  bool visible = true;
+  bool closing_td = false;
+  // Closing tag of a currently processed script or style element.
+  const char *cdata_close_tag = nullptr;
+  std::size_t cdata_close_tag_length = 0;
+  // Address of the last link and the start of its text in the output.
+  const char *href = nullptr;
+  std::size_t href_length = 0;
+  const char *href_text = nullptr;
+
+  while (*p != '\0') {
+    if (cdata_close_tag != nullptr) {
+      // Note: Do not even assume any other tag is a tag in CDATA.
+      if (*p == '<' &&
+        g_ascii_strncasecmp(p, cdata_close_tag, cdata_close_tag_length) == 0) {
+        p += cdata_close_tag_length;
+        cdata_close_tag = nullptr;
+      }
+      else
+        ++p;
+      continue;
+    }
+
+    if (*p == '<' && p[1] != '\0' && !g_ascii_isspace(p[1])) {
+      // Scan until we end the tag either implicitly (closed start tag) or
+      // explicitly, using a sloppy method (i.e., < or > inside quoted
+      // attributes will screw us up).
+      const char *end = p + 1;
+      while (*end != '\0' && *end != '<' && *end != '>')
+        ++end;
+
+      // Extract the tag name.
+      const char *name = p + 1;
+      const char *name_end = name;
+      if (*name_end == '/')
+        ++name_end;
+      while (g_ascii_isalnum(*name_end))
+        ++name_end;
+
+      HTMLTagAction action = findHTMLTag(name, name_end - name);
+      if (action == HTML_TAG_CELL_END) {
+        closing_td = true;
+        visible = false;
+      }
+      else if (action != HTML_TAG_CELL || !closing_td) {
+        closing_td = false;
+        visible = true;
+      }
+
+      switch (action) {
+      case HTML_TAG_OTHER:
+        break;
+      case HTML_TAG_ANCHOR:
+        // Save the link address (if there is any) to print it later.
+        for (const char *st = name_end; st < end; ++st) {
+          if (g_ascii_strncasecmp(st, "href=", 5) != 0)
+            continue;
+          st += 5;
+          char delim = ' ';
+          if (*st == '"' || *st == '\'') {
+            delim = *st;
+            ++st;
+          }
+          const char *st_end = st;
+          while (st_end < end && *st_end != delim)
+            ++st_end;
+          href = st;
+          href_length = st_end - st;
+          href_text = o;
+          break;
+        }
+        break;
+      case HTML_TAG_ANCHOR_END:
+        if (href != nullptr) {
+          // Decode the address after a space for " (", it is kept only if it
+          // differs from the link text. 7 == strlen("http://").
+          char *addr = o + 2;
+          char *addr_end = unescapeHTML(href, href_length, addr);
+          std::size_t addr_length = addr_end - addr;
+          std::size_t text_length = o - href_text;
+          if (!(addr_length == text_length &&
+                  std::memcmp(href_text, addr, addr_length) == 0) &&
+            !(addr_length == text_length + 7 &&
+                std::memcmp(href_text, addr + 7, text_length) == 0)) {
+            o[0] = ' ';
+            o[1] = '(';
+            o = addr_end;
+            *o++ = ')';
+          }
+          href = nullptr;
+        }
+        break;
+      case HTML_TAG_BREAK:
+        *o++ = '\n';
+        break;
+      case HTML_TAG_BLOCK:
+        // Ignore the tag at the beginning of the text.
+        if (o != buf)
+          *o++ = '\n';
+        break;
+      case HTML_TAG_CELL:
+        if (closing_td) {
+          *o++ = '\t';
+          visible = true;
+        }
+        break;
+      case HTML_TAG_CELL_END:
+        break;
+      case HTML_TAG_SCRIPT:
+        cdata_close_tag = "</script>";
+        cdata_close_tag_length = 9;
+        break;
+      case HTML_TAG_STYLE:
+        cdata_close_tag = "</style>";
+        cdata_close_tag_length = 8;
+        break;
+      }
+
+      // Continue after the tag.
+      p = *end == '>' ? end + 1 : end;
+      continue;
+    }
+
+    if (*p == '<') {
+      // A lone '<' character, it is printed.
+      closing_td = false;
+      visible = true;
+    }
+    else if (!g_ascii_isspace(*p))
+      visible = true;
+
+    if (*p == '&') {
+      std::size_t entity_length;
+      char entity_buf[8];
+      const char *text = decodeHTMLEntity(p, &entity_length, entity_buf);
+      if (text != nullptr) {
+        while (*text != '\0')
+          *o++ = *text++;
+        p += entity_length;
+        continue;
+      }
+    }
+
+    if (visible)
+      *o++ = g_ascii_isspace(*p) && *p != '\t' ? ' ' : *p;
+    ++p;
+  }
+
+  *o = '\0';
+  return o - buf;
+}
+
+char *stripHTML(const char *str)
+{
+  if (str == nullptr)
+    return nullptr;
+
+  char *res = g_new(char, std::strlen(str) + 1);
+  stripHTML(str, res);
+  return res;
+}
+
+TimeFormatter::TimeFormatter()
+  : fast_format_(isFastFormat()), minute_start_(-1), day_length_(0)
+{
+}
+
+void TimeFormatter::format(time_t t, char *buf, std::size_t size)
+{
+  // Messages are mostly processed in the chronological order so consecutive
+  // calls usually hit the same minute. The local time and the date are then
+  // reused and only seconds need to be updated.
+  if (minute_start_ == -1 || t < minute_start_ || t >= minute_start_ + 60) {
+    // Convert to local time, note that localtime_r() should not really fail.
+    struct tm tm;
+    if (localtime_r(&t, &tm) == nullptr)
+      std::memset(&tm, 0, sizeof(tm));
+
+    // Reformat the date only if the day changed.
+    if (fast_format_ &&
+      (minute_start_ == -1 || tm.tm_yday != minute_tm_.tm_yday ||
+          tm.tm_year != minute_tm_.tm_year)) {
+      const char *day = purple_utf8_strftime("%x", &tm);
+      std::size_t length = g_strlcpy(day_, day, sizeof(day_));
+      day_length_ = MIN(length, sizeof(day_) - 1);
+    }
+
+    minute_start_ = t - tm.tm_sec;
+    tm.tm_sec = 0;
+    minute_tm_ = tm;
+  }
+
+  int sec = t - minute_start_;
+
+  if (!fast_format_) {
+    struct tm tm = minute_tm_;
+    tm.tm_sec = sec;
+    g_strlcpy(buf, purple_date_format_long(&tm), size);
+    return;
+  }
+
+  // Render "<date> HH:MM:SS".
+  g_assert(size >= day_length_ + 10);
+  char *p = buf;
+  std::memcpy(p, day_, day_length_);
+  p += day_length_;
+  int values[3] = {minute_tm_.tm_hour, minute_tm_.tm_min, sec};
+  for (int i = 0; i < 3; ++i) {
+    *p++ = i == 0 ? ' ' : ':';
+    *p++ = '0' + values[i] / 10;
+    *p++ = '0' + values[i] % 10;
+  }
+  *p = '\0';
+}
+
+bool TimeFormatter::isFastFormat()
+{
+  // Check if the long date format is the date followed by the time in the
+  // HH:MM:SS form, using an arbitrary time as a probe.
+  struct tm probe;
+  std::memset(&probe, 0, sizeof(probe));
+  probe.tm_year = 116;
+  probe.tm_mon = 11;
+  probe.tm_mday = 31;
+  probe.tm_wday = 6;
+  probe.tm_yday = 365;
+  probe.tm_hour = 13;
+  probe.tm_min = 45;
+  probe.tm_sec = 56;
+
+  char *expected =
+    g_strdup_printf("%s 13:45:56", purple_utf8_strftime("%x", &probe));
+  bool res = std::strcmp(purple_date_format_long(&probe), expected) == 0;
+  g_free(expected);
+
+  return res;
+}
+
 } // namespace Utils
 
 // vim: set tabstop=2 shiftwidth=2 textwidth=80 expandtab:
@@ -18,6 +18,8 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <cstddef>
+#include <ctime>
 #include <libpurple/purple.h>
 
 namespace Utils {
@@ -29,6 +31,42 @@ char *stripAccelerator(const char *label);
 // out-of-range. Returns true if the conversion was successful, false otherwise.
 bool stringToNumber(const char *text, long min, long max, long *out);
 
+// Strips HTML markup from a string and unescapes HTML entities. Tags that
+// separate blocks of text (<br>, <p>, <div>, ...) are converted to newlines,
+// the address of a link is appended after the link text, and <script> and
+// <style> elements are removed completely. The result is written to buf which
+// must be at least strlen(str) + 1 bytes long and must not overlap str.
+// Returns length of the result.
+std::size_t stripHTML(const char *str, char *buf);
+
+// Convenience variant of stripHTML() that returns a newly allocated string.
+char *stripHTML(const char *str);
+
+// Formats times in the purple_date_format_long() format. The last formatted
+// minute is cached so that formatting times of the same minute is cheap.
+class TimeFormatter {
+public:
+  TimeFormatter();
+
+  // Writes the local time t into buf of a given size.
+  void format(time_t t, char *buf, std::size_t size);
+
+private:
+  // Whether purple_date_format_long() produces "<date> HH:MM:SS" in the
+  // current locale. The time part can be then rendered directly.
+  bool fast_format_;
+
+  // Start of the cached minute, or -1 if the cache is empty.
+  time_t minute_start_;
+  // Broken-down local time of the cached minute.
+  struct tm minute_tm_;
+  // Formatted date of the cached minute (only used by the fast format).
+  char day_[64];
+  std::size_t day_length_;
+
+  static bool isFastFormat();
+};
+
 } // namespace Utils
 
 #endif // UTILS_H
@@ -0,0 +1,370 @@
+// Micro-benchmarks comparing optimized CenterIM functions with their original
+// implementations. The program is not a part of the test suite, run it
+// manually and compare the reported times. It first checks that the optimized
+// functions produce the same output and exits with a non-zero status if not.
+
+#include <src/Log.h>
+#include <src/Utils.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <glib.h>
+#include <libpurple/purple.h>
+#include <vector>
+
+// Utils.cpp logs through the Log singleton in functions that are not
+// benchmarked, provide a dummy implementation to satisfy the linker.
+Log *Log::instance()
+{
+  return nullptr;
+}
+
+void Log::warning(const char * /*fmt*/, ...)
+{
+}
+
+namespace {
+
+// Number of times each benchmark processes its whole input.
+const int ITERATIONS = 20000;
+
+// Sample of messages in the form in which libpurple passes them to
+// the conversation, mostly plain text with occasional markup.
+const char *const messages[] = {
+  // Plain text.
+  "Hello, how are you?",
+  "I'm fine, thanks. What about you?",
+  "A longer message without any markup that mostly just needs to be copied "
+  "over to the output buffer, which is the common case in practice.",
+
+  // XMPP, XHTML-IM bodies and escaped plain text.
+  "<body xmlns='http://www.w3.org/1999/xhtml'><p>Build <span "
+  "style='font-weight: bold;'>#1432</span> passed, see <a "
+  "href='https://ci.example.org/job/centerim/1432/'>"
+  "https://ci.example.org/job/centerim/1432/</a></p></body>",
+  "<body xmlns='http://www.w3.org/1999/xhtml'><p>First line</p><p>Second "
+  "<em>line</em></p><p>Third line</p></body>",
+  "if (a &lt; b &amp;&amp; c &gt; d)\n  return &quot;done&quot;;",
+  "Minutes are at <a "
+  "href=\"https://wiki.example.org/Meeting?date=2016-05-02&amp;lang=en\">"
+  "the wiki</a>, agenda at <a href=\"http://www.centerim.org/\">"
+  "www.centerim.org</a>.",
+  "Meeting&nbsp;at&nbsp;3&nbsp;PM in room&nbsp;B &copy; 2016 Example&reg;",
+  "<a href=\"http://www.example.com/?a=1&amp;b=2\">http://www.example.com/"
+  "?a=1&amp;b=2</a>",
+
+  // IRC, mIRC formatting converted to HTML, text escaped by
+  // g_markup_escape_text() and links marked by purple_markup_linkify().
+  "<B>ChanServ</B>: <FONT COLOR=\"#FF0000\">Warning:</FONT> channel "
+  "<U>#centerim</U> is moderated",
+  "I&#39;ll be back in 5 minutes, &lt;ping&gt; me if needed",
+  "Topic for #centerim: Release 5.0 is out &#8212; <A "
+  "HREF=\"https://www.centerim.org/download/\">"
+  "https://www.centerim.org/download/</A>",
+  "<I>nick</I> has changed the topic to: <B>bugs</B>\t&amp;\t<B>fixes</B>",
+
+  // OTR notices and a query message.
+  "<b>The following message received from alice@example.org was <i>not</i> "
+  "encrypted: [</b>hi, are you there?<b>]</b>",
+  "?OTRv23? alice@example.org has requested an <a "
+  "href=\"https://otr.cypherpunks.ca/\">Off-the-Record private "
+  "conversation</a>. However, you do not have a plugin to support that.\n"
+  "See <a href=\"https://otr.cypherpunks.ca/\">https://otr.cypherpunks.ca/"
+  "</a> for more information.",
+
+  // Numeric entities.
+  "Temperature: 21&#176;C, price 5&#x20AC;, smile &#x263a; &#9731;",
+  "Fish &amp; chips &lt;3 &quot;tasty&quot; &#x263a; &unknown; & alone",
+
+  // Script and style elements whose content is not displayed.
+  "<style type=\"text/css\">p { color: red; }</style><p>Styled "
+  "<i>text</i></p>",
+  "Look: <script type=\"text/javascript\">if (a < b) alert(\"<b>hi</b>\");"
+  "</SCRIPT>done",
+
+  // Other markup.
+  "<b>Important:</b> the meeting was moved to 3 PM",
+  "<font color=\"#ff0000\">red</font> <i>italic</i> <u>underline</u>",
+  "Line one<br>Line two<br/>Line three<BR />Line four",
+  "<p>First paragraph</p><p>Second paragraph</p><hr><div>Footer</div>",
+  "<table><tr><td>a</td><td>b</td></tr><tr><td>c</td><td>d</td></tr></table>"
+  "after",
+  "<ul><li>one</li><li>two</li></ul>",
+  "a < b and c <d",
+};
+
+// Original implementation of Conversation::stripHTML(). The only change is
+// the fixed test for the end of CDATA, the original contained a typo (a length
+// of !strlen()) that made it drop all text after a script or style element.
+// Utils::stripHTML() ends the element at its closing tag as libpurple does.
+char *oldStripHTML(const char *str)
+{
+  // Almost copy&paste from libpurple/util.c:purple_markup_strip_html(), but
+  // this version does not convert tab character to a space.
+
+  if (str == nullptr)
+    return nullptr;
+
+  int i, j, k, entlen;
+  bool visible = true;
+  bool closing_td_p = false;
+  gchar *str2;
+  const gchar *cdata_close_tag = nullptr, *ent;
+  gchar *href = nullptr;
+  int href_st = 0;
+
+  str2 = g_strdup(str);
+
+  for (i = 0, j = 0; str2[i] != '\0'; ++i) {
+    if (str2[i] == '<') {
+      if (cdata_close_tag) {
+        // Note: Do not even assume any other tag is a tag in CDATA.
+        if (!g_ascii_strncasecmp(
+              str2 + i, cdata_close_tag, strlen(cdata_close_tag))) {
+          i += strlen(cdata_close_tag) - 1;
+          cdata_close_tag = nullptr;
+        }
+        continue;
+      }
+      else if (!g_ascii_strncasecmp(str2 + i, "<td", 3) && closing_td_p) {
+        str2[j++] = '\t';
+        visible = true;
+      }
+      else if (!g_ascii_strncasecmp(str2 + i, "</td>", 5)) {
+        closing_td_p = true;
+        visible = false;
+      }
+      else {
+        closing_td_p = false;
+        visible = true;
+      }
+
+      k = i + 1;
+
+      if (g_ascii_isspace(str2[k]))
+        visible = true;
+      else if (str2[k]) {
+        // Scan until we end the tag either implicitly (closed start tag) or
+        // explicitly, using a sloppy method (i.e., < or > inside quoted
+        // attributes will screw us up).
+        while (str2[k] != '\0' && str2[k] != '<' && str2[k] != '>')
+          ++k;
+
+        // If we have got an <a> tag with an href, save the address to print
+        // later.
+        if (g_ascii_strncasecmp(str2 + i, "<a", 2) == 0 &&
+          g_ascii_isspace(str2[i + 2])) {
+          int st;  // Start of href, inclusive [.
+          int end; // End of href, exclusive ).
+          char delim = ' ';
+          // Find start of href.
+          for (st = i + 3; st < k; ++st) {
+            if (g_ascii_strncasecmp(str2 + st, "href=", 5) == 0) {
+              st += 5;
+              if (str2[st] == '"' || str2[st] == '\'') {
+                delim = str2[st];
+                ++st;
+              }
+              break;
+            }
+          }
+          // Find end of address.
+          for (end = st; end < k && str2[end] != delim; ++end) {
+            // All the work is done in the loop construct above.
+          }
+
+          // If there is an address, save it. If there was already one saved,
+          // kill it.
+          if (st < k) {
+            char *tmp;
+            g_free(href);
+            tmp = g_strndup(str2 + st, end - st);
+            href = purple_unescape_html(tmp);
+            g_free(tmp);
+            href_st = j;
+          }
+        }
+
+        // Replace </a> with an ascii representation of the address the link was
+        // pointing to.
+        else if (href != nullptr &&
+          g_ascii_strncasecmp(str2 + i, "</a>", 4) == 0) {
+          std::size_t hrlen = std::strlen(href);
+
+          // Only insert the href if it is different from the CDATA.
+          // 7 == strlen("http://").
+          if ((hrlen != (unsigned)(j - href_st) ||
+                std::strncmp(str2 + href_st, href, hrlen)) != 0 &&
+            (hrlen != (unsigned)(j - href_st + 7) ||
+                std::strncmp(str2 + href_st, href + 7, hrlen - 7) != 0)) {
+            str2[j++] = ' ';
+            str2[j++] = '(';
+            g_memmove(str2 + j, href, hrlen);
+            j += hrlen;
+            str2[j++] = ')';
+            g_free(href);
+            href = nullptr;
+          }
+        }
+
+        // Check for tags which should be mapped to newline (but ignore some of
+        // the tags at the beginning of the text).
+        else if ((j != 0 && (g_ascii_strncasecmp(str2 + i, "<p>", 3) == 0 ||
+                              g_ascii_strncasecmp(str2 + i, "<tr", 3) == 0 ||
+                              g_ascii_strncasecmp(str2 + i, "<hr", 3) == 0 ||
+                              g_ascii_strncasecmp(str2 + i, "<li", 3) == 0 ||
+                              g_ascii_strncasecmp(str2 + i, "<div", 4) == 0)) ||
+          g_ascii_strncasecmp(str2 + i, "<br", 3) == 0 ||
+          g_ascii_strncasecmp(str2 + i, "</table>", 8) == 0)
+          str2[j++] = '\n';
+        else if (g_ascii_strncasecmp(str2 + i, "<script", 7) == 0)
+          cdata_close_tag = "</script>";
+        else if (g_ascii_strncasecmp(str2 + i, "<style", 6) == 0)
+          cdata_close_tag = "</style>";
+        // Update the index and continue checking after the tag.
+        i = (str2[k] == '<' || str2[k] == '\0') ? k - 1 : k;
+        continue;
+      }
+    }
+    else if (cdata_close_tag)
+      continue;
+    else if (!g_ascii_isspace(str2[i]))
+      visible = true;
+
+    if (str2[i] == '&' &&
+      (ent = purple_markup_unescape_entity(str2 + i, &entlen))) {
+      while (*ent != '\0')
+        str2[j++] = *ent++;
+      i += entlen - 1;
+      continue;
+    }
+
+    if (visible)
+      str2[j++] = g_ascii_isspace(str2[i]) && str[i] != '\t' ? ' ' : str2[i];
+  }
+
+  g_free(href);
+
+  str2[j] = '\0';
+
+  return str2;
+}
+
+// Checks that Utils::stripHTML() produces the same output as the original
+// implementation for every sample message. Returns false on a mismatch.
+bool checkStripHTML()
+{
+  bool res = true;
+  std::vector<char> buf;
+  for (const char *message : messages) {
+    char *expected = oldStripHTML(message);
+    buf.resize(std::strlen(message) + 1);
+    Utils::stripHTML(message, buf.data());
+    if (std::strcmp(expected, buf.data()) != 0) {
+      std::printf("stripHTML mismatch:\n  input:    '%s'\n  expected: '%s'\n"
+                  "  result:   '%s'\n",
+        message, expected, buf.data());
+      res = false;
+    }
+    g_free(expected);
+  }
+  return res;
+}
+
+// Prints the measured time. The output size is printed too, it keeps the
+// results used and shows whether the compared functions produce output of
+// the same size.
+void report(const char *name, gint64 start, gint64 end, std::size_t count,
+  std::size_t output_size)
+{
+  std::printf("%-30s %10.1f ms %10.1f ns/op %12zu B\n", name,
+    (end - start) / 1000.0, (end - start) * 1000.0 / count, output_size);
+}
+
+// Compares the original stripHTML() with Utils::stripHTML() that writes into
+// a reused buffer, as done when loading conversation history.
+void benchmarkStripHTML()
+{
+  std::size_t count = 0;
+  std::size_t size = 0;
+  gint64 start = g_get_monotonic_time();
+  for (int i = 0; i < ITERATIONS; ++i)
+    for (const char *message : messages) {
+      char *res = oldStripHTML(message);
+      size += std::strlen(res);
+      g_free(res);
+      ++count;
+    }
+  gint64 end = g_get_monotonic_time();
+  report("stripHTML (original)", start, end, count, size);
+
+  size = 0;
+  std::vector<char> buf;
+  start = g_get_monotonic_time();
+  for (int i = 0; i < ITERATIONS; ++i)
+    for (const char *message : messages) {
+      buf.resize(std::max(buf.size(), std::strlen(message) + 1));
+      size += Utils::stripHTML(message, buf.data());
+    }
+  end = g_get_monotonic_time();
+  report("Utils::stripHTML", start, end, count, size);
+}
+
+// Original time formatting from Conversation::extractTime().
+void oldFormatTime(time_t t, char *buf, std::size_t size)
+{
+  // Convert to local time, note that localtime_r() should not really fail.
+  struct tm t_local;
+  if (localtime_r(&t, &t_local) == nullptr)
+    std::memset(&t_local, 0, sizeof(t_local));
+
+  char *res = g_strdup(purple_date_format_long(&t_local));
+  g_strlcpy(buf, res, size);
+  g_free(res);
+}
+
+// Compares the original time formatting with Utils::TimeFormatter on a
+// sequence of times as they appear in a conversation log, one message every
+// few seconds.
+void benchmarkFormatTime()
+{
+  const time_t first = 1451606400; // 2016-01-01 00:00:00 UTC
+  const int step = 7;
+  const std::size_t count = ITERATIONS * 10;
+  char buf[128];
+
+  std::size_t size = 0;
+  gint64 start = g_get_monotonic_time();
+  for (std::size_t i = 0; i < count; ++i) {
+    oldFormatTime(first + i * step, buf, sizeof(buf));
+    size += std::strlen(buf);
+  }
+  gint64 end = g_get_monotonic_time();
+  report("formatTime (original)", start, end, count, size);
+
+  size = 0;
+  Utils::TimeFormatter formatter;
+  start = g_get_monotonic_time();
+  for (std::size_t i = 0; i < count; ++i) {
+    formatter.format(first + i * step, buf, sizeof(buf));
+    size += std::strlen(buf);
+  }
+  end = g_get_monotonic_time();
+  report("Utils::TimeFormatter", start, end, count, size);
+}
+
+} // anonymous namespace
+
+int main()
+{
+  if (!checkStripHTML())
+    return 1;
+
+  benchmarkStripHTML();
+  benchmarkFormatTime();
+  return 0;
+}
+
+// vim: set tabstop=2 shiftwidth=2 textwidth=80 expandtab
@@ -0,0 +1,146 @@
+#include <cppconsui/ColorScheme.h>
+#include <cppconsui/KeyConfig.h>
+#include <cppconsui/Label.h>
+#include <cppconsui/ListView.h>
+#include <cppconsui/Window.h>
+
+#include <cstdio>
+
+// TestModel class
+class TestModel : public CppConsUI::ListModel {
+public:
+  TestModel() : rows_(100000) {}
+  virtual ~TestModel() override {}
+
+  virtual std::size_t getRowCount() const override { return rows_; }
+  virtual const char *getRowText(std::size_t row) const override;
+  virtual int getRowColor(std::size_t row) const override
+  {
+    return row % 3 + 1;
+  }
+
+  void addRows(std::size_t count);
+  void removeRows(std::size_t count);
+
+private:
+  std::size_t rows_;
+  mutable char text_[64];
+
+  CONSUI_DISABLE_COPY(TestModel);
+};
+
+const char *TestModel::getRowText(std::size_t row) const
+{
+  // Rows are generated on demand, nothing is stored per row.
+  std::snprintf(text_, sizeof(text_), "Row %zu of %zu", row + 1, rows_);
+  return text_;
+}
+
+void TestModel::addRows(std::size_t count)
+{
+  std::size_t first = rows_;
+  rows_ += count;
+  signal_rows_inserted(first, count);
+  signal_rows_changed(0, first);
+}
+
+void TestModel::removeRows(std::size_t count)
+{
+  if (count > rows_)
+    count = rows_;
+  rows_ -= count;
+  signal_rows_removed(rows_, count);
+  signal_rows_changed(0, rows_);
+}
+
+// TestWindow class
+class TestWindow : public CppConsUI::Window {
+public:
+  TestWindow();
+  virtual ~TestWindow() override;
+
+protected:
+  const int SCHEME_LISTVIEWWINDOW = 1;
+  TestModel *model;
+  CppConsUI::ListView *listview;
+  CppConsUI::Label *label;
+
+private:
+  void onActivate(CppConsUI::ListView &activator, std::size_t row);
+
+  void actionAddRows();
+  void actionRemoveRows();
+
+  CONSUI_DISABLE_COPY(TestWindow);
+};
+
+TestWindow::TestWindow() : CppConsUI::Window(0, 0, AUTOSIZE, AUTOSIZE)
+{
+  setClosable(false);
+  setColorScheme(SCHEME_LISTVIEWWINDOW);
+
+  addWidget(*(new CppConsUI::Label(
+              "Press F1 to add rows, F2 to remove rows, F10 to quit.")),
+    1, 1);
+  label = new CppConsUI::Label(AUTOSIZE, 1, "");
+  addWidget(*label, 1, 2);
+
+  model = new TestModel;
+  listview = new CppConsUI::ListView(AUTOSIZE, AUTOSIZE, model);
+  listview->signal_activate.connect(
+    sigc::mem_fun(this, &TestWindow::onActivate));
+  addWidget(*listview, 1, 4);
+
+  COLORSCHEME->setAttributesExt(SCHEME_LISTVIEWWINDOW,
+    CppConsUI::ColorScheme::PROPERTY_LISTVIEW_TEXT, 1,
+    CppConsUI::Curses::Color::RED, CppConsUI::Curses::Color::BLACK);
+  COLORSCHEME->setAttributesExt(SCHEME_LISTVIEWWINDOW,
+    CppConsUI::ColorScheme::PROPERTY_LISTVIEW_TEXT, 2,
+    CppConsUI::Curses::Color::GREEN, CppConsUI::Curses::Color::BLACK);
+  COLORSCHEME->setAttributesExt(SCHEME_LISTVIEWWINDOW,
+    CppConsUI::ColorScheme::PROPERTY_LISTVIEW_TEXT, 3,
+    CppConsUI::Curses::Color::YELLOW, CppConsUI::Curses::Color::BLACK);
+
+  declareBindable("listviewwindow", "add-rows",
+    sigc::mem_fun(this, &TestWindow::actionAddRows),
+    InputProcessor::BINDABLE_NORMAL);
+  declareBindable("listviewwindow", "remove-rows",
+    sigc::mem_fun(this, &TestWindow::actionRemoveRows),
+    InputProcessor::BINDABLE_NORMAL);
+}
+
+TestWindow::~TestWindow()
+{
+  listview->setModel(nullptr);
+  delete model;
+}
+
+void TestWindow::onActivate(
+  CppConsUI::ListView & /*activator*/, std::size_t row)
+{
+  char text[64];
+  std::snprintf(text, sizeof(text), "Activated row %zu.", row + 1);
+  label->setText(text);
+}
+
+void TestWindow::actionAddRows()
+{
+  model->addRows(1000);
+}
+
+void TestWindow::actionRemoveRows()
+{
+  model->removeRows(1000);
+}
+
+void setupTest()
+{
+  KEYCONFIG->bindKey("listviewwindow", "add-rows", "F1");
+  KEYCONFIG->bindKey("listviewwindow", "remove-rows", "F2");
+
+  // Create the main window.
+  auto win = new TestWindow;
+  win->show();
+}
+
+// vim: set tabstop=2 shiftwidth=2 textwidth=80 expandtab